@@ -3,6 +3,7 @@
 #include <cstring>
 #include <fstream>
 #include <atomic>
+#include <functional>
 #include <ciso646>
 #include <VMUtils/nonnull.hpp>
 #include <varch/utils/common.hpp>
@@ -13,6 +14,46 @@ struct ArchiverImpl;
 
 VM_EXPORT
 {
+	enum class Quantize : uint32_t
+	{
+		None = 0,
+		Window,	  /* linear map of a window to [0, 255] */
+		Equalize  /* histogram equalization */
+	};
+
+	/* uint16 input is mapped to 8 bits just before bricking, using a
+	   histogram of regions sampled across the whole volume, so that
+	   archives of disjoint slice ranges map identically */
+	struct QuantizeOptions
+	{
+		VM_DEFINE_ATTRIBUTE( Quantize, mode ) = Quantize::None;
+		/* window [window_lo, window_hi] of Window, the percentiles clip_percent
+		   and 100 - clip_percent of the histogram when window_lo >= window_hi */
+		VM_DEFINE_ATTRIBUTE( uint32_t, window_lo ) = 0;
+		VM_DEFINE_ATTRIBUTE( uint32_t, window_hi ) = 0;
+		VM_DEFINE_ATTRIBUTE( double, clip_percent ) = 0.5;
+		/* sampled regions of 32^3 voxels */
+		VM_DEFINE_ATTRIBUTE( uint32_t, samples ) = 512;
+	};
+
+	/* reported after every stride, octree cell or sparse batch */
+	struct ArchiveProgress
+	{
+		/* grid blocks handled of blocks_total, 0 for sparse volumes */
+		VM_DEFINE_ATTRIBUTE( size_t, blocks_done );
+		VM_DEFINE_ATTRIBUTE( size_t, blocks_total );
+		/* input read and body written so far */
+		VM_DEFINE_ATTRIBUTE( uint64_t, bytes_in );
+		VM_DEFINE_ATTRIBUTE( uint64_t, bytes_out );
+		/* input MB/s and estimated seconds left */
+		VM_DEFINE_ATTRIBUTE( double, throughput );
+		VM_DEFINE_ATTRIBUTE( double, eta );
+		/* block slices [slice_begin, slices_done) are complete */
+		VM_DEFINE_ATTRIBUTE( size_t, slices_done );
+	};
+
+	using ProgressCallback = std::function<void( ArchiveProgress const &progress )>;
+
 	struct ArchiverOptions
 	{
 		VM_DEFINE_ATTRIBUTE( size_t, x );
@@ -23,14 +64,85 @@ VM_EXPORT
 		VM_DEFINE_ATTRIBUTE( string, input );
 		VM_DEFINE_ATTRIBUTE( string, output );
 		VM_DEFINE_ATTRIBUTE( EncodeOptions, compress_opts );
+		/* Label32 reads the input as uint32 labels and stores them losslessly */
+		VM_DEFINE_ATTRIBUTE( EncodeMethod, encode_method ) = EncodeMethod::H264;
+		/* voxels of the input interleave this many channels, each archived
+		   as its own set of blocks in a single read pass */
+		VM_DEFINE_ATTRIBUTE( size_t, channels ) = 1;
+		/* h264 blocks whose maximum absolute voxel error exceeds max_error
+		   are stored losslessly instead, -1 skips the verification */
+		VM_DEFINE_ATTRIBUTE( int, max_error ) = -1;
+		/* also store the residual of every lossy h264 block, so that
+		   unarchivers with DecodeOptions::refine decode exact values */
+		VM_DEFINE_ATTRIBUTE( bool, residual ) = false;
+		/* input voxels are uint16 when quantize.mode is not None */
+		VM_DEFINE_ATTRIBUTE( QuantizeOptions, quantize );
+		/* physical value of each 8-bit code of an input that is already
+		   quantized, stored as is, quantize sets its own */
+		VM_DEFINE_ATTRIBUTE( vector<float>, transfer );
 		VM_DEFINE_ATTRIBUTE( size_t, suggest_mem_gb ) = 128;
+		/* z-planes of each region are read from the input file concurrently
+		   through this many independent handles */
+		VM_DEFINE_ATTRIBUTE( size_t, io_threads ) = 1;
+		/* archive block slices [slice_begin, slice_end) only, so that disjoint
+		   z-slabs can be archived by independent processes and merged later */
+		VM_DEFINE_ATTRIBUTE( size_t, slice_begin ) = 0;
+		VM_DEFINE_ATTRIBUTE( size_t, slice_end ) = size_t( -1 );
+		/* adaptive bricking: octree nodes of up to 2^max_block_level blocks per
+		   axis whose value range is within homogeneity are stored as a single
+		   downsampled block, 0 keeps the fixed block size */
+		VM_DEFINE_ATTRIBUTE( size_t, max_block_level ) = 0;
+		VM_DEFINE_ATTRIBUTE( size_t, homogeneity ) = 0;
+		/* min, max and mean of every block, stored beside the index so that
+		   readers can skip blocks without decoding them */
+		VM_DEFINE_ATTRIBUTE( bool, block_stats ) = true;
+		/* bins of a coarse per block histogram over the 8 bit codes, at most
+		   256, 0 for none, not supported for label volumes */
+		VM_DEFINE_ATTRIBUTE( unsigned, histogram_bins ) = 0;
+		/* the longest side of the preview volume stored in the footer, a
+		   subsampling of raw readable without decoding, 0 for none. there
+		   is none either if raw is no larger, it would be a copy of raw */
+		VM_DEFINE_ATTRIBUTE( uint32_t, preview_size ) = 128;
+		/* h264 frames are padded so that each starts at a multiple of this
+		   many bytes in the file, e.g. 4096 for direct reads, 0 packs them
+		   back to back. a power of two, label volumes ignore it */
+		VM_DEFINE_ATTRIBUTE( uint32_t, frame_alignment ) = 0;
+		/* called on the converting thread */
+		VM_DEFINE_ATTRIBUTE( ProgressCallback, on_progress );
 	};
 
+	/* yields the next occupied brick of a sparse source and returns true,
+	   or returns false when exhausted. a brick holds block_size^3 voxels
+	   including padding with channels interleaved, and its reader is kept
+	   until the brick is encoded */
+	using BrickIterator = std::function<bool( Idx &idx, vm::Arc<Reader> &brick )>;
+
+	/* reads voxels [start, start + size) of the raw volume into dst in x-major
+	   order with channels interleaved, the region always lies within raw */
+	using RegionSource = std::function<void( Idx const &start, Idx const &size, unsigned char *dst )>;
+
 	struct Archiver final : vm::NoCopy
 	{
 		Archiver( ArchiverOptions const &opts );
+		/* the constructors below ignore opts.input and opts.output,
+		   output is written at [0, ...) and must be seekable */
+		/* input holds the raw volume in x-major order */
+		Archiver( ArchiverOptions const &opts, Reader &input, Writer &output );
+		Archiver( ArchiverOptions const &opts, RegionSource const &input, Writer &output );
+		/* for convert_sparse, which takes its bricks from an iterator */
+		Archiver( ArchiverOptions const &opts, Writer &output );
 		~Archiver();
 		bool convert();
+		/* archive only the bricks yielded by the iterator, the rest of
+		   the grid is marked as empty in the index */
+		bool convert_sparse( BrickIterator const &bricks );
+		/* may be called from any thread, the conversion stops at the next
+		   stride, cell or batch boundary and returns false. the archive is
+		   still finished and holds the complete block slices [slice_begin,
+		   slices_done) of the last progress, so that the conversion can be
+		   resumed from slices_done and merged. sparse archives keep every
+		   brick encoded so far */
+		void cancel();
 
 	private:
 		vm::Box<ArchiverImpl> _;
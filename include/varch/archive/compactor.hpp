@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <VMUtils/nonnull.hpp>
+#include <varch/utils/common.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+struct CompactorImpl;
+
+VM_EXPORT
+{
+	struct CompactorOptions
+	{
+		VM_DEFINE_ATTRIBUTE( string, input );
+		VM_DEFINE_ATTRIBUTE( string, output );
+	};
+
+	/* copies only the frames referenced by the index of an updated archive
+	   into a new archive, dropping replaced frames and old footers */
+	struct Compactor final : vm::NoCopy
+	{
+		Compactor( CompactorOptions const &opts );
+		~Compactor();
+		bool compact();
+
+	private:
+		vm::Box<CompactorImpl> _;
+	};
+}
+
+VM_END_MODULE()
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <VMUtils/nonnull.hpp>
+#include <varch/utils/common.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+struct MergerImpl;
+
+VM_EXPORT
+{
+	struct MergerOptions
+	{
+		/* partial archives produced with disjoint slice ranges */
+		VM_DEFINE_ATTRIBUTE( vector<string>, inputs );
+		VM_DEFINE_ATTRIBUTE( string, output );
+		/* write a manifest of the header and index only, which keeps the
+		   inputs as its shards instead of copying their frames, see
+		   ShardedReader */
+		VM_DEFINE_ATTRIBUTE( bool, manifest ) = false;
+	};
+
+	/* concatenates the bodies of partial archives and rewrites their
+	   frame_offset and block_idx into a single archive, without re-encoding */
+	struct Merger final : vm::NoCopy
+	{
+		Merger( MergerOptions const &opts );
+		~Merger();
+		bool merge();
+
+	private:
+		vm::Box<MergerImpl> _;
+	};
+}
+
+VM_END_MODULE()
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <VMUtils/nonnull.hpp>
+#include <varch/archive/archiver.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+struct TranscoderImpl;
+
+VM_EXPORT
+{
+	struct TranscoderOptions
+	{
+		VM_DEFINE_ATTRIBUTE( string, input );
+		VM_DEFINE_ATTRIBUTE( string, output );
+		/* geometry and encoding of the new archive, the volume size, channels
+		   and encode method are taken from the input archive */
+		VM_DEFINE_ATTRIBUTE( ArchiverOptions, archive_opts );
+		/* refine decodes exact voxels from archives with residuals */
+		VM_DEFINE_ATTRIBUTE( DecodeOptions, decode_opts );
+	};
+
+	/* rearchives an archive with a new block geometry or encoding, without
+	   the original raw. blocks are decoded one z-layer of the input grid at
+	   a time, the next layer in parallel with encoding, so at most a few
+	   layers are held in memory besides the archiver's own buffers */
+	struct Transcoder final : vm::NoCopy
+	{
+		Transcoder( TranscoderOptions const &opts );
+		~Transcoder();
+		bool transcode();
+
+	private:
+		vm::Box<TranscoderImpl> _;
+	};
+}
+
+VM_END_MODULE()
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <VMUtils/nonnull.hpp>
+#include <varch/archive/archiver.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+struct UpdaterImpl;
+
+VM_EXPORT
+{
+	struct UpdaterOptions
+	{
+		/* the archive to update in place */
+		VM_DEFINE_ATTRIBUTE( string, archive );
+		/* encoding of the updated blocks, the geometry is taken from the
+		   archive and compress_opts must give the archive's frame size */
+		VM_DEFINE_ATTRIBUTE( ArchiverOptions, archive_opts );
+	};
+
+	/* re-encodes the blocks overlapping a modified region, including those
+	   whose padding overlaps it, and appends their frames and a new footer
+	   to the archive. the replaced frames and the old footer are left as
+	   garbage until the archive is compacted */
+	struct Updater final : vm::NoCopy
+	{
+		Updater( UpdaterOptions const &opts );
+		~Updater();
+		/* src holds voxels [start, start + size) of the raw volume in x-major
+		   order with channels interleaved, the region must lie within raw */
+		bool update( Idx const &start, Idx const &size, unsigned char const *src );
+
+	private:
+		vm::Box<UpdaterImpl> _;
+	};
+}
+
+VM_END_MODULE()
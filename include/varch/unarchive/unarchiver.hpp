@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <VMUtils/nonnull.hpp>
 #include <cudafx/memory.hpp>
 #include <varch/utils/common.hpp>
@@ -10,27 +11,35 @@ struct UnarchiverImpl;
 
 struct UnarchiverData
 {
-	UnarchiverData( Reader &reader ) :
+	/* unarchivers look blocks up in the block table of v7 archives in place,
+	   lazy_index avoids building the in-memory index and leaves the large
+	   sections of v14 footers unread until first used */
+	UnarchiverData( Reader &reader, bool lazy_index = false ) :
 	  content( reader, sizeof( Header ), reader.size() - sizeof( Header ) )
 	{
 		reader.seek( 0 );
 		reader.read_typed( header );
+		header.upgrade();
 		vm::println( "header: {}", header );
+		if ( header.version > archive_version ) {
+			throw std::runtime_error( vm::fmt( "unsupported archive version: {} > {}",
+											   header.version, archive_version ) );
+		}
+		if ( header.sharded ) {
+			throw std::runtime_error( "the archive is a manifest, open it through ShardedReader" );
+		}
+		if ( header.codec > FrameCodec::Palette || header.packing > FramePacking::Block ) {
+			throw std::runtime_error( vm::fmt( "unsupported frame codec {} with packing {}",
+											   int( header.codec ), int( header.packing ) ) );
+		}
 
-		uint64_t meta_offset;
-		content.seek( content.size() - sizeof( meta_offset ) );
-		content.read_typed( meta_offset );
-		content.seek( meta_offset );
-		content.read_typed( frame_offset );
-		content.read_typed( block_idx );
-		content.seek( 0 );
+		footer.read_from( content, header.version, lazy_index );
 	}
 
 public:
 	Header header;
 	PartReader content;
-	vector<uint64_t> frame_offset;
-	map<Idx, BlockIndex> block_idx;
+	Footer footer;
 };
 
 VM_EXPORT
@@ -59,6 +68,28 @@ VM_EXPORT
 		unsigned inner_offset;
 	};
 
+	/* frames [ first_frame, last_frame ] at body bytes [ offset, offset + length ) */
+	struct FrameRange
+	{
+		uint32_t first_frame, last_frame;
+		uint64_t offset, length;
+	};
+
+	/* what decoding the voxel box [ start, start + size ) of a channel
+	   takes, see Unarchiver::plan_region */
+	struct RegionPlan
+	{
+		Idx start, size;
+		uint32_t channel = 0;
+		/* grid blocks whose inner voxels cover the box, in decode order */
+		std::vector<Idx> blocks;
+		/* frames to read, coalesced into disjoint byte ranges in file order */
+		std::vector<FrameRange> ranges;
+		uint64_t read_bytes = 0;
+		/* estimated decode cost, frames decoded and bytes they decode to */
+		uint64_t decoded_frames = 0, decoded_bytes = 0;
+	};
+
 	struct Unarchiver final : vm::NoCopy, vm::NoMove
 	{
 		Unarchiver( Reader &reader, DecodeOptions const &opts = {} );
@@ -67,6 +98,50 @@ VM_EXPORT
 	public:
 		std::size_t unarchive_to( Idx const &idx,
 								  cufx::MemoryView1D<unsigned char> const &dst );
+		/* a single channel of a multi-channel archive, channel 0 above */
+		std::size_t unarchive_to( Idx const &idx, uint32_t channel,
+								  cufx::MemoryView1D<unsigned char> const &dst );
+		/* all channels interleaved per voxel like the raw input,
+		   dst holds block_size^3 * channels * voxel_size bytes */
+		std::size_t unarchive_interleaved_to( Idx const &idx,
+											  cufx::MemoryView1D<unsigned char> const &dst );
+		/* empty blocks were absent from a sparse source and decode to zeros */
+		bool is_empty( Idx const &idx ) const;
+		/* adaptive archives store homogeneous regions as one block covering
+		   2^level grid blocks per axis, unarchive_to resamples it for any idx */
+		Idx resolve( Idx const &idx ) const;
+		unsigned block_level( Idx const &idx ) const;
+		/* statistics of the stored values of the block covering idx, see
+		   BlockStats, read from the index without decoding, false for
+		   archives without statistics */
+		bool block_stats( Idx const &idx, BlockStats &stats, uint32_t channel = 0 ) const;
+		/* grid blocks whose stored values may lie within [lo, hi], all other
+		   blocks have none, e.g. empty space for a transfer function */
+		std::vector<Idx> blocks_in_range( uint32_t lo, uint32_t hi, uint32_t channel = 0 ) const;
+		/* the preview volume of a channel, preview_dim() voxels of
+		   voxel_size() bytes in x-major order subsampling raw by
+		   preview_scale(), read in one piece without decoding anything,
+		   false for archives without */
+		bool preview( std::vector<unsigned char> &dst, uint32_t channel = 0 ) const;
+		/* decodes blocks of a channel in frame order so that every frame is
+		   decoded at most once, consumer gets each block as block_size^3 *
+		   voxel_size host bytes valid until it returns, in unspecified order */
+		void batch_unarchive( std::vector<Idx> const &blocks, uint32_t channel,
+							  std::function<void( Idx const &idx, unsigned char const *block )> const &consumer );
+		/* the blocks covering a voxel box within raw and the frames they
+		   need, voxel v lies in the inner voxels of block v / block_inner()
+		   at block voxel v % block_inner() + padding(), read from the index
+		   without decoding */
+		RegionPlan plan_region( Idx const &start, Idx const &size, uint32_t channel = 0 ) const;
+		/* decodes every block of a plan like batch_unarchive, i.e. each
+		   frame of the box is read and decoded once, reading each of
+		   plan.ranges in one piece and taking all frames from them. the
+		   consumer can not decode blocks outside the plan */
+		void unarchive_region( RegionPlan const &plan,
+							   std::function<void( Idx const &idx, unsigned char const *block )> const &consumer );
+		/* frames whose bytes do not match their stored crc32c, empty for
+		   archives written without checksums */
+		std::vector<uint32_t> corrupted_frames();
 		// // block_idx ->
 		// void batch_unarchive( std::vector<Idx> const &blocks,
 		// 					  std::function<void( Idx const &idx, VoxelStreamPacket const & )> const &consumer );
@@ -91,6 +166,26 @@ VM_EXPORT
 		auto block_inner() const { return data.header.block_inner; }
 		auto padding() const { return data.header.padding; }
 		auto frame_size() const { return data.header.frame_size; }
+		auto encode_method() const { return data.header.encode_method; }
+		auto codec() const { return data.header.codec; }
+		auto packing() const { return data.header.packing; }
+		auto frame_width() const { return data.header.frame_width; }
+		auto frame_height() const { return data.header.frame_height; }
+		/* bytes per voxel of a decoded block, 4 for label archives */
+		auto voxel_size() const { return data.header.voxel_size(); }
+		auto channels() const { return data.footer.channels(); }
+		/* whether DecodeOptions::refine can decode exact values */
+		auto has_residuals() const { return data.footer.has_residuals(); }
+		/* physical value of each decoded 8-bit code, empty unless quantized */
+		auto &transfer() const { return data.footer.transfer; }
+		auto has_checksums() const { return data.footer.has_checksums(); }
+		auto has_block_stats() const { return data.footer.has_stats(); }
+		/* files holding the frames of a manifest opened by ShardedReader */
+		auto &shards() const { return data.footer.shards; }
+		auto histogram_bins() const { return data.footer.histogram_bins; }
+		auto has_preview() const { return data.footer.has_preview(); }
+		auto preview_dim() const { return data.footer.preview_dim; }
+		auto preview_scale() const { return data.footer.preview_scale; }
 
 	private:
 		UnarchiverData data;
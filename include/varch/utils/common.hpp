@@ -6,6 +6,7 @@
 #include <VMUtils/modules.hpp>
 #include <cudafx/memory.hpp>
 #include "io.hpp"
+#include "varint.hpp"
 
 VM_BEGIN_MODULE( vol )
 
@@ -42,18 +43,63 @@ VM_EXPORT
 		VM_DEFINE_ATTRIBUTE( unsigned, width ) = 1024;
 		VM_DEFINE_ATTRIBUTE( unsigned, height ) = 1024;
 		VM_DEFINE_ATTRIBUTE( unsigned, batch_frames ) = 64;
+		/* cpu worker threads of the palette codec, 0 for hardware concurrency */
+		VM_DEFINE_ATTRIBUTE( unsigned, threads ) = 0;
 	};
 	struct DecodeOptions
 	{
 		VM_DEFINE_ATTRIBUTE( ComputeDevice, device ) = ComputeDevice::Default;
 		VM_DEFINE_ATTRIBUTE( unsigned, io_queue_size ) = 4;
+		/* adds the stored residual to h264 blocks, giving exact values */
+		VM_DEFINE_ATTRIBUTE( bool, refine ) = false;
+		/* checks every frame against its stored crc32c before its first
+		   decode, corrupted frames throw instead of reaching the decoder */
+		VM_DEFINE_ATTRIBUTE( bool, verify_checksums ) = false;
+	};
+
+	enum class EncodeMethod : uint32_t
+	{
+		H264 = 0, /* 8 bit scalar volumes */
+		Label32	  /* uint32 segmentation labels, lossless block-local palette */
+	};
+
+	/* the codec of the frames in the archive body, decoders are chosen by it */
+	enum class FrameCodec : uint8_t
+	{
+		H264 = 0,
+		Palette /* one palette chunk per frame, see PaletteMode */
+	};
+
+	/* how block voxels are laid out in the frames */
+	enum class FramePacking : uint8_t
+	{
+		/* voxels fill the luma then the interleaved chroma plane of
+		   frame_width x frame_height frames, blocks span frame boundaries */
+		Nv12 = 0,
+		Block /* a frame per block */
+	};
+
+	enum class BlockCodec : uint8_t
+	{
+		H264 = 0,
+		Empty,	/* not present in the source, decodes to zeros */
+		Palette, /* lossless, label blocks and h264 blocks over the error bound */
+		/* grid positions without a block of their own in the dense block
+		   table of v7 footers, never part of an in-memory index */
+		Absent = 0xff
 	};
 
 	struct BlockIndex
 	{
 		VM_DEFINE_ATTRIBUTE( uint32_t, first_frame );
 		VM_DEFINE_ATTRIBUTE( uint32_t, last_frame );
-		VM_DEFINE_ATTRIBUTE( uint64_t, offset );
+		/* offset < frame_size, the upper half of what used to be a 64 bit
+		   offset holds per-block fields, which read as zero in v0 archives */
+		VM_DEFINE_ATTRIBUTE( uint32_t, offset );
+		VM_DEFINE_ATTRIBUTE( BlockCodec, codec ) = BlockCodec::H264;
+		/* octree level, the block covers 2^level blocks of the grid per axis */
+		VM_DEFINE_ATTRIBUTE( uint8_t, level ) = 0;
+		uint8_t reserved[ 2 ] = {};
 
 		bool operator<( BlockIndex const &other ) const
 		{
@@ -65,12 +111,39 @@ VM_EXPORT
 		{
 			return first_frame == other.first_frame &&
 				   last_frame == other.last_frame &&
-				   offset == other.offset;
+				   offset == other.offset &&
+				   codec == other.codec &&
+				   level == other.level;
 		}
 
 		friend ostream &operator<<( ostream &os, BlockIndex const &_ )
 		{
-			vm::fprint( os, "{{ f0: {}, f1: {}, offset:{} }}", _.first_frame, _.last_frame, _.offset );
+			vm::fprint( os, "{{ f0: {}, f1: {}, offset:{}, codec: {}, level: {} }}",
+						_.first_frame, _.last_frame, _.offset, int( _.codec ), int( _.level ) );
+			return os;
+		}
+	};
+
+	/* value statistics of a block as stored, i.e. 8 bit codes or labels,
+	   padding included, computed by the archiver while bricking */
+	struct BlockStats
+	{
+		VM_DEFINE_ATTRIBUTE( uint32_t, min ) = 0;
+		VM_DEFINE_ATTRIBUTE( uint32_t, max ) = 0;
+		VM_DEFINE_ATTRIBUTE( float, mean ) = 0;
+		/* voxels per bin of equal width over [ 0, 256 ), empty unless
+		   archived with ArchiverOptions::histogram_bins */
+		vector<uint32_t> histogram;
+
+		bool operator==( BlockStats const &other ) const
+		{
+			return min == other.min && max == other.max &&
+				   mean == other.mean && histogram == other.histogram;
+		}
+
+		friend ostream &operator<<( ostream &os, BlockStats const &_ )
+		{
+			vm::fprint( os, "{{ min: {}, max: {}, mean: {} }}", _.min, _.max, _.mean );
 			return os;
 		}
 	};
@@ -119,9 +192,27 @@ VM_EXPORT
 	};
 }
 
+/* bumped on every change of the archive format, readers refuse newer archives
+   1: BlockIndex::codec
+   2: BlockIndex::level, octree index of adaptive archives
+   3: Header::encode_method, label archives
+   4: Footer::channel_idx, multi-channel archives
+   5: Footer::residual_idx, h264 blocks refinable to exact values
+   6: Footer::transfer, quantized archives
+   7: dense block table replacing block_idx and channel_idx
+   8: Footer::frame_crc, frame checksums
+   9: Header::codec, packing and frame geometry
+   10: Footer::stats_idx, per block statistics
+   11: Header::sharded, manifests of frames stored in shard files
+   12: varint frame lengths and the compact block table
+   13: Footer::preview, embedded preview volume
+   14: footer sections and their directory, metadata added from now on
+	   gets a section of its own and leaves the version alone */
+constexpr uint64_t archive_version = 14;
+
 struct Header
 {
-	VM_DEFINE_ATTRIBUTE( uint64_t, version );
+	VM_DEFINE_ATTRIBUTE( uint64_t, version ) = archive_version;
 	VM_DEFINE_ATTRIBUTE( Idx, raw );
 	VM_DEFINE_ATTRIBUTE( Idx, dim );
 	VM_DEFINE_ATTRIBUTE( Idx, adjusted );
@@ -129,14 +220,47 @@ struct Header
 	VM_DEFINE_ATTRIBUTE( uint64_t, block_size );
 	VM_DEFINE_ATTRIBUTE( uint64_t, block_inner );
 	VM_DEFINE_ATTRIBUTE( uint64_t, padding );
-	VM_DEFINE_ATTRIBUTE( uint64_t, encode_method ) = 0;
-	VM_DEFINE_ATTRIBUTE( uint64_t, frame_size );
+	VM_DEFINE_ATTRIBUTE( EncodeMethod, encode_method ) = EncodeMethod::H264;
+	/* the upper halves of what used to be a 64 bit encode_method and
+	   frame_size, which read as zero in archives before v9 */
+	VM_DEFINE_ATTRIBUTE( FrameCodec, codec ) = FrameCodec::H264;
+	VM_DEFINE_ATTRIBUTE( FramePacking, packing ) = FramePacking::Nv12;
+	/* the file is a manifest, the frames lie in Footer::shards, see ShardedReader */
+	VM_DEFINE_ATTRIBUTE( bool, sharded ) = false;
+	/* h264 frames are padded to start at file offsets aligned to
+	   2^log_frame_alignment, see ArchiverOptions::frame_alignment, 0 if
+	   they are not and in older archives */
+	VM_DEFINE_ATTRIBUTE( uint8_t, log_frame_alignment ) = 0;
+	VM_DEFINE_ATTRIBUTE( uint32_t, frame_size );
+	/* 0 if unknown, frame_size is in bytes */
+	VM_DEFINE_ATTRIBUTE( uint16_t, frame_width ) = 0;
+	VM_DEFINE_ATTRIBUTE( uint16_t, frame_height ) = 0;
+
+	uint64_t voxel_size() const
+	{
+		return encode_method == EncodeMethod::Label32 ? sizeof( uint32_t ) : sizeof( char );
+	}
+
+	uint32_t frame_alignment() const
+	{
+		return log_frame_alignment ? 1u << log_frame_alignment : 0;
+	}
+
+	/* archives before v9 only know the encode method */
+	void upgrade()
+	{
+		if ( version < 9 && encode_method == EncodeMethod::Label32 ) {
+			codec = FrameCodec::Palette;
+			packing = FramePacking::Block;
+		}
+	}
 
 	friend std::ostream &operator<<( std::ostream &os, Header const &header )
 	{
 		vm::fprint( os, "version: {}\nraw: {}\ndim: {}\nadjusted: {}\n"
 						"log_block_size: {}\nblock_size: {}\nblock_inner: {}\n"
-						"padding: {}\nframe_size: {}",
+						"padding: {}\nencode_method: {}\ncodec: {}\npacking: {}\n"
+						"frame_size: {}\nframe_geometry: {}x{}\nframe_alignment: {}",
 					header.version,
 					header.raw,
 					header.dim,
@@ -145,11 +269,886 @@ struct Header
 					header.block_size,
 					header.block_inner,
 					header.padding,
-					header.frame_size );
+					int( header.encode_method ),
+					int( header.codec ),
+					int( header.packing ),
+					header.frame_size,
+					header.frame_width,
+					header.frame_height,
+					header.frame_alignment() );
 		return os;
 	}
 };
 
 #pragma pack( pop )
 
+/* an h264 frame is stored as u32 len, u8 packet[ len ], and may be followed
+   by filler up to the next frame_alignment boundary of the file, u32
+   frame_filler | n, u8 zero[ n ], which counts as part of the frame in
+   frame_offset and is skipped by decoders */
+constexpr uint32_t frame_filler = 0x80000000u;
+
+/* a palette block is stored as one frame holding the chunk
+
+	 u32 palette_size, voxel palette[ palette_size ] ascending, u8 mode
+
+   followed by one of
+	 Bitpack: u8 bits in { 0, 1, 2, 4, 8, 16, 32 },
+			  palette indices packed lsb first into u64 words
+	 Rle:     u32 nruns, varint run length - 1 and varint palette index per run */
+enum class PaletteMode : uint8_t
+{
+	Bitpack = 0,
+	Rle = 1
+};
+
+/* the metadata of v14 footers is split into tagged sections, readers
+   skip the sections they do not know unless flagged required_section */
+enum class SectionTag : uint32_t
+{
+	FrameLengths = 1,
+	BlockTable = 2,
+	Residuals = 3,
+	Transfer = 4,
+	Checksums = 5,
+	Stats = 6,
+	Shards = 7,
+	Preview = 8
+};
+
+constexpr uint32_t required_section = 1;
+
+/* an entry of the section directory, offset relative to meta_offset */
+struct Section
+{
+	SectionTag tag = SectionTag{};
+	uint32_t flags = 0;
+	uint64_t offset = 0, length = 0;
+};
+
+/* footer = frame_offset, block_idx, channel_idx (v4), residual_idx (v5),
+   transfer (v6), frame_crc (v8), stats table (v10), shards, shard_offset
+   and frame_shard (v11), preview_dim, preview_scale and preview (v13),
+   meta_offset
+   meta_offset is the last field of the body and locates the footer
+
+   from v14 the fields are stored as sections, absent ones left out,
+
+	 u8 sections[], Section directory[ nsections ], u32 nsections, u64 meta_offset
+
+   holding, in the encoding of earlier versions
+	 FrameLengths: frame_offset ( required )
+	 BlockTable:   block_idx and channel_idx ( required )
+	 Residuals:    residual_idx
+	 Transfer:     transfer
+	 Checksums:    frame_crc
+	 Stats:        the stats table
+	 Shards:       shards, shard_offset and frame_shard ( required )
+	 Preview:      preview_dim, preview_scale and preview
+
+   from v7 block_idx and channel_idx are stored as the dense block table
+
+	 Idx dim, u32 channels, BlockIndex entries[ channels ][ dim.total() ]
+
+   holding the entry of block idx of channel c at
+   c * dim.total() + idx.x + idx.y * dim.x + idx.z * dim.x * dim.y, and
+   BlockCodec::Absent for grid positions covered by a coarser octree node
+   or outside the slice range of a partial archive
+
+   from v12 frame_offset is stored as the varint lengths of the frames,
+   u64 nbytes, u8 lengths[ nbytes ], and the block table compactly as
+
+	 Idx dim, u32 channels, u64 frame_size, u64 block_bytes, u32 chunk_entries,
+	 u64 nchunks, u64 chunk_end[ nchunks ], u64 nbytes, u8 chunks[ nbytes ]
+
+   the grid positions of every channel are split into chunks of
+   chunk_entries, chunk k of channel c ends at chunk_end[ c * nchunks / channels + k ],
+   and each entry of a chunk is the varint tag codec | explicit << 2 | level << 3,
+   codec 3 standing for Absent, followed by the varints
+	 explicit: first_frame, last_frame, offset
+	 H264:     zigzag( first_frame * frame_size + offset - end ), with end
+			   the position + block_bytes of the previous h264 entry in the
+			   chunk or 0, last_frame implied by block_bytes
+	 Palette:  zigzag( first_frame - previous palette frame in the chunk - 1 ),
+			   the previous being -1 at the start of a chunk, with
+			   last_frame = first_frame and offset 0
+	 Empty, Absent: none, all fields 0
+
+   the stats table lays out the BlockStats of the same grid positions as
+
+	 u32 channels, u32 histogram_bins,
+	 { u32 min, u32 max, f32 mean, u32 histogram[ histogram_bins ] }
+	   entries[ channels ][ dim.total() ]
+
+   with channels = 0 for archives without statistics */
+struct Footer
+{
+	vector<uint64_t> frame_offset = { 0 };
+	/* index of channel 0, the only channel of single channel archives */
+	map<Idx, BlockIndex> block_idx;
+	/* index of channels 1.. */
+	vector<map<Idx, BlockIndex>> channel_idx;
+	/* one map per channel when archived with residuals, from an h264 block
+	   to the palette frame of its residual ( original - decoded ) mod 256,
+	   blocks decoded exactly have none */
+	vector<map<Idx, uint32_t>> residual_idx;
+	/* physical value of each decoded 8-bit code, empty unless quantized */
+	vector<float> transfer;
+	/* crc32c of the bytes of every frame, empty for archives without */
+	vector<uint32_t> frame_crc;
+	/* one map per channel keyed like the index, empty for archives without */
+	vector<map<Idx, BlockStats>> stats_idx;
+	uint32_t histogram_bins = 0;
+	/* empty unless sharded, frame f lies in shard frame_shard[ f ] at
+	   shard_offset of the shard plus the length of its earlier frames in it,
+	   relative shard paths are relative to the directory of the manifest */
+	vector<string> shards;
+	vector<uint64_t> shard_offset;
+	vector<uint32_t> frame_shard;
+	/* preview_dim voxels of the stored voxel size per channel, x-major,
+	   channels one after the other, voxel p holding the raw voxel nearest
+	   to the center of raw voxels [ p * preview_scale, ( p + 1 ) * preview_scale ),
+	   or the box filtered value stored for it by a homogeneous octree block
+	   of a higher level, zero where a sparse source has no block. empty for
+	   archives without */
+	Idx preview_dim = Idx{};
+	uint32_t preview_scale = 0;
+	vector<char> preview;
+	/* the block table of a v7 footer read with lazy_index, which is looked
+	   up in place until index() fills block_idx and channel_idx */
+	struct BlockTable
+	{
+		Reader *content = nullptr;
+		/* of the dense entries, or of the chunk stream of a compact table */
+		uint64_t offset = 0;
+		Idx dim;
+		uint32_t channels = 0;
+		/* 0 without a stats table */
+		uint64_t stats_offset = 0;
+		/* v12 compact table */
+		bool compact = false;
+		uint64_t frame_size = 0, block_bytes = 0;
+		uint32_t chunk_entries = 0;
+		vector<uint64_t> chunk_end;
+		/* the last chunk looked up */
+		mutable uint64_t cached_chunk = uint64_t( -1 );
+		mutable vector<BlockIndex> cached;
+		/* of the preview, which is read by read_preview */
+		uint64_t preview_offset = 0, preview_bytes = 0;
+		/* v14 sections left in content until first used, offsets absolute,
+		   see read_section */
+		Section residuals, checksums;
+	} table;
+
+public:
+	uint32_t frame_count() const { return frame_offset.size() - 1; }
+	uint32_t channels() const { return table.content ? table.channels : 1 + channel_idx.size(); }
+	bool has_residuals() const { return not residual_idx.empty() || table.residuals.length; }
+	bool has_checksums() const { return not frame_crc.empty() || table.checksums.length; }
+	bool has_stats() const { return table.content ? table.stats_offset != 0 : not stats_idx.empty(); }
+	uint64_t stats_entry_size() const { return 3 * sizeof( uint32_t ) + histogram_bins * sizeof( uint32_t ); }
+	bool has_preview() const { return preview_scale != 0; }
+	uint64_t preview_channel_bytes() const
+	{
+		return ( table.content ? table.preview_bytes : preview.size() ) / channels();
+	}
+
+	/* residual_idx and frame_crc, read on first use */
+	vector<map<Idx, uint32_t>> &residuals()
+	{
+		if ( table.residuals.length ) {
+			parse_residuals( read_section( *table.content, table.residuals ) );
+			table.residuals = Section{};
+		}
+		return residual_idx;
+	}
+	vector<uint32_t> &checksums()
+	{
+		if ( table.checksums.length ) {
+			parse_checksums( read_section( *table.content, table.checksums ) );
+			table.checksums = Section{};
+		}
+		return frame_crc;
+	}
+
+	map<Idx, BlockIndex> &index( uint32_t channel )
+	{
+		load_index();
+		return channel ? channel_idx[ channel - 1 ] : block_idx;
+	}
+	map<Idx, BlockIndex> const &index( uint32_t channel ) const
+	{
+		if ( table.content ) {
+			throw std::logic_error( "block index not loaded" );
+		}
+		return channel ? channel_idx[ channel - 1 ] : block_idx;
+	}
+
+	/* a single table entry or map lookup */
+	bool find( uint32_t channel, Idx const &idx, BlockIndex &entry ) const
+	{
+		if ( not table.content ) {
+			auto &index = this->index( channel );
+			auto it = index.find( idx );
+			if ( it == index.end() ) {
+				return false;
+			}
+			entry = it->second;
+			return true;
+		}
+		auto &dim = table.dim;
+		if ( not( idx.x < dim.x && idx.y < dim.y && idx.z < dim.z ) ) {
+			return false;
+		}
+		const auto i = ( uint64_t( idx.z ) * dim.y + idx.y ) * dim.x + idx.x;
+		if ( table.compact ) {
+			const auto chunk = channel * chunks_per_channel() + i / table.chunk_entries;
+			if ( chunk != table.cached_chunk ) {
+				decode_chunk( chunk, table.cached );
+				table.cached_chunk = chunk;
+			}
+			entry = table.cached[ i % table.chunk_entries ];
+			return entry.codec != BlockCodec::Absent;
+		}
+		const auto pos = table.offset + sizeof( BlockIndex ) * ( channel * dim.total() + i );
+		if ( auto src = table.content->mapped() ) {
+			memcpy( &entry, src + pos, sizeof( entry ) );
+		} else {
+			table.content->seek( pos );
+			table.content->read_typed( entry );
+		}
+		return entry.codec != BlockCodec::Absent;
+	}
+
+	/* the statistics of a block of the index, like find */
+	bool find_stats( uint32_t channel, Idx const &idx, BlockStats &stats ) const
+	{
+		if ( not table.content ) {
+			if ( channel >= stats_idx.size() ) {
+				return false;
+			}
+			auto it = stats_idx[ channel ].find( idx );
+			if ( it == stats_idx[ channel ].end() ) {
+				return false;
+			}
+			stats = it->second;
+			return true;
+		}
+		BlockIndex entry;
+		if ( not table.stats_offset || not find( channel, idx, entry ) ) {
+			return false;
+		}
+		auto &dim = table.dim;
+		const auto pos = table.stats_offset + stats_entry_size() *
+												( channel * dim.total() + ( uint64_t( idx.z ) * dim.y + idx.y ) * dim.x + idx.x );
+		if ( auto src = table.content->mapped() ) {
+			parse_stats( src + pos, stats );
+			return true;
+		}
+		vector<char> buffer( stats_entry_size() );
+		table.content->seek( pos );
+		table.content->read( buffer.data(), buffer.size() );
+		parse_stats( buffer.data(), stats );
+		return true;
+	}
+
+	/* the preview of a channel, preview_channel_bytes() into dst, a single read */
+	bool read_preview( uint32_t channel, char *dst ) const
+	{
+		if ( not has_preview() || channel >= channels() ) {
+			return false;
+		}
+		const auto n = preview_channel_bytes();
+		if ( not table.content ) {
+			memcpy( dst, preview.data() + channel * n, n );
+			return true;
+		}
+		table.content->seek( table.preview_offset + channel * n );
+		return table.content->read( dst, n ) == n;
+	}
+
+	/* fills block_idx and channel_idx from the block table, and the other
+	   fields left in content */
+	void load_index()
+	{
+		if ( not table.content ) {
+			return;
+		}
+		auto &dim = table.dim;
+		channel_idx.resize( table.channels - 1 );
+		stats_idx.resize( table.stats_offset ? table.channels : 0 );
+		vector<BlockIndex> entries( dim.total() );
+		vector<char> stats( table.stats_offset ? dim.total() * stats_entry_size() : 0 );
+		vector<BlockIndex> chunk;
+		for ( uint32_t c = 0; c != table.channels; ++c ) {
+			if ( table.compact ) {
+				for ( uint64_t k = 0; k != chunks_per_channel(); ++k ) {
+					decode_chunk( c * chunks_per_channel() + k, chunk );
+					std::copy( chunk.begin(), chunk.end(), entries.begin() + k * table.chunk_entries );
+				}
+			} else {
+				table.content->seek( table.offset + c * entries.size() * sizeof( BlockIndex ) );
+				table.content->read( reinterpret_cast<char *>( entries.data() ), entries.size() * sizeof( BlockIndex ) );
+			}
+			if ( not stats.empty() ) {
+				table.content->seek( table.stats_offset + c * stats.size() );
+				table.content->read( stats.data(), stats.size() );
+			}
+			auto &index = c ? channel_idx[ c - 1 ] : block_idx;
+			for ( uint64_t i = 0; i != entries.size(); ++i ) {
+				if ( entries[ i ].codec == BlockCodec::Absent ) continue;
+				const auto idx = Idx{}
+								   .set_x( i % dim.x )
+								   .set_y( i / dim.x % dim.y )
+								   .set_z( i / dim.x / dim.y );
+				index.emplace( idx, entries[ i ] );
+				if ( not stats.empty() ) {
+					parse_stats( stats.data() + i * stats_entry_size(), stats_idx[ c ][ idx ] );
+				}
+			}
+		}
+		preview.resize( table.preview_bytes );
+		table.content->seek( table.preview_offset );
+		table.content->read( preview.data(), preview.size() );
+		residuals();
+		checksums();
+		table.content->seek( 0 );
+		table.content = nullptr;
+		table.cached.clear();
+	}
+
+	/* with lazy_index the block table of a v7 footer is left in content,
+	   which must outlive the footer */
+	void read_from( Reader &content, uint64_t version, bool lazy_index = false )
+	{
+		uint64_t meta_offset;
+		content.seek( content.size() - sizeof( meta_offset ) );
+		content.read_typed( meta_offset );
+		if ( version >= 14 ) {
+			read_sections( content, meta_offset );
+		} else {
+			content.seek( meta_offset );
+			read_fields( content, version );
+		}
+		if ( not lazy_index ) {
+			load_index();
+		}
+		content.seek( 0 );
+	}
+
+	/* always writes the current archive_version, the block table is laid
+	   out on the block grid of the header and predicted from its geometry */
+	void write_to( Writer &body, Header const &header ) const
+	{
+		const uint64_t meta_offset = body.tell();
+		vector<Section> directory;
+		auto section = [&]( SectionTag tag, uint32_t flags, auto const &write ) {
+			Section entry;
+			entry.tag = tag;
+			entry.flags = flags;
+			entry.offset = body.tell() - meta_offset;
+			write();
+			entry.length = body.tell() - meta_offset - entry.offset;
+			directory.emplace_back( entry );
+		};
+		section( SectionTag::FrameLengths, required_section, [&] {
+			vector<unsigned char> lengths;
+			for ( uint32_t f = 0; f != frame_count(); ++f ) {
+				put_varint( lengths, frame_offset[ f + 1 ] - frame_offset[ f ] );
+			}
+			body.write_typed( lengths );
+		} );
+		section( SectionTag::BlockTable, required_section, [&] { write_block_table( body, header ); } );
+		if ( has_residuals() ) {
+			section( SectionTag::Residuals, 0, [&] { body.write_typed( residual_idx ); } );
+		}
+		if ( not transfer.empty() ) {
+			section( SectionTag::Transfer, 0, [&] { body.write_typed( transfer ); } );
+		}
+		if ( not frame_crc.empty() ) {
+			section( SectionTag::Checksums, 0, [&] { body.write_typed( frame_crc ); } );
+		}
+		if ( has_stats() ) {
+			section( SectionTag::Stats, 0, [&] { write_stats_table( body, header.dim ); } );
+		}
+		if ( not shards.empty() ) {
+			section( SectionTag::Shards, required_section, [&] {
+				body.write_typed( shards );
+				body.write_typed( shard_offset );
+				body.write_typed( frame_shard );
+			} );
+		}
+		if ( has_preview() ) {
+			section( SectionTag::Preview, 0, [&] {
+				body.write_typed( preview_dim );
+				body.write_typed( preview_scale );
+				body.write_typed( preview );
+			} );
+		}
+		const uint32_t nsections = directory.size();
+		body.write( reinterpret_cast<char const *>( directory.data() ), nsections * sizeof( Section ) );
+		body.write_typed( nsections );
+		body.write_typed( meta_offset );
+	}
+
+private:
+	static constexpr uint32_t default_chunk_entries = 1024;
+	enum : uint64_t
+	{
+		AbsentTag = 3,
+		ExplicitTag = 4,
+		LevelShift = 3
+	};
+
+	/* the directory lies right before nsections and meta_offset, sections
+	   are located relative to meta_offset */
+	void read_sections( Reader &content, uint64_t meta_offset )
+	{
+		uint32_t nsections;
+		const auto end = content.size() - sizeof( meta_offset ) - sizeof( nsections );
+		content.seek( end );
+		content.read_typed( nsections );
+		if ( meta_offset > end || uint64_t( nsections ) * sizeof( Section ) > end - meta_offset ) {
+			throw runtime_error( "corrupted section directory" );
+		}
+		const auto sections_end = end - nsections * sizeof( Section );
+		vector<Section> directory( nsections );
+		content.seek( sections_end );
+		content.read( reinterpret_cast<char *>( directory.data() ), nsections * sizeof( Section ) );
+		table.content = &content;
+		bool has_table = false;
+		for ( auto &section : directory ) {
+			const auto pos = meta_offset + section.offset;
+			if ( section.offset > sections_end - meta_offset || section.length > sections_end - pos ) {
+				throw runtime_error( vm::fmt( "section {} out of the footer", uint32_t( section.tag ) ) );
+			}
+			content.seek( pos );
+			switch ( section.tag ) {
+			case SectionTag::FrameLengths: read_frame_lengths( content ); break;
+			case SectionTag::BlockTable:
+				read_block_table( content, true );
+				has_table = true;
+				break;
+			case SectionTag::Residuals:
+				table.residuals = section;
+				table.residuals.offset = pos;
+				break;
+			case SectionTag::Transfer:
+				parse_section( content, section, [&]( SliceReader &reader ) {
+					return read_bounded( reader, transfer );
+				} );
+				break;
+			case SectionTag::Checksums:
+				table.checksums = section;
+				table.checksums.offset = pos;
+				break;
+			case SectionTag::Stats: read_stats_table( content ); break;
+			case SectionTag::Shards:
+				parse_section( content, section, [&]( SliceReader &reader ) {
+					return read_bounded( reader, shards ) &&
+						   read_bounded( reader, shard_offset ) &&
+						   read_bounded( reader, frame_shard );
+				} );
+				break;
+			case SectionTag::Preview: read_preview_volume( content ); break;
+			default:
+				if ( section.flags & required_section ) {
+					throw runtime_error( vm::fmt( "unsupported archive section {}", uint32_t( section.tag ) ) );
+				}
+			}
+		}
+		if ( not has_table ) {
+			throw runtime_error( "archive without block table" );
+		}
+	}
+
+	/* footers before v14, one field after another */
+	void read_fields( Reader &content, uint64_t version )
+	{
+		if ( version >= 12 ) {
+			read_frame_lengths( content );
+		} else {
+			content.read_typed( frame_offset );
+		}
+		if ( version >= 7 ) {
+			read_block_table( content, version >= 12 );
+		} else {
+			content.read_typed( block_idx );
+			if ( version >= 4 ) {
+				content.read_typed( channel_idx );
+			}
+		}
+		if ( version >= 5 ) {
+			content.read_typed( residual_idx );
+		}
+		if ( version >= 6 ) {
+			content.read_typed( transfer );
+		}
+		if ( version >= 8 ) {
+			content.read_typed( frame_crc );
+		}
+		if ( version >= 10 ) {
+			read_stats_table( content );
+		}
+		if ( version >= 11 ) {
+			content.read_typed( shards );
+			content.read_typed( shard_offset );
+			content.read_typed( frame_shard );
+		}
+		if ( version >= 13 ) {
+			read_preview_volume( content );
+		}
+	}
+
+	void read_frame_lengths( Reader &content )
+	{
+		vector<unsigned char> lengths;
+		content.read_typed( lengths );
+		frame_offset.assign( 1, 0 );
+		if ( decode_varints( lengths.data(), lengths.size(), frame_offset ) < 0 ) {
+			throw runtime_error( "corrupted frame offsets" );
+		}
+		for ( size_t f = 1; f < frame_offset.size(); ++f ) {
+			frame_offset[ f ] += frame_offset[ f - 1 ];
+		}
+	}
+
+	/* leaves the entries in content */
+	void read_block_table( Reader &content, bool compact )
+	{
+		content.read_typed( table.dim );
+		content.read_typed( table.channels );
+		table.content = &content;
+		if ( compact ) {
+			table.compact = true;
+			content.read_typed( table.frame_size );
+			content.read_typed( table.block_bytes );
+			content.read_typed( table.chunk_entries );
+			content.read_typed( table.chunk_end );
+			uint64_t nbytes;
+			content.read_typed( nbytes );
+			table.offset = content.tell();
+			if ( not table.chunk_entries ||
+				 table.chunk_end.size() != table.channels * chunks_per_channel() ) {
+				throw runtime_error( "corrupted block table" );
+			}
+			content.seek( table.offset + nbytes );
+		} else {
+			table.offset = content.tell();
+			content.seek( table.offset + table.channels * table.dim.total() * sizeof( BlockIndex ) );
+		}
+	}
+
+	/* leaves the entries in content, after the block table */
+	void read_stats_table( Reader &content )
+	{
+		uint32_t stats_channels;
+		content.read_typed( stats_channels );
+		content.read_typed( histogram_bins );
+		if ( stats_channels ) {
+			table.stats_offset = content.tell();
+			content.seek( table.stats_offset + stats_channels * table.dim.total() * stats_entry_size() );
+		}
+	}
+
+	/* leaves the voxels in content */
+	void read_preview_volume( Reader &content )
+	{
+		content.read_typed( preview_dim );
+		content.read_typed( preview_scale );
+		content.read_typed( table.preview_bytes );
+		table.preview_offset = content.tell();
+		content.seek( table.preview_offset + table.preview_bytes );
+	}
+
+	/* the bytes of a section at an absolute offset of content, which is
+	   left where it was, e.g. within the frames a decoder reads */
+	static vector<char> read_section( Reader &content, Section const &section )
+	{
+		vector<char> bytes( section.length );
+		if ( auto src = content.mapped() ) {
+			memcpy( bytes.data(), src + section.offset, bytes.size() );
+			return bytes;
+		}
+		const auto pos = content.tell();
+		content.seek( section.offset );
+		const auto nread = content.read( bytes.data(), bytes.size() );
+		content.seek( pos );
+		if ( nread != bytes.size() ) {
+			throw runtime_error( vm::fmt( "section {} out of the footer", uint32_t( section.tag ) ) );
+		}
+		return bytes;
+	}
+
+	/* parses the section at the position of content within its bytes,
+	   which parse must consume exactly */
+	template <typename F>
+	static void parse_section( Reader &content, Section const &section, F const &parse )
+	{
+		vector<char> bytes( section.length );
+		SliceReader reader( bytes.data(), bytes.size() );
+		if ( content.read( bytes.data(), bytes.size() ) != bytes.size() ||
+			 not parse( reader ) || reader.tell() != reader.size() ) {
+			throw runtime_error( vm::fmt( "corrupted section {}", uint32_t( section.tag ) ) );
+		}
+	}
+
+	/* read_typed with the count checked against the bytes left first */
+	template <typename T>
+	static bool read_bounded( SliceReader &reader, vector<T> &dst )
+	{
+		uint64_t n = 0;
+		if ( reader.read_typed( n ) != sizeof( n ) || n > ( reader.size() - reader.tell() ) / sizeof( T ) ) {
+			return false;
+		}
+		dst.resize( n );
+		return reader.read( reinterpret_cast<char *>( dst.data() ), n * sizeof( T ) ) == n * sizeof( T );
+	}
+	static bool read_bounded( SliceReader &reader, vector<string> &dst )
+	{
+		uint64_t n = 0;
+		if ( reader.read_typed( n ) != sizeof( n ) || n > ( reader.size() - reader.tell() ) / sizeof( n ) ) {
+			return false;
+		}
+		dst.resize( n );
+		for ( auto &str : dst ) {
+			uint64_t len = 0;
+			if ( reader.read_typed( len ) != sizeof( len ) || len > reader.size() - reader.tell() ) {
+				return false;
+			}
+			str.resize( len );
+			reader.read( &str[ 0 ], len );
+		}
+		return true;
+	}
+
+	/* residual_idx as read_typed writes it, every count checked against
+	   the bytes left in the section */
+	void parse_residuals( vector<char> const &bytes )
+	{
+		SliceReader reader( bytes.data(), bytes.size() );
+		const auto left = [&] { return reader.size() - reader.tell(); };
+		uint64_t nchannels = 0;
+		reader.read_typed( nchannels );
+		if ( nchannels > left() / sizeof( uint64_t ) ) {
+			throw runtime_error( "corrupted residual section" );
+		}
+		residual_idx.resize( nchannels );
+		for ( auto &index : residual_idx ) {
+			uint64_t n = 0;
+			reader.read_typed( n );
+			if ( n > left() / ( sizeof( Idx ) + sizeof( uint32_t ) ) ) {
+				throw runtime_error( "corrupted residual section" );
+			}
+			for ( uint64_t i = 0; i != n; ++i ) {
+				Idx idx;
+				uint32_t frame;
+				reader.read_typed( idx );
+				reader.read_typed( frame );
+				index.emplace( idx, frame );
+			}
+		}
+		if ( left() ) {
+			throw runtime_error( "corrupted residual section" );
+		}
+	}
+
+	/* frame_crc, one per frame, filling the section */
+	void parse_checksums( vector<char> const &bytes )
+	{
+		uint64_t n = 0;
+		if ( bytes.size() >= sizeof( n ) ) {
+			memcpy( &n, bytes.data(), sizeof( n ) );
+		}
+		if ( n != frame_count() || bytes.size() != sizeof( n ) + n * sizeof( uint32_t ) ) {
+			throw runtime_error( "corrupted checksum section" );
+		}
+		frame_crc.resize( n );
+		memcpy( frame_crc.data(), bytes.data() + sizeof( n ), n * sizeof( uint32_t ) );
+	}
+
+	void write_block_table( Writer &body, Header const &header ) const
+	{
+		auto &dim = header.dim;
+		const uint32_t nchannels = channels();
+		body.write_typed( dim );
+		body.write_typed( nchannels );
+		BlockTable compact;
+		compact.dim = dim;
+		compact.frame_size = header.frame_size;
+		compact.block_bytes = header.block_size * header.block_size * header.block_size * header.voxel_size();
+		compact.chunk_entries = default_chunk_entries;
+		body.write_typed( compact.frame_size );
+		body.write_typed( compact.block_bytes );
+		body.write_typed( compact.chunk_entries );
+		vector<unsigned char> stream;
+		vector<BlockIndex> entries( dim.total() );
+		for ( uint32_t c = 0; c != nchannels; ++c ) {
+			std::fill( entries.begin(), entries.end(), BlockIndex{}.set_codec( BlockCodec::Absent ) );
+			for ( auto &entry : index( c ) ) {
+				auto &idx = entry.first;
+				if ( not( idx.x < dim.x && idx.y < dim.y && idx.z < dim.z ) ) {
+					throw std::logic_error( vm::fmt( "block {} out of grid {}", idx, dim ) );
+				}
+				entries[ ( uint64_t( idx.z ) * dim.y + idx.y ) * dim.x + idx.x ] = entry.second;
+			}
+			for ( uint64_t i = 0; i < entries.size(); i += compact.chunk_entries ) {
+				const auto n = std::min<uint64_t>( compact.chunk_entries, entries.size() - i );
+				encode_chunk( compact, entries.data() + i, n, stream );
+				compact.chunk_end.emplace_back( stream.size() );
+			}
+		}
+		body.write_typed( compact.chunk_end );
+		body.write_typed( stream );
+	}
+
+	void write_stats_table( Writer &body, Idx const &dim ) const
+	{
+		const uint32_t stats_channels = channels();
+		body.write_typed( stats_channels );
+		body.write_typed( histogram_bins );
+		vector<char> stats( dim.total() * stats_entry_size() );
+		for ( uint32_t c = 0; c != stats_channels; ++c ) {
+			std::fill( stats.begin(), stats.end(), 0 );
+			for ( auto &entry : stats_idx[ c ] ) {
+				auto &idx = entry.first;
+				if ( entry.second.histogram.size() != histogram_bins ) {
+					throw std::logic_error( vm::fmt( "block {} has {} histogram bin(s), expected {}",
+													 idx, entry.second.histogram.size(), histogram_bins ) );
+				}
+				auto dst = stats.data() + ( ( uint64_t( idx.z ) * dim.y + idx.y ) * dim.x + idx.x ) * stats_entry_size();
+				memcpy( dst, &entry.second.min, sizeof( uint32_t ) );
+				memcpy( dst + sizeof( uint32_t ), &entry.second.max, sizeof( uint32_t ) );
+				memcpy( dst + 2 * sizeof( uint32_t ), &entry.second.mean, sizeof( float ) );
+				memcpy( dst + 3 * sizeof( uint32_t ), entry.second.histogram.data(), histogram_bins * sizeof( uint32_t ) );
+			}
+			body.write( stats.data(), stats.size() );
+		}
+	}
+
+	uint64_t chunks_per_channel() const
+	{
+		return ( table.dim.total() + table.chunk_entries - 1 ) / table.chunk_entries;
+	}
+
+	/* each chunk is coded on its own, positions of h264 blocks predicted
+	   from the end of the previous one and palette frames from the
+	   previous palette frame, so that sequentially archived blocks take a
+	   byte or two, entries that do not fit the prediction are explicit */
+	static void encode_chunk( BlockTable const &table, BlockIndex const *entries, uint64_t n,
+							  vector<unsigned char> &dst )
+	{
+		uint64_t next_pos = 0;
+		uint32_t next_frame = 0;
+		for ( uint64_t i = 0; i != n; ++i ) {
+			auto &e = entries[ i ];
+			const uint64_t level = uint64_t( e.level ) << LevelShift;
+			const auto pos = uint64_t( e.first_frame ) * table.frame_size + e.offset;
+			switch ( e.codec ) {
+			case BlockCodec::Absent:
+			case BlockCodec::Empty:
+				if ( e.first_frame == 0 && e.last_frame == 0 && e.offset == 0 ) {
+					put_varint( dst, level | ( e.codec == BlockCodec::Absent ? AbsentTag : uint64_t( e.codec ) ) );
+					continue;
+				}
+				break;
+			case BlockCodec::H264:
+				if ( table.frame_size && table.block_bytes && e.offset < table.frame_size &&
+					 ( pos + table.block_bytes - 1 ) / table.frame_size == e.last_frame ) {
+					put_varint( dst, level | uint64_t( e.codec ) );
+					put_varint( dst, zigzag( int64_t( pos - next_pos ) ) );
+					next_pos = pos + table.block_bytes;
+					continue;
+				}
+				break;
+			case BlockCodec::Palette:
+				if ( e.offset == 0 && e.last_frame == e.first_frame ) {
+					put_varint( dst, level | uint64_t( e.codec ) );
+					put_varint( dst, zigzag( int64_t( e.first_frame ) - next_frame ) );
+					next_frame = e.first_frame + 1;
+					continue;
+				}
+				break;
+			}
+			const auto codec = e.codec == BlockCodec::Absent ? AbsentTag : uint64_t( e.codec );
+			put_varint( dst, level | ExplicitTag | codec );
+			put_varint( dst, e.first_frame );
+			put_varint( dst, e.last_frame );
+			put_varint( dst, e.offset );
+		}
+	}
+
+	void decode_chunk( uint64_t chunk, vector<BlockIndex> &entries ) const
+	{
+		const auto beg = chunk ? table.chunk_end[ chunk - 1 ] : 0;
+		if ( table.chunk_end[ chunk ] < beg || table.offset + table.chunk_end[ chunk ] > table.content->size() ) {
+			throw runtime_error( vm::fmt( "corrupted block table chunk {}", chunk ) );
+		}
+		const auto len = table.chunk_end[ chunk ] - beg;
+		vector<uint64_t> values;
+		int64_t nvalues;
+		if ( auto src = table.content->mapped() ) {
+			nvalues = decode_varints( reinterpret_cast<unsigned char const *>( src ) + table.offset + beg, len, values );
+		} else {
+			vector<unsigned char> bytes( len );
+			table.content->seek( table.offset + beg );
+			if ( table.content->read( reinterpret_cast<char *>( bytes.data() ), len ) != len ) {
+				throw runtime_error( vm::fmt( "corrupted block table chunk {}", chunk ) );
+			}
+			nvalues = decode_varints( bytes.data(), len, values );
+		}
+		if ( nvalues < 0 ) {
+			throw runtime_error( vm::fmt( "corrupted block table chunk {}", chunk ) );
+		}
+		const auto k = chunk % chunks_per_channel();
+		const auto n = std::min<uint64_t>( table.chunk_entries, table.dim.total() - k * table.chunk_entries );
+		entries.resize( n );
+		uint64_t next_pos = 0;
+		uint32_t next_frame = 0;
+		int64_t j = 0;
+		auto next = [&] {
+			if ( j >= int64_t( values.size() ) ) {
+				throw runtime_error( vm::fmt( "corrupted block table chunk {}", chunk ) );
+			}
+			return values[ j++ ];
+		};
+		for ( auto &e : entries ) {
+			const auto tag = next();
+			const auto codec = tag & ( ExplicitTag - 1 );
+			e = BlockIndex{}
+				  .set_codec( codec == AbsentTag ? BlockCodec::Absent : BlockCodec( codec ) )
+				  .set_level( uint8_t( tag >> LevelShift ) );
+			if ( tag & ExplicitTag ) {
+				e.first_frame = uint32_t( next() );
+				e.last_frame = uint32_t( next() );
+				e.offset = uint32_t( next() );
+			} else if ( e.codec == BlockCodec::H264 ) {
+				if ( not table.frame_size ) {
+					throw runtime_error( vm::fmt( "corrupted block table chunk {}", chunk ) );
+				}
+				const auto pos = next_pos + uint64_t( unzigzag( next() ) );
+				e.first_frame = uint32_t( pos / table.frame_size );
+				e.offset = uint32_t( pos % table.frame_size );
+				e.last_frame = uint32_t( ( pos + table.block_bytes - 1 ) / table.frame_size );
+				next_pos = pos + table.block_bytes;
+			} else if ( e.codec == BlockCodec::Palette ) {
+				e.first_frame = e.last_frame = uint32_t( next_frame + unzigzag( next() ) );
+				next_frame = e.first_frame + 1;
+			}
+		}
+		if ( j != int64_t( values.size() ) ) {
+			throw runtime_error( vm::fmt( "corrupted block table chunk {}", chunk ) );
+		}
+	}
+
+	void parse_stats( char const *src, BlockStats &stats ) const
+	{
+		memcpy( &stats.min, src, sizeof( uint32_t ) );
+		memcpy( &stats.max, src + sizeof( uint32_t ), sizeof( uint32_t ) );
+		memcpy( &stats.mean, src + 2 * sizeof( uint32_t ), sizeof( float ) );
+		stats.histogram.resize( histogram_bins );
+		memcpy( stats.histogram.data(), src + 3 * sizeof( uint32_t ), histogram_bins * sizeof( uint32_t ) );
+	}
+};
+
 VM_END_MODULE()
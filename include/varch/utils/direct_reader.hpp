@@ -0,0 +1,193 @@
+#pragma once
+
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+#include <VMUtils/concepts.hpp>
+#include "io.hpp"
+
+#ifdef WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+VM_EXPORT
+{
+	/* reads a file around the page cache, so that large random access
+	   workloads do not evict everything else. every read is widened to
+	   whole alignment sized pages of an aligned buffer, which is kept for
+	   the small reads that follow, e.g. a frame length then its packet.
+	   frames of archives with ArchiverOptions::frame_alignment start on a
+	   page, so their reads share no page with the frame before. falls back
+	   to cached reads where the file system refuses direct i/o */
+	struct DirectReader : Reader, vm::NoCopy, vm::NoMove
+	{
+		DirectReader( string const &path, size_t alignment = 4096 ) :
+		  alignment( alignment )
+		{
+			if ( not alignment || alignment & ( alignment - 1 ) ) {
+				throw logic_error( vm::fmt( "unsupported alignment: {}", alignment ) );
+			}
+#ifdef WIN32
+			file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+								OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr );
+			if ( file == INVALID_HANDLE_VALUE ) {
+				is_direct = false;
+				file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+									OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+			}
+			LARGE_INTEGER len;
+			if ( file == INVALID_HANDLE_VALUE || not GetFileSizeEx( file, &len ) ) {
+				close_file();
+				throw runtime_error( vm::fmt( "can not open file: {}", path ) );
+			}
+			slen = len.QuadPart;
+#else
+#ifdef O_DIRECT
+			fd = open( path.c_str(), O_RDONLY | O_DIRECT );
+#endif
+			if ( fd < 0 ) {
+				is_direct = false;
+				fd = open( path.c_str(), O_RDONLY );
+			}
+#ifdef F_NOCACHE
+			is_direct = fd >= 0 && fcntl( fd, F_NOCACHE, 1 ) != -1;
+#endif
+			struct stat st;
+			if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+				close_file();
+				throw runtime_error( vm::fmt( "can not open file: {}", path ) );
+			}
+			slen = st.st_size;
+#endif
+		}
+		~DirectReader()
+		{
+			close_file();
+			free_buffer();
+		}
+
+		void seek( size_t pos ) override
+		{
+			p = pos;
+		}
+		size_t tell() const override
+		{
+			return p;
+		}
+		size_t size() const override
+		{
+			return slen;
+		}
+		size_t read( char *dst, size_t dlen ) override
+		{
+			const auto n = std::min( slen - std::min( p, slen ), dlen );
+			if ( not n ) {
+				return 0;
+			}
+			if ( p < window_beg || p + n > window_end ) {
+				fill_window( p, p + n );
+			}
+			const auto nread = std::min( n, window_end - std::min( p, window_end ) );
+			memcpy( dst, buffer + ( p - window_beg ), nread );
+			p += nread;
+			return nread;
+		}
+
+		/* false if reads go through the page cache */
+		bool direct() const
+		{
+			return is_direct;
+		}
+
+	private:
+		void fill_window( size_t beg, size_t end )
+		{
+			beg &= ~( alignment - 1 );
+			end = ( end + alignment - 1 ) & ~( alignment - 1 );
+			if ( end - beg > capacity ) {
+				free_buffer();
+#ifdef WIN32
+				buffer = static_cast<char *>( _aligned_malloc( end - beg, alignment ) );
+#else
+				void *ptr = nullptr;
+				buffer = posix_memalign( &ptr, alignment, end - beg ) ? nullptr : static_cast<char *>( ptr );
+#endif
+				if ( not buffer ) {
+					throw runtime_error( vm::fmt( "can not allocate {} byte(s)", end - beg ) );
+				}
+				capacity = end - beg;
+			}
+			/* the window is invalid until the read succeeds */
+			window_beg = window_end = 0;
+			size_t got = 0;
+			while ( beg + got < end ) {
+#ifdef WIN32
+				OVERLAPPED ov = {};
+				ov.Offset = DWORD( beg + got );
+				ov.OffsetHigh = DWORD( uint64_t( beg + got ) >> 32 );
+				DWORD nread = 0;
+				if ( not ReadFile( file, buffer + got, DWORD( std::min<size_t>( end - beg - got, 1u << 30 ) ), &nread, &ov ) &&
+					 GetLastError() != ERROR_HANDLE_EOF ) {
+					throw runtime_error( "direct read failed" );
+				}
+#else
+				const auto nread = pread( fd, buffer + got, end - beg - got, beg + got );
+				if ( nread < 0 ) {
+					throw runtime_error( "direct read failed" );
+				}
+#endif
+				if ( nread == 0 ) break;
+				got += nread;
+			}
+			window_beg = beg;
+			window_end = beg + got;
+		}
+
+		void free_buffer()
+		{
+#ifdef WIN32
+			_aligned_free( buffer );
+#else
+			free( buffer );
+#endif
+			buffer = nullptr;
+			capacity = 0;
+		}
+
+		void close_file()
+		{
+#ifdef WIN32
+			if ( file != INVALID_HANDLE_VALUE ) CloseHandle( file );
+			file = INVALID_HANDLE_VALUE;
+#else
+			if ( fd >= 0 ) close( fd );
+			fd = -1;
+#endif
+		}
+
+	private:
+#ifdef WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+#else
+		int fd = -1;
+#endif
+		bool is_direct = true;
+		size_t alignment;
+		char *buffer = nullptr;
+		size_t capacity = 0;
+		size_t window_beg = 0, window_end = 0;
+		size_t p = 0;
+		size_t slen = 0;
+	};
+}
+
+VM_END_MODULE()
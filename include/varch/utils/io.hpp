@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <fstream>
+#include <string>
 #include <vector>
 #include <map>
 #include <cstring>
@@ -27,13 +28,16 @@ VM_EXPORT
 	struct Reader : RandomIO
 	{
 		virtual size_t read( char *dst, size_t len ) = 0;
+		/* the whole content if it is held in memory, e.g. a mapped file */
+		virtual char const *mapped() const { return nullptr; }
 		template <typename T, typename = typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
 		size_t read_typed( T &dst )
 		{
 			return read( reinterpret_cast<char *>( &dst ), sizeof( T ) );
 		}
 		template <typename T>
-		size_t read_typed( std::vector<T> &vec )
+		typename std::enable_if<std::is_trivially_copyable<T>::value, size_t>::type
+		  read_typed( std::vector<T> &vec )
 		{
 			uint64_t len;
 			auto nread = read_typed( len );
@@ -41,6 +45,26 @@ VM_EXPORT
 			nread += read( reinterpret_cast<char *>( vec.data() ), sizeof( T ) * len );
 			return nread;
 		}
+		template <typename T>
+		typename std::enable_if<!std::is_trivially_copyable<T>::value, size_t>::type
+		  read_typed( std::vector<T> &vec )
+		{
+			uint64_t len;
+			auto nread = read_typed( len );
+			vec.resize( len );
+			for ( auto &e : vec ) {
+				nread += read_typed( e );
+			}
+			return nread;
+		}
+		size_t read_typed( std::string &str )
+		{
+			uint64_t len;
+			auto nread = read_typed( len );
+			str.resize( len );
+			nread += read( &str[ 0 ], len );
+			return nread;
+		}
 		template <typename K, typename V>
 		size_t read_typed( std::map<K, V> &map )
 		{
@@ -65,14 +89,31 @@ VM_EXPORT
 			write( reinterpret_cast<char const *>( &src ), sizeof( T ) );
 		}
 		template <typename T>
-		void write_typed( std::vector<T> const &vec )
+		typename std::enable_if<std::is_trivially_copyable<T>::value>::type
+		  write_typed( std::vector<T> const &vec )
 		{
 			uint64_t len = vec.size();
 			write_typed( len );
 			write( reinterpret_cast<char const *>( vec.data() ), sizeof( T ) * len );
 		}
+		template <typename T>
+		typename std::enable_if<!std::is_trivially_copyable<T>::value>::type
+		  write_typed( std::vector<T> const &vec )
+		{
+			uint64_t len = vec.size();
+			write_typed( len );
+			for ( auto &e : vec ) {
+				write_typed( e );
+			}
+		}
+		void write_typed( std::string const &str )
+		{
+			uint64_t len = str.size();
+			write_typed( len );
+			write( str.data(), len );
+		}
 		template <typename K, typename V>
-		void write_typed( std::map<K, V> &map )
+		void write_typed( std::map<K, V> const &map )
 		{
 			uint64_t len = map.size();
 			write_typed( len );
@@ -108,6 +149,11 @@ VM_EXPORT
 		{
 			return _.read( dst, std::min( dlen, len - tell() ) );
 		}
+		char const *mapped() const override
+		{
+			auto src = _.mapped();
+			return src ? src + offset : nullptr;
+		}
 
 	private:
 		Reader &_;
@@ -141,6 +187,10 @@ VM_EXPORT
 			p += nread;
 			return nread;
 		}
+		char const *mapped() const override
+		{
+			return src;
+		}
 
 	private:
 		char const *src;
@@ -182,6 +232,39 @@ VM_EXPORT
 		size_t send;
 	};
 
+	struct PartWriter : Writer
+	{
+		PartWriter( Writer &_, size_t offset, size_t len ) :
+		  _( _ ),
+		  offset( offset ),
+		  len( len )
+		{
+			_.seek( offset );
+		}
+
+		void seek( size_t pos ) override
+		{
+			_.seek( pos + offset );
+		}
+		size_t tell() const override
+		{
+			return _.tell() - offset;
+		}
+		size_t size() const override
+		{
+			return len;
+		}
+		void write( char const *src, size_t slen ) override
+		{
+			_.write( src, std::min( slen, len - tell() ) );
+		}
+
+	private:
+		Writer &_;
+		size_t offset;
+		size_t len;
+	};
+
 	struct SliceWriter : Writer
 	{
 		SliceWriter( char *dst, size_t dlen ) :
@@ -15,6 +15,8 @@ VM_EXPORT
 		{
 		}
 
+		/* a seek to size() or beyond is the end of the stream, e.g. past
+		   the filler that ends the last frame of a range */
 		void seek( size_t pos ) override
 		{
 			size_t len = 0;
@@ -27,6 +29,7 @@ VM_EXPORT
 				}
 				len += size;
 			}
+			idx = _.size();
 		}
 		size_t tell() const override
 		{
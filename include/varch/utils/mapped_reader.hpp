@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <VMUtils/concepts.hpp>
+#include "io.hpp"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+VM_EXPORT
+{
+	/* maps a whole file read-only, pages are loaded on first access, so that
+	   opening an archive touches only its header and footer */
+	struct MappedReader : Reader, vm::NoCopy, vm::NoMove
+	{
+		MappedReader( string const &path )
+		{
+#ifdef WIN32
+			file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+								OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+			LARGE_INTEGER len;
+			if ( file == INVALID_HANDLE_VALUE || not GetFileSizeEx( file, &len ) ) {
+				throw runtime_error( vm::fmt( "can not open file: {}", path ) );
+			}
+			slen = len.QuadPart;
+			if ( slen ) {
+				mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+				src = mapping ? static_cast<char const *>( MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) ) : nullptr;
+			}
+#else
+			fd = open( path.c_str(), O_RDONLY );
+			struct stat st;
+			if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+				throw runtime_error( vm::fmt( "can not open file: {}", path ) );
+			}
+			slen = st.st_size;
+			if ( slen ) {
+				auto ptr = mmap( nullptr, slen, PROT_READ, MAP_SHARED, fd, 0 );
+				src = ptr == MAP_FAILED ? nullptr : static_cast<char const *>( ptr );
+			}
+#endif
+			if ( slen && not src ) {
+				close_file();
+				throw runtime_error( vm::fmt( "can not map file: {}", path ) );
+			}
+		}
+		~MappedReader()
+		{
+			close_file();
+		}
+
+		void seek( size_t pos ) override
+		{
+			p = pos;
+		}
+		size_t tell() const override
+		{
+			return p;
+		}
+		size_t size() const override
+		{
+			return slen;
+		}
+		size_t read( char *dst, size_t dlen ) override
+		{
+			auto nread = std::min( slen - std::min( p, slen ), dlen );
+			memcpy( dst, src + p, nread );
+			p += nread;
+			return nread;
+		}
+		char const *mapped() const override
+		{
+			return src;
+		}
+
+	private:
+		void close_file()
+		{
+#ifdef WIN32
+			if ( src ) UnmapViewOfFile( src );
+			if ( mapping ) CloseHandle( mapping );
+			if ( file != INVALID_HANDLE_VALUE ) CloseHandle( file );
+#else
+			if ( src ) munmap( const_cast<char *>( src ), slen );
+			if ( fd >= 0 ) close( fd );
+#endif
+		}
+
+	private:
+#ifdef WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int fd = -1;
+#endif
+		char const *src = nullptr;
+		size_t p = 0;
+		size_t slen = 0;
+	};
+}
+
+VM_END_MODULE()
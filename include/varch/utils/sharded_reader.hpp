@@ -0,0 +1,183 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <future>
+#include <stdexcept>
+#include <VMUtils/concepts.hpp>
+#include "common.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+VM_EXPORT
+{
+	/* presents a manifest and its shard files as the single file archive
+	   they describe, header, frames of all shards in frame order, footer,
+	   so that it can be opened by Unarchiver like any other archive. a read
+	   spanning frames of several shards reads the shards concurrently */
+	struct ShardedReader : Reader, vm::NoCopy, vm::NoMove
+	{
+		ShardedReader( string const &manifest )
+		{
+			ifstream is( manifest, ios::ate | ios::binary );
+			if ( not is.is_open() ) {
+				throw runtime_error( vm::fmt( "can not open manifest: {}", manifest ) );
+			}
+			meta.resize( is.tellg() );
+			is.seekg( 0 );
+			is.read( meta.data(), meta.size() );
+			Header header;
+			uint64_t meta_offset;
+			if ( meta.size() < sizeof( header ) + sizeof( meta_offset ) ) {
+				throw runtime_error( vm::fmt( "not an archive manifest: {}", manifest ) );
+			}
+			memcpy( &header, meta.data(), sizeof( header ) );
+			memcpy( &meta_offset, meta.data() + meta.size() - sizeof( meta_offset ), sizeof( meta_offset ) );
+			if ( not header.sharded || header.version > archive_version ) {
+				throw runtime_error( vm::fmt( "not an archive manifest: {}", manifest ) );
+			}
+			/* readers see a plain archive */
+			header.sharded = false;
+			memcpy( meta.data(), &header, sizeof( header ) );
+			frames_end = sizeof( header ) + meta_offset;
+
+			/* only the footer is read until the shards are open */
+			PartReader content( *this, sizeof( header ), size() - sizeof( header ) );
+			Footer footer;
+			footer.read_from( content, header.version, true );
+			frame_offset = std::move( footer.frame_offset );
+			frame_shard = std::move( footer.frame_shard );
+			shard_offset = std::move( footer.shard_offset );
+			if ( frame_shard.size() + 1 != frame_offset.size() ||
+				 shard_offset.size() != footer.shards.size() ) {
+				throw runtime_error( vm::fmt( "corrupted manifest: {}", manifest ) );
+			}
+			frame_local.resize( frame_shard.size() );
+			vector<uint64_t> shard_len( footer.shards.size() );
+			for ( size_t f = 0; f != frame_shard.size(); ++f ) {
+				if ( frame_shard[ f ] >= shard_len.size() ) {
+					throw runtime_error( vm::fmt( "frame {} in shard {} of {}", f, frame_shard[ f ], shard_len.size() ) );
+				}
+				frame_local[ f ] = shard_offset[ frame_shard[ f ] ] + shard_len[ frame_shard[ f ] ];
+				shard_len[ frame_shard[ f ] ] += frame_offset[ f + 1 ] - frame_offset[ f ];
+			}
+
+			const auto dir = manifest.substr( 0, manifest.find_last_of( "/\\" ) + 1 );
+			for ( auto &shard : footer.shards ) {
+				const bool absolute = not shard.empty() && ( shard[ 0 ] == '/' || shard[ 0 ] == '\\' ||
+															 shard.size() > 1 && shard[ 1 ] == ':' );
+				const auto path = absolute ? shard : dir + shard;
+				shards.emplace_back( new ifstream( path, ios::binary ) );
+				if ( not shards.back()->is_open() ) {
+					throw runtime_error( vm::fmt( "can not open shard: {}", path ) );
+				}
+			}
+		}
+
+		static bool is_manifest( string const &path )
+		{
+			ifstream is( path, ios::binary );
+			Header header;
+			return is.read( reinterpret_cast<char *>( &header ), sizeof( header ) ) && header.sharded;
+		}
+
+		void seek( size_t pos ) override
+		{
+			p = pos;
+		}
+		size_t tell() const override
+		{
+			return p;
+		}
+		size_t size() const override
+		{
+			return frames_end + meta.size() - sizeof( Header );
+		}
+		size_t read( char *dst, size_t dlen ) override
+		{
+			const auto end = std::min( p + dlen, size() );
+			const auto beg = p;
+			const auto frames_beg = uint64_t( sizeof( Header ) );
+			/* header */
+			if ( p < frames_beg && p < end ) {
+				const auto n = std::min( end, frames_beg ) - p;
+				memcpy( dst, meta.data() + p, n );
+				p += n;
+			}
+			/* frames */
+			if ( p < frames_end && p < end ) {
+				const auto n = std::min( end, frames_end ) - p;
+				read_frames( p - frames_beg, n, dst + ( p - beg ) );
+				p += n;
+			}
+			/* footer */
+			if ( p < end ) {
+				memcpy( dst + ( p - beg ), meta.data() + sizeof( Header ) + ( p - frames_end ), end - p );
+				p = end;
+			}
+			return end - beg;
+		}
+
+	private:
+		struct Segment
+		{
+			uint64_t local, len;
+			char *dst;
+		};
+
+		/* body bytes [pos, pos + len) of the frames, gathered per shard */
+		void read_frames( uint64_t pos, uint64_t len, char *dst )
+		{
+			vector<vector<Segment>> segments( shards.size() );
+			size_t nshards = 0;
+			auto f = uint32_t( std::upper_bound( frame_offset.begin(), frame_offset.end(), pos ) - frame_offset.begin() - 1 );
+			for ( const auto end = pos + len; pos < end; ++f ) {
+				const auto n = std::min( end, frame_offset[ f + 1 ] ) - pos;
+				const auto local = frame_local[ f ] + pos - frame_offset[ f ];
+				auto &shard = segments[ frame_shard[ f ] ];
+				nshards += shard.empty();
+				if ( not shard.empty() && shard.back().local + shard.back().len == local &&
+					 shard.back().dst + shard.back().len == dst ) {
+					shard.back().len += n;
+				} else {
+					shard.emplace_back( Segment{ local, n, dst } );
+				}
+				dst += n;
+				pos += n;
+			}
+			vector<future<void>> pending;
+			for ( size_t s = 0; s != shards.size(); ++s ) {
+				if ( segments[ s ].empty() ) continue;
+				auto job = [this, s, &segments] {
+					for ( auto &seg : segments[ s ] ) {
+						shards[ s ]->seekg( seg.local );
+						if ( not shards[ s ]->read( seg.dst, seg.len ) ) {
+							throw runtime_error( vm::fmt( "unexpected end of shard {}", s ) );
+						}
+					}
+				};
+				if ( nshards == 1 ) {
+					job();
+				} else {
+					pending.emplace_back( std::async( std::launch::async, job ) );
+				}
+			}
+			for ( auto &job : pending ) {
+				job.get();
+			}
+		}
+
+	private:
+		/* the manifest, its header patched to a plain archive */
+		vector<char> meta;
+		uint64_t frames_end;
+		vector<uint64_t> frame_offset, frame_local, shard_offset;
+		vector<uint32_t> frame_shard;
+		vector<unique_ptr<ifstream>> shards;
+		size_t p = 0;
+	};
+}
+
+VM_END_MODULE()
@@ -26,15 +26,11 @@ VM_EXPORT
 		void write( char const *src, size_t slen ) override
 		{
 			if ( data.size() < slen + idx ) {
+				/* grow geometrically so that appending stays amortized o(1) */
 				if ( data.capacity() < slen + idx ) {
-					data.resize( slen + idx );
-				} else {
-					vector<char> data_buf;
-					data_buf.reserve( ( idx + slen ) * 2 );
-					data_buf.resize( idx + slen );
-					data.swap( data_buf );
-					memcpy( data.data(), data_buf.data(), idx * sizeof( char ) );
+					data.reserve( std::max( slen + idx, data.capacity() * 2 ) );
 				}
+				data.resize( slen + idx );
 			}
 			memcpy( data.data() + idx, src, slen );
 			idx += slen;
@@ -42,7 +38,7 @@ VM_EXPORT
 
 	private:
 		vector<char> &data;
-		int idx = 0;
+		size_t idx = 0;
 	};
 }
 
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <VMUtils/modules.hpp>
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#define VARCH_VARINT_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+/* lsb first groups of 7 bits, the high bit of a byte is set if more follow */
+inline void put_varint( vector<unsigned char> &dst, uint64_t x )
+{
+	while ( x >= 0x80 ) {
+		dst.emplace_back( uint8_t( x ) | 0x80 );
+		x >>= 7;
+	}
+	dst.emplace_back( uint8_t( x ) );
+}
+
+inline uint64_t zigzag( int64_t x )
+{
+	return ( uint64_t( x ) << 1 ) ^ uint64_t( x >> 63 );
+}
+
+inline int64_t unzigzag( uint64_t x )
+{
+	return int64_t( x >> 1 ) ^ -int64_t( x & 1 );
+}
+
+inline int count_trailing_zeros( uint64_t x )
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64( &i, x );
+	return int( i );
+#else
+	return __builtin_ctzll( x );
+#endif
+}
+
+/* decodes every varint of src[ 0, len ) into dst, which is grown to hold
+   them, and returns the number decoded or -1 if the last one is cut off.
+   footer fields are mostly small deltas, so runs of single byte varints
+   are found 16 ( sse2 ) or 8 bytes at a time and widened without a branch
+   per byte, only longer varints are decoded one by one */
+inline int64_t decode_varints( unsigned char const *src, size_t len, vector<uint64_t> &dst )
+{
+	const auto base = dst.size();
+	/* at most one value per byte */
+	dst.resize( base + len );
+	auto out = dst.data() + base;
+	auto p = src;
+	const auto end = src + len;
+	while ( p != end ) {
+#ifdef VARCH_VARINT_SSE2
+		if ( end - p >= 16 ) {
+			const auto bytes = _mm_loadu_si128( reinterpret_cast<__m128i const *>( p ) );
+			const auto cont = uint32_t( _mm_movemask_epi8( bytes ) );
+			if ( cont == 0 ) {
+				const auto zero = _mm_setzero_si128();
+				const auto lo = _mm_unpacklo_epi8( bytes, zero );
+				const auto hi = _mm_unpackhi_epi8( bytes, zero );
+				const __m128i words[ 4 ] = { _mm_unpacklo_epi16( lo, zero ), _mm_unpackhi_epi16( lo, zero ),
+											 _mm_unpacklo_epi16( hi, zero ), _mm_unpackhi_epi16( hi, zero ) };
+				for ( int i = 0; i != 4; ++i ) {
+					_mm_storeu_si128( reinterpret_cast<__m128i *>( out + 4 * i ),
+									  _mm_unpacklo_epi32( words[ i ], zero ) );
+					_mm_storeu_si128( reinterpret_cast<__m128i *>( out + 4 * i + 2 ),
+									  _mm_unpackhi_epi32( words[ i ], zero ) );
+				}
+				out += 16;
+				p += 16;
+				continue;
+			}
+			for ( int n = count_trailing_zeros( cont ); n; --n ) {
+				*out++ = *p++;
+			}
+		} else
+#endif
+		  if ( end - p >= 8 ) {
+			uint64_t word;
+			memcpy( &word, p, sizeof( word ) );
+			const auto cont = word & 0x8080808080808080ull;
+			/* bytes are taken in memory order, i.e. from the low end on little endian */
+			const int n = cont ? count_trailing_zeros( cont ) / 8 : 8;
+			for ( int i = 0; i != n; ++i ) {
+				*out++ = *p++;
+			}
+			if ( n == 8 ) continue;
+		}
+		uint64_t x = 0;
+		for ( int shift = 0;; shift += 7 ) {
+			if ( p == end || shift > 63 ) {
+				return -1;
+			}
+			const auto byte = *p++;
+			x |= uint64_t( byte & 0x7f ) << shift;
+			if ( not( byte & 0x80 ) ) break;
+		}
+		*out++ = x;
+	}
+	dst.resize( out - dst.data() );
+	return dst.size() - base;
+}
+
+VM_END_MODULE()
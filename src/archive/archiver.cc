@@ -1,4 +1,12 @@
+#include <chrono>
 #include <thread>
+#include <future>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+#include <numeric>
+#include <algorithm>
+#include <functional>
 #include <VMat/geometry.h>
 #include <VMat/numeric.h>
 #include <VMUtils/timer.hpp>
@@ -6,7 +14,14 @@
 #include <varch/archive/archiver.hpp>
 #include <varch/utils/common.hpp>
 #include <varch/utils/unbounded_io.hpp>
+#include <varch/utils/unbounded_vector_writer.hpp>
+#include "../unarchive/idecoder.hpp"
+#include "../unarchive/crc32c.hpp"
+#include "backends/palette/palette_encoder.hpp"
 #include "video_compressor.hpp"
+#include "palette_compressor.hpp"
+#include "quantizer.hpp"
+#include "preview.hpp"
 
 VM_BEGIN_MODULE( vol )
 
@@ -15,33 +30,322 @@ using namespace std;
 
 using Voxel = char;
 
+static ICompressor *create_compressor( Writer &out, ArchiverOptions const &opts,
+									   size_t nvoxels_per_block )
+{
+	switch ( opts.encode_method ) {
+	case EncodeMethod::H264: return new VideoCompressor( out, opts.compress_opts, opts.frame_alignment );
+	case EncodeMethod::Label32: return new PaletteCompressor( out, nvoxels_per_block, opts.compress_opts );
+	default: throw runtime_error( vm::fmt( "unknown encode method: {}", int( opts.encode_method ) ) );
+	}
+}
+
+static size_t input_voxel_size( ArchiverOptions const &opts )
+{
+	if ( opts.quantize.mode != Quantize::None ) {
+		return sizeof( uint16_t ) * opts.channels;
+	}
+	return Header{}.set_encode_method( opts.encode_method ).voxel_size() * opts.channels;
+}
+
+/* io_threads workers, each with its own handle of the input file, that
+   read the regions of the input as runs of planes */
+struct RegionReaderPool : vm::NoCopy, vm::NoMove
+{
+	RegionReaderPool( ArchiverOptions const &opts, size_t voxel_size ) :
+	  voxel_size( voxel_size )
+	{
+		/* all handles are open before any worker starts */
+		for ( size_t i = 0; i != opts.io_threads; ++i ) {
+			readers.emplace_back( new RawReaderIO( opts.input, Size3( opts.x, opts.y, opts.z ), voxel_size ) );
+		}
+		for ( auto &reader : readers ) {
+			workers.emplace_back( [this, &reader = *reader] { work_loop( reader ); } );
+		}
+	}
+
+	~RegionReaderPool()
+	{
+		{
+			unique_lock<mutex> lk( mut );
+			should_stop = true;
+			job_cv.notify_all();
+		}
+		for ( auto &worker : workers ) {
+			worker.join();
+		}
+	}
+
+	/* the region is complete once every run is, rethrows their first error */
+	void read( Idx const &start, Idx const &size, unsigned char *dst )
+	{
+		const size_t plane = voxel_size * size.x * size.y;
+		const uint32_t nruns = std::min( size_t( size.z ), workers.size() );
+		Region region;
+		{
+			unique_lock<mutex> lk( mut );
+			region.pending = nruns;
+			for ( uint32_t i = 0; i != nruns; ++i ) {
+				const uint32_t z0 = size.z * i / nruns, z1 = size.z * ( i + 1 ) / nruns;
+				jobs.emplace_back( Job{ Vec3i( start.x, start.y, start.z + z0 ), Size3( size.x, size.y, z1 - z0 ),
+										dst + z0 * plane, &region } );
+			}
+			job_cv.notify_all();
+			done_cv.wait( lk, [&] { return region.pending == 0; } );
+		}
+		if ( region.error ) {
+			std::rethrow_exception( region.error );
+		}
+	}
+
+private:
+	struct Region
+	{
+		uint32_t pending;
+		exception_ptr error;
+	};
+	struct Job
+	{
+		Vec3i start;
+		Size3 size;
+		unsigned char *dst;
+		Region *region;
+	};
+
+	void work_loop( RawReaderIO &reader )
+	{
+		while ( true ) {
+			Job job;
+			{
+				unique_lock<mutex> lk( mut );
+				job_cv.wait( lk, [this] { return should_stop || jobs.size(); } );
+				if ( jobs.empty() ) return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			exception_ptr error;
+			try {
+				reader.readRegion( job.start, job.size, job.dst );
+			} catch ( ... ) {
+				error = std::current_exception();
+			}
+			{
+				unique_lock<mutex> lk( mut );
+				if ( error && not job.region->error ) {
+					job.region->error = error;
+				}
+				--job.region->pending;
+				done_cv.notify_all();
+			}
+		}
+	}
+
+private:
+	size_t voxel_size;
+	vector<unique_ptr<RawReaderIO>> readers;
+	deque<Job> jobs;
+	bool should_stop = false;
+	mutex mut;
+	condition_variable job_cv, done_cv;
+	vector<thread> workers;
+};
+
+/* sparse sources have no raw input file */
+static RegionSource file_source( ArchiverOptions const &opts )
+{
+	if ( opts.input == "" ) {
+		return nullptr;
+	}
+	const size_t voxel_size = input_voxel_size( opts );
+	if ( opts.io_threads <= 1 ) {
+		auto reader = make_shared<RawReaderIO>( opts.input, Size3( opts.x, opts.y, opts.z ), voxel_size );
+		return [=]( Idx const &start, Idx const &size, unsigned char *dst ) {
+			reader->readRegion( Vec3i( start.x, start.y, start.z ), Size3( size.x, size.y, size.z ), dst );
+		};
+	}
+	auto pool = make_shared<RegionReaderPool>( opts, voxel_size );
+	vm::println( "read input with {} thread(s)", opts.io_threads );
+	return [=]( Idx const &start, Idx const &size, unsigned char *dst ) {
+		pool->read( start, size, dst );
+	};
+}
+
+static RegionSource reader_source( ArchiverOptions const &opts, Reader &input )
+{
+	const size_t voxel_size = input_voxel_size( opts );
+	const Idx raw = Idx{}.set_x( opts.x ).set_y( opts.y ).set_z( opts.z );
+	if ( input.size() < raw.total() * voxel_size ) {
+		throw runtime_error( vm::fmt( "input has {} byte(s), expected {}",
+									  input.size(), raw.total() * voxel_size ) );
+	}
+	return [&input, raw, voxel_size]( Idx const &start, Idx const &size, unsigned char *dst ) {
+		/* rows spanning raw.x are contiguous in the input, as are slices spanning raw.y */
+		const bool full_rows = size.x == raw.x;
+		const bool full_slices = full_rows && size.y == raw.y;
+		const uint32_t nz = full_slices ? 1 : size.z;
+		const uint32_t ny = full_rows ? 1 : size.y;
+		const size_t len = size_t( size.x ) * ( size.y / ny ) * ( size.z / nz ) * voxel_size;
+		for ( uint32_t z = 0; z != nz; ++z ) {
+			for ( uint32_t y = 0; y != ny; ++y ) {
+				input.seek( ( ( uint64_t( start.z + z ) * raw.y + start.y + y ) * raw.x + start.x ) * voxel_size );
+				if ( input.read( reinterpret_cast<char *>( dst ), len ) != len ) {
+					throw runtime_error( "unexpected end of input" );
+				}
+				dst += len;
+			}
+		}
+	};
+}
+
+/* forwards the frames written to the body and checksums each of them once
+   its end is known from frame_offset, keeping only the bytes of frames
+   not yet checksummed */
+struct ChecksumWriter : Writer
+{
+	ChecksumWriter( Writer &_ ) :
+	  _( _ )
+	{
+	}
+
+	void seek( size_t pos ) override
+	{
+		_.seek( pos );
+	}
+	size_t tell() const override
+	{
+		return _.tell();
+	}
+	size_t size() const override
+	{
+		return _.size();
+	}
+	void write( char const *src, size_t len ) override
+	{
+		unique_lock<mutex> lk( mut );
+		pending.insert( pending.end(), src, src + len );
+		_.write( src, len );
+	}
+
+	/* the compressor must be idle, so that frame_offset is stable */
+	void checksum( vector<uint64_t> const &frame_offset )
+	{
+		unique_lock<mutex> lk( mut );
+		const auto base = frame_offset[ crc.size() ];
+		while ( crc.size() + 1 < frame_offset.size() &&
+				frame_offset[ crc.size() + 1 ] - base <= pending.size() ) {
+			const auto beg = frame_offset[ crc.size() ] - base;
+			crc.emplace_back( crc32c( pending.data() + beg, frame_offset[ crc.size() + 1 ] - base - beg ) );
+		}
+		pending.erase( pending.begin(), pending.begin() + ( frame_offset[ crc.size() ] - base ) );
+	}
+
+public:
+	vector<uint32_t> crc;
+
+private:
+	Writer &_;
+	mutex mut;
+	vector<char> pending;
+};
+
 struct ArchiverImpl final : vm::NoCopy, vm::NoMove
 {
 private:
 	size_t log_block_size, block_size, block_inner, padding;
 	Idx raw, dim, adjusted;
+	EncodeMethod encode_method;
+	/* bytes per voxel of one channel, buffers below are raw bytes */
+	size_t voxel_bytes;
+	/* input voxels interleave all channels, which are split into one block each */
+	size_t channels, input_voxel_bytes;
 
 	const size_t nvoxels_per_block;
 	const int ncols, nrows, nslices;
+	int slice_begin, slice_end;
+	/* adaptive bricking merges homogeneous octree nodes up to max_level */
+	size_t max_level, homogeneity;
 	int ncols_per_stride, nrows_per_stride, stride_interval;
 	int nblocks_per_stride, nrow_iters;
 	size_t buffer_size;
 
-	RawReaderIO input;
-	ofstream output;
+	RegionSource input;
+	/* archives to a file unless given a writer */
+	ofstream output_file;
+	unique_ptr<Writer> file_writer;
+	Writer &output;
 
-	vol::UnboundedStreamWriter body_writer;
-	VideoCompressor video_compressor;
+	PartWriter body_writer;
+	/* frames are written through checksum_writer, the footer is not */
+	ChecksumWriter checksum_writer;
+	/* h264 blocks are decoded right after encoding when max_error >= 0 or
+	   residuals are stored, the frames of a stride are staged until verified */
+	const int max_error;
+	const bool residual;
+	const bool verify;
+	vector<char> staging;
+	UnboundedVectorWriter staging_writer;
+	unique_ptr<ICompressor> compressor;
+	unique_ptr<IDecoder> verifier;
 
 	vector<char> read_buffer, write_buffer;
+	vector<char> region_buffer;
 	atomic<size_t> read_blocks = 0;
 	size_t written_blocks = 0;
 	vm::Timer t;
 
-	map<Idx, BlockIndex> block_idx;
+	/* one index per channel */
+	vector<map<Idx, BlockIndex>> block_idx;
+
+	struct Pending
+	{
+		uint32_t channel;
+		Idx idx;
+		char const *src;
+	};
+	vector<Pending> pending;
+	uint32_t verified_frames = 0;
+	vector<unsigned char> decoded;
+	/* palette frames stored after all video frames, holding blocks over
+	   max_error and residuals */
+	PaletteEncoder palette_encoder;
+	vector<unsigned char> palette_chunk, residual_buffer;
+	vector<char> palette_body;
+	vector<uint64_t> palette_offset = { 0 };
+	size_t nfallbacks = 0;
+	vector<map<Idx, uint32_t>> residual_idx;
+	/* statistics of every accepted block, computed while it is in cache */
+	const bool block_stats;
+	const uint32_t histogram_bins;
+	vector<map<Idx, BlockStats>> stats_idx;
+	/* sampled from every accepted block, one volume per channel */
+	PreviewSampler preview_sampler;
+	vector<char> preview;
+	/* uint16 input is read into quantize_buffer and mapped to 8 bits */
+	const bool quantize;
+	Quantizer quantizer;
+	vector<uint16_t> quantize_buffer;
+	vector<float> transfer;
+	/* with padding, neighbouring strides overlap by 2 * padding planes along z
+	   and rows along y, the overlap read for one stride is kept for the next */
+	struct Halo
+	{
+		Idx start, size;
+		vector<char> data;
+	};
+	bool reuse_halo;
+	/* planes shared with the next slice, by (row iteration, rep) */
+	map<pair<int, int>, Halo> z_halo;
+	/* rows shared with the next row iteration of the slice, by rep */
+	map<int, Halo> y_halo;
+	vector<char> halo_buffer;
+	size_t read_bytes = 0;
+	ProgressCallback on_progress;
+	chrono::steady_clock::time_point started;
+	atomic<bool> cancelled = false;
+	size_t slices_done;
 
 public:
-	ArchiverImpl( ArchiverOptions const &opts ) :
+	ArchiverImpl( ArchiverOptions const &opts, RegionSource const &input, Writer *out ) :
 	  log_block_size( opts.log_block_size ),
 	  block_size( 1 << opts.log_block_size ),
 	  block_inner( block_size - 2 * opts.padding ),
@@ -55,26 +359,94 @@ public:
 				  .set_x( dim.x * block_size )
 				  .set_y( dim.y * block_size )
 				  .set_z( dim.z * block_size ) ),
+	  encode_method( opts.encode_method ),
+	  voxel_bytes( Header{}.set_encode_method( encode_method ).voxel_size() ),
+	  channels( opts.channels ),
+	  input_voxel_bytes( voxel_bytes * channels ),
 	  nvoxels_per_block( block_size * block_size * block_size ),
 	  ncols( dim.x ),
 	  nrows( dim.y ),
 	  nslices( dim.z ),
-	  input( opts.input, Size3( raw.x, raw.y, raw.z ), sizeof( Voxel ) ),
-	  output( opts.output, ios::binary ),
-	  body_writer( output, sizeof( Header ) ),
-	  video_compressor( body_writer, opts.compress_opts )
+	  slice_begin( opts.slice_begin ),
+	  slice_end( std::min( opts.slice_end, size_t( dim.z ) ) ),
+	  max_level( opts.max_block_level ),
+	  homogeneity( opts.homogeneity ),
+	  input( input ),
+	  output_file( out ? ofstream() : ofstream( opts.output, ios::binary ) ),
+	  file_writer( out ? nullptr : new UnboundedStreamWriter( output_file ) ),
+	  output( out ? *out : *file_writer ),
+	  body_writer( output, sizeof( Header ), output.size() - sizeof( Header ) ),
+	  checksum_writer( body_writer ),
+	  max_error( opts.max_error ),
+	  residual( opts.residual && encode_method == EncodeMethod::H264 ),
+	  verify( ( max_error >= 0 || residual ) && encode_method == EncodeMethod::H264 ),
+	  staging_writer( staging ),
+	  compressor( create_compressor( verify ? (Writer &)staging_writer : checksum_writer,
+									 opts, nvoxels_per_block ) ),
+	  block_stats( opts.block_stats ),
+	  histogram_bins( opts.block_stats ? opts.histogram_bins : 0 ),
+	  preview_sampler( raw, PreviewSampler::scale_for( raw, opts.preview_size ), block_size, block_inner, padding ),
+	  quantize( opts.quantize.mode != Quantize::None ),
+	  transfer( opts.transfer ),
+	  on_progress( opts.on_progress ),
+	  slices_done( slice_begin )
 	{
 		if ( padding < 0 || padding > 2 ) {
 			throw runtime_error( "unsupported padding" );
 		}
-		if ( not output.is_open() ) {
+		if ( not out && not output_file.is_open() ) {
 			throw runtime_error( "can not open output file" );
 		}
+		if ( slice_begin >= slice_end ) {
+			throw runtime_error( vm::fmt( "invalid slice range: [{}, {})", slice_begin, slice_end ) );
+		}
+		if ( channels < 1 || channels > 256 ) {
+			throw runtime_error( vm::fmt( "unsupported channel count: {}", channels ) );
+		}
+		block_idx.resize( channels );
+		if ( residual ) {
+			residual_idx.resize( channels );
+		}
+		if ( block_stats ) {
+			stats_idx.resize( channels );
+		}
+		preview.resize( channels * preview_sampler.dim.total() * voxel_bytes );
+		if ( histogram_bins > 256 ) {
+			throw runtime_error( vm::fmt( "unsupported histogram bins: {}", histogram_bins ) );
+		}
+		if ( histogram_bins && encode_method != EncodeMethod::H264 ) {
+			throw runtime_error( "histograms are not supported for label volumes" );
+		}
+		if ( opts.frame_alignment & ( opts.frame_alignment - 1 ) || opts.frame_alignment > ( 1u << 30 ) ) {
+			throw runtime_error( vm::fmt( "unsupported frame alignment: {}", opts.frame_alignment ) );
+		}
+		if ( max_level && encode_method != EncodeMethod::H264 ) {
+			throw runtime_error( "adaptive bricking is not supported for label volumes" );
+		}
+		if ( max_level && channels > 1 ) {
+			throw runtime_error( "adaptive bricking is not supported for multi-channel volumes" );
+		}
+		if ( max_level && residual ) {
+			throw runtime_error( "adaptive bricking is not supported with residuals" );
+		}
+		if ( quantize && encode_method != EncodeMethod::H264 ) {
+			throw runtime_error( "quantization is not supported for label volumes" );
+		}
+		if ( max_level > 8 ) {
+			throw runtime_error( vm::fmt( "unsupported max block level: {}", max_level ) );
+		}
+		/* octree cells must not straddle the boundary of a slice range */
+		if ( slice_begin % ( 1 << max_level ) ||
+			 slice_end % ( 1 << max_level ) && slice_end != nslices ) {
+			throw runtime_error( vm::fmt( "slice range [{}, {}) not aligned to {} with max block level {}",
+										  slice_begin, slice_end, 1 << max_level, max_level ) );
+		}
 
 		size_t gb_to_bytes = size_t( 1024 ) /*Mb*/ * 1024 /*Kb*/ * 1024 /*Bytes*/;
-		size_t block_size_in_bytes = sizeof( Voxel ) * nvoxels_per_block;
+		size_t block_size_in_bytes = input_voxel_bytes * nvoxels_per_block;
 		size_t mem_size_in_bytes = opts.suggest_mem_gb * gb_to_bytes;
-		int nblocks_in_mem = mem_size_in_bytes / block_size_in_bytes / 2 /*two buffers*/;
+		/* two buffers, plus decoded frames when verifying and uint16 voxels when quantizing */
+		int nblocks_in_mem = mem_size_in_bytes / block_size_in_bytes / ( 2 + verify + 2 * quantize );
 		if ( not nblocks_in_mem ) {
 			throw runtime_error( "total memory < block size" );
 		}
@@ -85,6 +457,16 @@ public:
 		vm::println( "padding: {}", padding );
 		vm::println( "dim: {}", dim );
 		vm::println( "adjusted: {}", adjusted );
+		vm::println( "voxel bytes: {}", voxel_bytes );
+		vm::println( "channels: {}", channels );
+		if ( verify ) {
+			verifier = create_decoder( DecodeOptions{}.set_device( opts.compress_opts.device ) );
+			vm::println( "verify blocks with max error: {}, residuals: {}", max_error, residual );
+		}
+		if ( quantize && input ) {
+			quantizer.build( input, raw, channels, opts.quantize );
+			transfer = quantizer.transfer;
+		}
 
 		// const int maxBlocksPerStride = 2;
 		// nblocks_in_mem = std::min( nblocks_in_mem, maxBlocksPerStride );
@@ -103,10 +485,28 @@ public:
 
 		nrow_iters = RoundUpDivide( nrows, nrows_per_stride );
 
-		vm::println( "total strides: {}", nrow_iters * stride_interval * nslices );
+		vm::println( "slice range: [{}, {}) of {}", slice_begin, slice_end, nslices );
+		vm::println( "total strides: {}", nrow_iters * stride_interval * ( slice_end - slice_begin ) );
 
 		// since read_buffer is no larger than write_buffer
-		buffer_size = nvoxels_per_block * nblocks_per_stride;
+		buffer_size = input_voxel_bytes * nvoxels_per_block * nblocks_per_stride;
+
+		/* z halos cover the whole xy extent of a slice */
+		const size_t halo_bytes = input_voxel_bytes * adjusted.x * adjusted.y * 2 * padding;
+		reuse_halo = padding && halo_bytes <= mem_size_in_bytes - 2 * buffer_size;
+		if ( reuse_halo ) {
+			vm::println( "reuse halo of {} byte(s) between strides", halo_bytes );
+		}
+
+		if ( max_level ) {
+			const size_t cell_blocks = 1 << ( 3 * max_level );
+			const size_t cell_extent = ( block_inner << max_level ) + 2 * padding;
+			buffer_size = cell_extent * cell_extent * cell_extent;
+			if ( ( buffer_size + cell_blocks * nvoxels_per_block ) * sizeof( Voxel ) > mem_size_in_bytes ) {
+				throw runtime_error( vm::fmt( "total memory < octree cell size, max block level {} too large", max_level ) );
+			}
+			vm::println( "adaptive bricking: max level {}, homogeneity {}", max_level, homogeneity );
+		}
 	}
 	~ArchiverImpl()
 	{
@@ -194,98 +594,734 @@ public:
 		vm::println( "dxy: {}", Vec2i( dx, dy ) );
 
 		/* always read region into buffer[0..] */
-		input.readRegion(
-		  region_start, region_size,
-		  reinterpret_cast<unsigned char *>( read_buffer.data() ) );
+		read_stride_region( it, rep, region_start, region_size,
+							raw_region_start.y + int( nrows_per_stride * block_inner ),
+							raw_region_start.z + int( block_inner ),
+							read_buffer.data() );
 
 		/* transfer overflowed into correct position */
 		if ( overflow ) {
 			memset( write_buffer.data(), 0,
-					sizeof( Voxel ) * nvoxels_per_block * nblocks_per_stride );
+					input_voxel_bytes * nvoxels_per_block * nblocks_per_stride );
 			auto dst = write_buffer.data();
 			auto src = read_buffer.data();
 			for ( size_t dep = 0; dep < region_size.z; ++dep ) {
-				auto slice_dst = dst + dep * raw_region_size.x * raw_region_size.y;
-				auto slice_src = src + dep * region_size.x * region_size.y;
+				auto slice_dst = dst + input_voxel_bytes * dep * raw_region_size.x * raw_region_size.y;
+				auto slice_src = src + input_voxel_bytes * dep * region_size.x * region_size.y;
 				for ( size_t i = 0; i < region_size.y; ++i ) {
 					memcpy(
-					  slice_dst + dz * raw_region_size.x * raw_region_size.y +
-						( i + dy ) * raw_region_size.x + dx, /*x'_i*/
-					  slice_src + i * region_size.x,		 /*x_i*/
-					  region_size.x * sizeof( Voxel ) );
+					  slice_dst + input_voxel_bytes * ( dz * raw_region_size.x * raw_region_size.y +
+												  ( i + dy ) * raw_region_size.x + dx ), /*x'_i*/
+					  slice_src + input_voxel_bytes * i * region_size.x,					   /*x_i*/
+					  region_size.x * input_voxel_bytes );
 				}
 			}
 			write_buffer.swap( read_buffer );
 		}
+		const auto block_bytes = voxel_bytes * nvoxels_per_block;
+		const auto block_at = [&]( int dblkid ) {
+			const auto blkid = blkid_base + dblkid;
+			return Idx{}
+			  .set_x( blkid % dim.x )
+			  .set_y( blkid / dim.x % dim.y )
+			  .set_z( blkid / ( dim.x * dim.y ) % dim.z );
+		};
 		for ( int yb = 0; yb < stride_size.y; yb++ ) {
 			for ( int xb = 0; xb < stride_size.x; xb++ ) {
 				const int dblkid = xb + yb * stride_size.x;
-				const auto dst = write_buffer.data() + dblkid * nvoxels_per_block;
-				const auto src = read_buffer.data() + xb * block_inner + yb * block_inner * raw_region_size.x;
+				/* channel c of the block is at dst + c * block_bytes */
+				const auto dst = write_buffer.data() + channels * dblkid * block_bytes;
+				const auto src = read_buffer.data() + input_voxel_bytes * ( xb * block_inner + yb * block_inner * raw_region_size.x );
 
 				for ( size_t dep = 0; dep < block_size; ++dep ) {
-					auto slice_dst = dst + dep * block_size * block_size;
-					auto slice_src = src + dep * raw_region_size.x * raw_region_size.y;
+					auto slice_dst = dst + voxel_bytes * dep * block_size * block_size;
+					auto slice_src = src + input_voxel_bytes * dep * raw_region_size.x * raw_region_size.y;
 					for ( size_t row = 0; row < block_size; ++row ) {
-						memcpy(
-						  slice_dst + row * block_size,
-						  slice_src + row * raw_region_size.x,
-						  block_size * sizeof( Voxel ) );
+						deinterleave( slice_src + input_voxel_bytes * row * raw_region_size.x,
+									  slice_dst + voxel_bytes * row * block_size,
+									  block_size );
 					}
 				}
 				++read_blocks;
-
-				const auto blkid = blkid_base + dblkid;
-				const auto idx = Idx{}
-								   .set_x( blkid % dim.x )
-								   .set_y( blkid / dim.x % dim.y )
-								   .set_z( blkid / ( dim.x * dim.y ) % dim.z );
-				// auto dp = reinterpret_cast<uint8_t *>( dst );
-				// vm::println( "${}: { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} ...", blkid, int( dp[ 0 ] ), int( dp[ 1 ] ), int( dp[ 2 ] ),
-				// 			 int( dp[ 3 ] ), int( dp[ 4 ] ), int( dp[ 5 ] ), int( dp[ 6 ] ),
-				// 			 int( dp[ 7 ] ), int( dp[ 8 ] ), int( dp[ 9 ] ) );
-				block_idx[ idx ] = video_compressor.accept(
-				  vm::Arc<Reader>( new SliceReader( dst, nvoxels_per_block ) ) );
-			}
-		}
-		video_compressor.flush( true );
-		// vm::println( "{}", video_compressor.frame_len() );
+			}
+		}
+		/* channel by channel, so that consecutive frames hold similar data */
+		for ( size_t c = 0; c != channels; ++c ) {
+			for ( int dblkid = 0; dblkid != stride_size.x * stride_size.y; ++dblkid ) {
+				accept_block( c, block_at( dblkid ),
+							  write_buffer.data() + ( channels * dblkid + c ) * block_bytes );
+			}
+		}
+		end_batch();
 		vm::println( "handled {} blocks", read_blocks );
 	}
 
+	void accept_block( uint32_t channel, Idx const &idx, char const *src, unsigned level = 0 )
+	{
+		block_idx[ channel ][ idx ] = compressor->accept(
+										vm::Arc<Reader>( new SliceReader( src, voxel_bytes * nvoxels_per_block ) ) )
+										.set_level( level );
+		if ( verify ) {
+			pending.emplace_back( Pending{ channel, idx, src } );
+		}
+		if ( block_stats ) {
+			stats_idx[ channel ][ idx ] = compute_stats( src );
+		}
+		sample_preview( channel, idx, level, src );
+	}
+
+	void sample_preview( uint32_t channel, Idx const &idx, unsigned level, char const *src )
+	{
+		const auto channel_bytes = preview.size() / channels;
+		preview_sampler.sample( idx, level, src, voxel_bytes, voxel_bytes, preview.data() + channel * channel_bytes );
+	}
+
+	BlockStats compute_stats( char const *src ) const
+	{
+		BlockStats stats;
+		if ( voxel_bytes == sizeof( uint32_t ) ) {
+			const auto labels = reinterpret_cast<uint32_t const *>( src );
+			const auto range = std::minmax_element( labels, labels + nvoxels_per_block );
+			return stats.set_min( *range.first )
+			  .set_max( *range.second )
+			  .set_mean( std::accumulate( labels, labels + nvoxels_per_block, 0.0 ) / nvoxels_per_block );
+		}
+		/* a full histogram of the codes gives the rest in 256 steps */
+		uint32_t counts[ 256 ] = {};
+		const auto codes = reinterpret_cast<unsigned char const *>( src );
+		for ( size_t i = 0; i != nvoxels_per_block; ++i ) {
+			++counts[ codes[ i ] ];
+		}
+		uint64_t sum = 0;
+		bool seen = false;
+		stats.histogram.resize( histogram_bins );
+		for ( uint32_t v = 0; v != 256; ++v ) {
+			if ( not counts[ v ] ) continue;
+			if ( not seen ) {
+				stats.min = v;
+				seen = true;
+			}
+			stats.max = v;
+			sum += uint64_t( v ) * counts[ v ];
+			if ( histogram_bins ) {
+				stats.histogram[ v * histogram_bins >> 8 ] += counts[ v ];
+			}
+		}
+		stats.mean = double( sum ) / nvoxels_per_block;
+		return stats;
+	}
+
+	/* after a stride or cell, its blocks are no longer referenced */
+	void end_batch()
+	{
+		if ( not verify ) {
+			compressor->flush( true );
+		} else {
+			/* pad to a frame boundary so that every pending block is decodable */
+			compressor->wait();
+			verify_pending();
+		}
+		/* the compressor is idle until the next block is accepted */
+		checksum_writer.checksum( compressor->frame_offset() );
+	}
+
+	/* decodes the staged frames, stores every block whose maximum absolute
+	   error exceeds max_error with the lossless palette codec instead and
+	   the residual of the others if requested */
+	void verify_pending()
+	{
+		const size_t frame_size = compressor->frame_size();
+		const auto nframes = compressor->frame_count() - verified_frames;
+		decoded.resize( nframes * frame_size );
+		size_t len = 0;
+		SliceReader reader( staging.data(), staging_writer.tell() );
+		verifier->decode( reader, [&]( Packet const &packet ) {
+			if ( len + packet.length > decoded.size() ) {
+				throw runtime_error( "verifier decoded more frames than encoded" );
+			}
+			packet.copy_to( cufx::MemoryView1D<unsigned char>( decoded.data() + len, packet.length ) );
+			len += packet.length;
+		} );
+		if ( len != decoded.size() ) {
+			throw runtime_error( vm::fmt( "verifier decoded {} / {} byte(s)", len, decoded.size() ) );
+		}
+
+		residual_buffer.resize( nvoxels_per_block );
+		for ( auto &block : pending ) {
+			auto &entry = block_idx[ block.channel ][ block.idx ];
+			auto src = reinterpret_cast<unsigned char const *>( block.src );
+			auto dec = decoded.data() + size_t( entry.first_frame - verified_frames ) * frame_size + entry.offset;
+			int err = 0;
+			for ( size_t i = 0; i != nvoxels_per_block; ++i ) {
+				err = std::max( err, std::abs( int( src[ i ] ) - int( dec[ i ] ) ) );
+			}
+			if ( max_error >= 0 && err > max_error ) {
+				/* frame numbers are rebased past the video frames in finish */
+				const auto frame = append_palette_frame( src );
+				entry.set_first_frame( frame )
+				  .set_last_frame( frame )
+				  .set_offset( 0 )
+				  .set_codec( BlockCodec::Palette );
+				++nfallbacks;
+			} else if ( residual && err ) {
+				for ( size_t i = 0; i != nvoxels_per_block; ++i ) {
+					residual_buffer[ i ] = src[ i ] - dec[ i ];
+				}
+				residual_idx[ block.channel ][ block.idx ] = append_palette_frame( residual_buffer.data() );
+			}
+		}
+		pending.clear();
+
+		checksum_writer.write( staging.data(), staging_writer.tell() );
+		staging_writer.seek( 0 );
+		verified_frames = compressor->frame_count();
+	}
+
+	uint32_t append_palette_frame( unsigned char const *src )
+	{
+		palette_encoder.encode( src, nvoxels_per_block, palette_chunk );
+		const auto frame = uint32_t( palette_offset.size() - 1 );
+		const auto chunk_len = uint32_t( palette_chunk.size() );
+		palette_body.insert( palette_body.end(), reinterpret_cast<char const *>( &chunk_len ),
+							 reinterpret_cast<char const *>( &chunk_len ) + sizeof( chunk_len ) );
+		palette_body.insert( palette_body.end(), palette_chunk.begin(), palette_chunk.end() );
+		palette_offset.emplace_back( palette_body.size() );
+		return frame;
+	}
+
+	void read_region( Vec3i const &start, Size3 const &size, unsigned char *dst )
+	{
+		const auto idx = Idx{}.set_x( start.x ).set_y( start.y ).set_z( start.z );
+		const auto len = Idx{}.set_x( size.x ).set_y( size.y ).set_z( size.z );
+		if ( not quantize ) {
+			read_bytes += len.total() * input_voxel_bytes;
+			return input( idx, len, dst );
+		}
+		const auto n = len.total() * channels;
+		read_bytes += n * sizeof( uint16_t );
+		quantize_buffer.resize( n );
+		input( idx, len, reinterpret_cast<unsigned char *>( quantize_buffer.data() ) );
+		quantizer.map( quantize_buffer.data(), dst, n );
+	}
+
+	/* reads a clamped stride region like read_region, taking the planes and rows
+	   it shares with the previous strides from their halos, and keeps those it
+	   shares with the next strides, which start at y_next and z_next */
+	void read_stride_region( int it, int rep, Vec3i const &start, Size3 const &size,
+							 int y_next, int z_next, char *dst )
+	{
+		const auto at = [&]( int y, int z ) { return Idx{}.set_x( start.x ).set_y( y ).set_z( z ); };
+		const int y1 = start.y + size.y, z1 = start.z + size.z;
+		const size_t row = input_voxel_bytes * size.x, plane = row * size.y;
+		if ( not reuse_halo ) {
+			return read_region( start, size, reinterpret_cast<unsigned char *>( dst ) );
+		}
+
+		/* leading planes from the previous slice */
+		int z = start.z;
+		auto &zh = z_halo[ make_pair( it, rep ) ];
+		if ( zh.start == at( start.y, z ) && zh.size.x == size.x && zh.size.y == size.y ) {
+			const int n = std::min( int( zh.size.z ), z1 - z );
+			memcpy( dst, zh.data.data(), n * plane );
+			z += n;
+		}
+
+		/* leading rows of the remaining planes from the previous row iteration */
+		int y = start.y;
+		auto &yh = y_halo[ rep ];
+		const auto nz = z1 - z;
+		if ( nz && yh.start == at( y, z ) && yh.size.x == size.x && yh.size.z == nz ) {
+			const int n = std::min( int( yh.size.y ), y1 - y );
+			for ( int k = 0; k != nz; ++k ) {
+				memcpy( dst + ( z - start.z + k ) * plane, yh.data.data() + k * yh.size.y * row, n * row );
+			}
+			y += n;
+		}
+		if ( nz && y < y1 ) {
+			const auto rest = Size3( size.x, y1 - y, nz );
+			const auto rest_start = Vec3i( start.x, y, z );
+			if ( y == start.y ) {
+				read_region( rest_start, rest, reinterpret_cast<unsigned char *>( dst + ( z - start.z ) * plane ) );
+			} else {
+				halo_buffer.resize( row * rest.y * nz );
+				read_region( rest_start, rest, reinterpret_cast<unsigned char *>( halo_buffer.data() ) );
+				for ( int k = 0; k != nz; ++k ) {
+					memcpy( dst + ( z - start.z + k ) * plane + ( y - start.y ) * row,
+							halo_buffer.data() + k * rest.y * row, rest.y * row );
+				}
+			}
+		}
+
+		/* trailing planes and rows of this stride lead the next ones */
+		const int zk = std::max( z_next, int( start.z ) );
+		if ( zk < z1 ) {
+			zh.start = at( start.y, zk );
+			zh.size = Idx{}.set_x( size.x ).set_y( size.y ).set_z( z1 - zk );
+			zh.data.assign( dst + ( zk - start.z ) * plane, dst + size.z * plane );
+		} else {
+			z_halo.erase( make_pair( it, rep ) );
+		}
+		const int yk = std::max( y_next, int( start.y ) );
+		if ( nz && yk < y1 ) {
+			yh.start = at( yk, z );
+			yh.size = Idx{}.set_x( size.x ).set_y( y1 - yk ).set_z( nz );
+			yh.data.resize( nz * yh.size.y * row );
+			for ( int k = 0; k != nz; ++k ) {
+				memcpy( yh.data.data() + k * yh.size.y * row,
+						dst + ( z - start.z + k ) * plane + ( yk - start.y ) * row, yh.size.y * row );
+			}
+		} else {
+			y_halo.erase( rep );
+		}
+	}
+
+	void report_progress( size_t blocks_total )
+	{
+		if ( not on_progress ) {
+			return;
+		}
+		const auto dt = chrono::duration<double>( chrono::steady_clock::now() - started ).count();
+		const size_t done = read_blocks;
+		on_progress( ArchiveProgress{}
+					   .set_blocks_done( done )
+					   .set_blocks_total( blocks_total )
+					   .set_bytes_in( read_bytes )
+					   .set_bytes_out( compressor->frame_offset().back() + palette_body.size() )
+					   .set_throughput( dt > 0 ? read_bytes / dt / ( 1 << 20 ) : 0 )
+					   .set_eta( done && blocks_total > done ? dt * ( blocks_total - done ) / done : 0 )
+					   .set_slices_done( slices_done ) );
+	}
+
+	/* drops the blocks of slices [slices_done, ...) converted before a cancel,
+	   their frames are left unreferenced until the archive is compacted */
+	void drop_incomplete_slices()
+	{
+		const auto incomplete = [this]( Idx const &idx ) { return idx.z >= slices_done; };
+		size_t ndropped = 0;
+		for ( auto &index : block_idx ) {
+			for ( auto it = index.begin(); it != index.end(); ) {
+				it = incomplete( it->first ) ? ( ++ndropped, index.erase( it ) ) : std::next( it );
+			}
+		}
+		for ( auto &index : residual_idx ) {
+			for ( auto it = index.begin(); it != index.end(); ) {
+				it = incomplete( it->first ) ? index.erase( it ) : std::next( it );
+			}
+		}
+		for ( auto &index : stats_idx ) {
+			for ( auto it = index.begin(); it != index.end(); ) {
+				it = incomplete( it->first ) ? index.erase( it ) : std::next( it );
+			}
+		}
+		const auto channel_bytes = preview.size() / channels;
+		for ( size_t c = 0; c != channels && channel_bytes; ++c ) {
+			preview_sampler.clear_from( slices_done, voxel_bytes, preview.data() + c * channel_bytes );
+		}
+		vm::println( "cancelled, kept slices [{}, {}), dropped {} block(s)", slice_begin, slices_done, ndropped );
+	}
+
+	void cancel()
+	{
+		cancelled = true;
+	}
+
+	/* splits n interleaved input voxels into the channels of a block */
+	void deinterleave( char const *src, char *dst, size_t n ) const
+	{
+		if ( channels == 1 ) {
+			memcpy( dst, src, n * voxel_bytes );
+			return;
+		}
+		const auto block_bytes = voxel_bytes * nvoxels_per_block;
+		for ( size_t c = 0; c != channels; ++c ) {
+			auto plane = dst + c * block_bytes;
+			auto p = src + c * voxel_bytes;
+			if ( voxel_bytes == 1 ) {
+				for ( size_t i = 0; i != n; ++i, p += channels ) {
+					plane[ i ] = *p;
+				}
+			} else {
+				for ( size_t i = 0; i != n; ++i, p += input_voxel_bytes ) {
+					memcpy( plane + i * voxel_bytes, p, voxel_bytes );
+				}
+			}
+		}
+	}
+
+	/* reads region [start, start + size) of raw, voxels outside raw are zero */
+	void read_padded_region( Vec3i const &start, Size3 const &size, Voxel *dst )
+	{
+		const Vec3i lo( std::max( start.x, 0 ),
+						std::max( start.y, 0 ),
+						std::max( start.z, 0 ) );
+		const Vec3i hi( std::min( start.x + int( size.x ), int( raw.x ) ),
+						std::min( start.y + int( size.y ), int( raw.y ) ),
+						std::min( start.z + int( size.z ), int( raw.z ) ) );
+		if ( lo.x == start.x && lo.y == start.y && lo.z == start.z &&
+			 hi.x == start.x + size.x && hi.y == start.y + size.y && hi.z == start.z + size.z ) {
+			read_region( start, size, reinterpret_cast<unsigned char *>( dst ) );
+			return;
+		}
+		memset( dst, 0, voxel_bytes * size.Prod() );
+		if ( hi.x <= lo.x || hi.y <= lo.y || hi.z <= lo.z ) {
+			return;
+		}
+		const Size3 clamped( hi.x - lo.x, hi.y - lo.y, hi.z - lo.z );
+		region_buffer.resize( voxel_bytes * clamped.Prod() );
+		read_region( lo, clamped, reinterpret_cast<unsigned char *>( region_buffer.data() ) );
+		const auto d = lo - start;
+		for ( size_t z = 0; z < clamped.z; ++z ) {
+			for ( size_t y = 0; y < clamped.y; ++y ) {
+				memcpy( dst + voxel_bytes * ( ( ( z + d.z ) * size.y + y + d.y ) * size.x + d.x ),
+						region_buffer.data() + voxel_bytes * ( z * clamped.y + y ) * clamped.x,
+						clamped.x * voxel_bytes );
+			}
+		}
+	}
+
+	struct NodeRange
+	{
+		unsigned char lo = 0xff, hi = 0;
+		bool valid = false, homogeneous = true;
+	};
+
+	/* archives one octree cell of 2^max_level blocks per axis, merging homogeneous
+	   nodes into a single block that holds the node downsampled by 2^level */
+	void cell_task( Idx const &cell )
+	{
+		const int S = 1 << max_level;
+		const int extent = S * block_inner + 2 * padding;
+		const auto cell_buffer = read_buffer.data();
+		read_padded_region( Vec3i( cell.x * block_inner - padding,
+								   cell.y * block_inner - padding,
+								   cell.z * block_inner - padding ),
+							Size3( extent, extent, extent ),
+							cell_buffer );
+
+		/* value range of every node, bottom up */
+		vector<vector<NodeRange>> levels( max_level + 1 );
+		levels[ 0 ].resize( S * S * S );
+		for ( int z = 0; z < S; ++z ) {
+			for ( int y = 0; y < S; ++y ) {
+				for ( int x = 0; x < S; ++x ) {
+					if ( cell.x + x >= dim.x || cell.y + y >= dim.y || cell.z + z >= dim.z ) continue;
+					auto &node = levels[ 0 ][ x + S * ( y + S * z ) ];
+					node.valid = true;
+					const auto src = cell_buffer + ( z * extent * extent + y * extent + x ) * block_inner;
+					for ( size_t dep = 0; dep < block_size; ++dep ) {
+						for ( size_t row = 0; row < block_size; ++row ) {
+							auto line = reinterpret_cast<unsigned char const *>( src + dep * extent * extent + row * extent );
+							auto mm = minmax_element( line, line + block_size );
+							node.lo = std::min( node.lo, *mm.first );
+							node.hi = std::max( node.hi, *mm.second );
+						}
+					}
+					node.homogeneous = node.hi - node.lo <= homogeneity;
+				}
+			}
+		}
+		for ( int l = 1, n = S >> 1; l <= max_level; ++l, n >>= 1 ) {
+			levels[ l ].resize( n * n * n );
+			for ( int i = 0; i < n * n * n; ++i ) {
+				auto &node = levels[ l ][ i ];
+				const int x = i % n, y = i / n % n, z = i / ( n * n );
+				for ( int c = 0; c < 8; ++c ) {
+					const int cn = n << 1;
+					auto &child = levels[ l - 1 ][ ( 2 * x + ( c & 1 ) ) +
+												   cn * ( ( 2 * y + ( c >> 1 & 1 ) ) +
+														  cn * ( 2 * z + ( c >> 2 ) ) ) ];
+					if ( not child.valid ) continue;
+					node.valid = true;
+					node.homogeneous = node.homogeneous && child.homogeneous;
+					node.lo = std::min( node.lo, child.lo );
+					node.hi = std::max( node.hi, child.hi );
+				}
+				node.homogeneous = node.homogeneous && node.hi - node.lo <= homogeneity;
+			}
+		}
+
+		size_t nblocks = 0;
+		std::function<void( int, int, int, int )> emit = [&]( int x, int y, int z, int l ) {
+			const int n = S >> l;
+			auto &node = levels[ l ][ ( x >> l ) + n * ( ( y >> l ) + n * ( z >> l ) ) ];
+			if ( not node.valid ) return;
+			if ( l > 0 && not node.homogeneous ) {
+				const int h = 1 << ( l - 1 );
+				for ( int c = 0; c < 8; ++c ) {
+					emit( x + ( c & 1 ) * h, y + ( c >> 1 & 1 ) * h, z + ( c >> 2 ) * h, l - 1 );
+				}
+				return;
+			}
+			const auto dst = write_buffer.data() + nblocks++ * nvoxels_per_block;
+			const auto src = cell_buffer + ( z * extent * extent + y * extent + x ) * block_inner;
+			const int f = 1 << l;
+			for ( size_t dep = 0; dep < block_size; ++dep ) {
+				for ( size_t row = 0; row < block_size; ++row ) {
+					auto line = dst + ( dep * block_size + row ) * block_size;
+					if ( l == 0 ) {
+						memcpy( line, src + dep * extent * extent + row * extent, block_size * sizeof( Voxel ) );
+						continue;
+					}
+					/* box filter, samples beyond the cell are never referenced by finer blocks */
+					for ( size_t col = 0; col < block_size; ++col ) {
+						size_t sum = 0, cnt = 0;
+						for ( int k = 0; k < f; ++k ) {
+							for ( int j = 0; j < f; ++j ) {
+								for ( int i = 0; i < f; ++i ) {
+									const size_t vx = x * block_inner + col * f + i;
+									const size_t vy = y * block_inner + row * f + j;
+									const size_t vz = z * block_inner + dep * f + k;
+									if ( vx >= extent || vy >= extent || vz >= extent ) continue;
+									sum += reinterpret_cast<unsigned char const &>(
+									  cell_buffer[ ( vz * extent + vy ) * extent + vx ] );
+									++cnt;
+								}
+							}
+						}
+						line[ col ] = cnt ? Voxel( ( sum + cnt / 2 ) / cnt ) : 0;
+					}
+				}
+			}
+			const auto idx = Idx{}
+							   .set_x( cell.x + x )
+							   .set_y( cell.y + y )
+							   .set_z( cell.z + z );
+			accept_block( 0, idx, dst, l );
+			read_blocks += 1 << ( 3 * l );
+		};
+		emit( 0, 0, 0, max_level );
+
+		end_batch();
+		vm::println( "cell {}: {} block(s), handled {} blocks", cell, nblocks, read_blocks );
+	}
+
+	void convert_adaptive()
+	{
+		const int S = 1 << max_level;
+		read_buffer.resize( buffer_size );
+		write_buffer.resize( nvoxels_per_block << ( 3 * max_level ) );
+		const size_t blocks_total = size_t( ncols ) * nrows * ( slice_end - slice_begin );
+		for ( int z = slice_begin; z < slice_end && not cancelled; z += S ) {
+			for ( int y = 0; y < nrows && not cancelled; y += S ) {
+				for ( int x = 0; x < ncols && not cancelled; x += S ) {
+					cell_task( Idx{}.set_x( x ).set_y( y ).set_z( z ) );
+					if ( y + S >= nrows && x + S >= ncols ) {
+						slices_done = std::min( z + S, slice_end );
+					}
+					report_progress( blocks_total );
+				}
+			}
+		}
+	}
+
 	bool convert()
 	{
+		if ( not input ) {
+			throw runtime_error( "no input file to convert" );
+		}
 		t.start();
+		started = chrono::steady_clock::now();
+
+		if ( max_level ) {
+			{
+				vm::Timer::Scoped t( [&]( auto dt ) {
+					vm::println( "total convert time: {}", dt.s() );
+				} );
+				convert_adaptive();
+				compressor->wait();
+			}
+			vector<char>{}.swap( read_buffer );
+			vector<char>{}.swap( write_buffer );
+			if ( cancelled ) {
+				drop_incomplete_slices();
+			}
+			vm::println( "adaptive bricking: {} block(s) for a grid of {}", block_idx[ 0 ].size(), dim.total() );
+			return finish() && not cancelled;
+		}
 
 		vm::println( "allocing buffers: {} byte(s) x 2 = {} Mb",
 					 buffer_size, buffer_size / 1024 /*Kb*/ / 1024 /*Mb*/ );
-		read_buffer.resize( nvoxels_per_block * nblocks_per_stride );
-		write_buffer.resize( nvoxels_per_block * nblocks_per_stride );
+		read_buffer.resize( buffer_size );
+		write_buffer.resize( buffer_size );
 
 		{
 			vm::Timer::Scoped t( [&]( auto dt ) {
 				vm::println( "total convert time: {}", dt.s() );
 			} );
 
-			atomic<bool> should_stop( false );
-			for ( int slice = 0; slice < nslices; slice++ ) {
-				for ( int it = 0; it < nrow_iters; ++it ) {
-					for ( int rep = 0; rep < stride_interval; ++rep ) {
+			const size_t blocks_total = size_t( ncols ) * nrows * ( slice_end - slice_begin );
+			for ( int slice = slice_begin; slice < slice_end && not cancelled; slice++ ) {
+				for ( int it = 0; it < nrow_iters && not cancelled; ++it ) {
+					for ( int rep = 0; rep < stride_interval && not cancelled; ++rep ) {
 						stride_read_task( slice, it, rep );
+						if ( it + 1 == nrow_iters && rep + 1 == stride_interval ) {
+							slices_done = slice + 1;
+						}
+						report_progress( blocks_total );
 					}
 				}
 			}
-			video_compressor.wait();
+			compressor->wait();
 		}
+		vm::println( "read {} byte(s) of input", read_bytes );
+		z_halo.clear();
+		y_halo.clear();
 
 		vector<char>{}.swap( read_buffer );
 		vector<char>{}.swap( write_buffer );
+		if ( cancelled ) {
+			drop_incomplete_slices();
+		}
 
-		uint64_t meta_offset = body_writer.tell();
-		body_writer.write_typed( video_compressor.frame_offset() );
-		body_writer.write_typed( block_idx );
-		body_writer.write_typed( meta_offset );
+		return finish() && not cancelled;
+	}
 
+	bool convert_sparse( BrickIterator const &bricks )
+	{
+		if ( quantize ) {
+			throw runtime_error( "quantization is not supported for sparse volumes" );
+		}
+		t.start();
+		started = chrono::steady_clock::now();
+
+		{
+			vm::Timer::Scoped t( [&]( auto dt ) {
+				vm::println( "total convert time: {}", dt.s() );
+			} );
+
+			const size_t max_slots = std::max( nblocks_per_stride, 1 );
+			size_t nslots = 0;
+			write_buffer.resize( max_slots * channels * voxel_bytes * nvoxels_per_block );
+
+			Idx idx;
+			vm::Arc<Reader> brick;
+			while ( not cancelled && bricks( idx, brick ) ) {
+				if ( not( idx.x < dim.x && idx.y < dim.y && idx.z < dim.z ) ) {
+					throw runtime_error( vm::fmt( "brick {} out of grid {}", idx, dim ) );
+				}
+				if ( brick->size() - brick->tell() != input_voxel_bytes * nvoxels_per_block ) {
+					throw runtime_error( vm::fmt( "brick {} has {} byte(s), expected {}", idx,
+												  brick->size() - brick->tell(), input_voxel_bytes * nvoxels_per_block ) );
+				}
+				if ( block_idx[ 0 ].count( idx ) ) {
+					throw runtime_error( vm::fmt( "duplicate brick {}", idx ) );
+				}
+				++read_blocks;
+				read_bytes += input_voxel_bytes * nvoxels_per_block;
+				if ( read_blocks % max_slots == 0 ) {
+					report_progress( 0 );
+				}
+				/* statistics need the brick in memory, unless it is already,
+				   the preview reads its few samples from wherever it is */
+				if ( channels == 1 && not verify && ( not block_stats || brick->mapped() ) ) {
+					if ( block_stats ) {
+						stats_idx[ 0 ][ idx ] = compute_stats( brick->mapped() + brick->tell() );
+					}
+					if ( not preview.empty() ) {
+						if ( brick->mapped() ) {
+							sample_preview( 0, idx, 0, brick->mapped() + brick->tell() );
+						} else {
+							preview_sampler.sample( idx, *brick, voxel_bytes, preview.data() );
+						}
+					}
+					block_idx[ 0 ][ idx ] = compressor->accept( std::move( brick ) );
+					/* bounds the frames held for checksumming */
+					if ( read_blocks % max_slots == 0 ) {
+						end_batch();
+					}
+					continue;
+				}
+				/* bricks are kept in slots until verified, multi-channel
+				   bricks are interleaved like the raw input */
+				const auto block_bytes = voxel_bytes * nvoxels_per_block;
+				const auto slot = write_buffer.data() + nslots * channels * block_bytes;
+				read_buffer.resize( channels * block_bytes );
+				brick->read( read_buffer.data(), read_buffer.size() );
+				deinterleave( read_buffer.data(), slot, nvoxels_per_block );
+				for ( size_t c = 0; c != channels; ++c ) {
+					accept_block( c, idx, slot + c * block_bytes );
+				}
+				if ( ++nslots == max_slots ) {
+					end_batch();
+					nslots = 0;
+				}
+			}
+			if ( verify ) {
+				end_batch();
+			} else {
+				compressor->wait();
+			}
+		}
+
+		auto empty = BlockIndex{}
+					   .set_first_frame( 0 )
+					   .set_last_frame( 0 )
+					   .set_offset( 0 )
+					   .set_codec( BlockCodec::Empty );
+		auto empty_stats = BlockStats{};
+		empty_stats.histogram.resize( histogram_bins );
+		if ( histogram_bins ) {
+			empty_stats.histogram[ 0 ] = nvoxels_per_block;
+		}
+		for ( uint32_t z = 0; z != dim.z; ++z ) {
+			for ( uint32_t y = 0; y != dim.y; ++y ) {
+				for ( uint32_t x = 0; x != dim.x; ++x ) {
+					const auto idx = Idx{}.set_x( x ).set_y( y ).set_z( z );
+					for ( auto &index : block_idx ) {
+						index.emplace( idx, empty );
+					}
+					for ( auto &index : stats_idx ) {
+						index.emplace( idx, empty_stats );
+					}
+				}
+			}
+		}
+		vm::println( "occupied {} / {} block(s)", read_blocks, dim.total() );
+
+		return finish() && not cancelled;
+	}
+
+	bool finish()
+	{
+		Footer footer;
+		footer.frame_offset = compressor->frame_offset();
+		if ( palette_offset.size() > 1 ) {
+			const auto nvideo_frames = uint32_t( footer.frame_offset.size() - 1 );
+			const auto video_end = footer.frame_offset.back();
+			for ( size_t i = 1; i != palette_offset.size(); ++i ) {
+				footer.frame_offset.emplace_back( video_end + palette_offset[ i ] );
+			}
+			for ( auto &index : block_idx ) {
+				for ( auto &e : index ) {
+					if ( e.second.codec == BlockCodec::Palette ) {
+						e.second.first_frame += nvideo_frames;
+						e.second.last_frame += nvideo_frames;
+					}
+				}
+			}
+			for ( auto &index : residual_idx ) {
+				for ( auto &e : index ) {
+					e.second += nvideo_frames;
+				}
+			}
+			checksum_writer.write( palette_body.data(), palette_body.size() );
+			vm::println( "{} block(s) over max error stored losslessly", nfallbacks );
+		}
+		footer.block_idx.swap( block_idx[ 0 ] );
+		footer.channel_idx.assign( std::make_move_iterator( block_idx.begin() + 1 ),
+								   std::make_move_iterator( block_idx.end() ) );
+		footer.residual_idx.swap( residual_idx );
+		footer.stats_idx.swap( stats_idx );
+		footer.histogram_bins = histogram_bins;
+		footer.preview_dim = preview_sampler.dim;
+		footer.preview_scale = preview_sampler.scale;
+		footer.preview.swap( preview );
+		footer.transfer.swap( transfer );
+		checksum_writer.checksum( footer.frame_offset );
+		if ( checksum_writer.crc.size() != footer.frame_count() ) {
+			throw logic_error( vm::fmt( "checksummed {} of {} frame(s)", checksum_writer.crc.size(), footer.frame_count() ) );
+		}
+		footer.frame_crc.swap( checksum_writer.crc );
 		auto header = Header{}
 						.set_log_block_size( log_block_size )
 						.set_block_size( block_size )
@@ -294,10 +1330,18 @@ public:
 						.set_raw( raw )
 						.set_dim( dim )
 						.set_adjusted( adjusted )
-						.set_frame_size( video_compressor.frame_size() );
+						.set_encode_method( encode_method )
+						.set_codec( compressor->codec() )
+						.set_packing( compressor->packing() )
+						.set_frame_size( compressor->frame_size() )
+						.set_log_frame_alignment( compressor->frame_alignment() ? count_trailing_zeros( compressor->frame_alignment() ) : 0 )
+						.set_frame_width( compressor->frame_width() )
+						.set_frame_height( compressor->frame_height() );
+		footer.write_to( body_writer, header );
 
-		StreamWriter writer( output, 0, sizeof( Header ) );
-		writer.write_typed( header );
+		output.seek( 0 );
+		output.write_typed( header );
+		output_file.flush();
 
 		return true;
 	}
@@ -306,7 +1350,19 @@ public:
 VM_EXPORT
 {
 	Archiver::Archiver( ArchiverOptions const &opts ) :
-	  _( new ArchiverImpl( opts ) )
+	  _( new ArchiverImpl( opts, file_source( opts ), nullptr ) )
+	{
+	}
+	Archiver::Archiver( ArchiverOptions const &opts, Reader &input, Writer &output ) :
+	  _( new ArchiverImpl( opts, reader_source( opts, input ), &output ) )
+	{
+	}
+	Archiver::Archiver( ArchiverOptions const &opts, RegionSource const &input, Writer &output ) :
+	  _( new ArchiverImpl( opts, input, &output ) )
+	{
+	}
+	Archiver::Archiver( ArchiverOptions const &opts, Writer &output ) :
+	  _( new ArchiverImpl( opts, nullptr, &output ) )
 	{
 	}
 	Archiver::~Archiver()
@@ -316,6 +1372,14 @@ VM_EXPORT
 	{
 		return _->convert();
 	}
+	bool Archiver::convert_sparse( BrickIterator const &bricks )
+	{
+		return _->convert_sparse( bricks );
+	}
+	void Archiver::cancel()
+	{
+		_->cancel();
+	}
 }
 
 VM_END_MODULE()
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cstring>
+#include "palette_encoder.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+namespace
+{
+size_t varint_size( uint32_t x )
+{
+	size_t n = 1;
+	while ( x >= 0x80 ) {
+		x >>= 7;
+		++n;
+	}
+	return n;
+}
+
+void put_varint( vector<unsigned char> &dst, uint32_t x )
+{
+	while ( x >= 0x80 ) {
+		dst.emplace_back( x & 0x7f | 0x80 );
+		x >>= 7;
+	}
+	dst.emplace_back( x );
+}
+
+template <typename T>
+void put( vector<unsigned char> &dst, T const &x )
+{
+	auto p = reinterpret_cast<unsigned char const *>( &x );
+	dst.insert( dst.end(), p, p + sizeof( T ) );
+}
+
+}  // namespace
+
+template <typename T>
+void PaletteEncoder::encode( T const *src, size_t n, vector<unsigned char> &chunk )
+{
+	/* labels come in long runs, so both the palette and the index
+	   lookup are built per run instead of per voxel */
+	runs.clear();
+	for ( size_t i = 0; i < n; ) {
+		size_t j = i + 1;
+		while ( j < n && src[ j ] == src[ i ] ) ++j;
+		runs.emplace_back( Run{ uint32_t( j - i ), src[ i ] } );
+		i = j;
+	}
+	palette.resize( runs.size() );
+	std::transform( runs.begin(), runs.end(), palette.begin(),
+					[]( Run const &run ) { return run.value; } );
+	std::sort( palette.begin(), palette.end() );
+	palette.erase( std::unique( palette.begin(), palette.end() ), palette.end() );
+	for ( auto &run : runs ) {
+		run.value = std::lower_bound( palette.begin(), palette.end(), run.value ) - palette.begin();
+	}
+
+	uint8_t bits = 0;
+	if ( palette.size() > 1 ) {
+		for ( bits = 1; ( uint64_t( 1 ) << bits ) < palette.size(); bits <<= 1 ) {}
+	}
+	const size_t nwords = ( n * bits + 63 ) / 64;
+	size_t rle_size = sizeof( uint32_t );
+	for ( auto &run : runs ) {
+		rle_size += varint_size( run.len - 1 ) + varint_size( run.value );
+	}
+
+	chunk.clear();
+	put( chunk, uint32_t( palette.size() ) );
+	for ( auto &value : palette ) {
+		put( chunk, T( value ) );
+	}
+
+	if ( rle_size < 1 + nwords * sizeof( uint64_t ) ) {
+		put( chunk, PaletteMode::Rle );
+		put( chunk, uint32_t( runs.size() ) );
+		for ( auto &run : runs ) {
+			put_varint( chunk, run.len - 1 );
+			put_varint( chunk, run.value );
+		}
+		return;
+	}
+
+	put( chunk, PaletteMode::Bitpack );
+	put( chunk, bits );
+	if ( not bits ) return;
+	const auto base = chunk.size();
+	chunk.resize( base + nwords * sizeof( uint64_t ), 0 );
+	/* bits divides 64 so no index straddles two words */
+	uint64_t word = 0;
+	size_t pos = 0, w = 0;
+	for ( auto &run : runs ) {
+		for ( uint32_t i = 0; i < run.len; ++i ) {
+			word |= uint64_t( run.value ) << pos;
+			if ( ( pos += bits ) == 64 ) {
+				memcpy( chunk.data() + base + w++ * sizeof( uint64_t ), &word, sizeof( word ) );
+				word = 0;
+				pos = 0;
+			}
+		}
+	}
+	if ( pos ) {
+		memcpy( chunk.data() + base + w * sizeof( uint64_t ), &word, sizeof( word ) );
+	}
+}
+
+template void PaletteEncoder::encode( uint8_t const *, size_t, vector<unsigned char> & );
+template void PaletteEncoder::encode( uint32_t const *, size_t, vector<unsigned char> & );
+
+VM_END_MODULE()
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <varch/utils/common.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+/* lossless palette coding of uint8 or uint32 voxels, see PaletteMode for the chunk layout */
+struct PaletteEncoder final
+{
+	template <typename T>
+	void encode( T const *src, std::size_t n,
+				 std::vector<unsigned char> &chunk );
+
+private:
+	struct Run
+	{
+		uint32_t len, value;
+	};
+	std::vector<Run> runs;
+	std::vector<uint32_t> palette;
+};
+
+VM_END_MODULE()
@@ -0,0 +1,136 @@
+#include <fstream>
+#include <varch/archive/compactor.hpp>
+#include <varch/unarchive/unarchiver.hpp>
+#include <varch/utils/unbounded_io.hpp>
+#include "frame_filler.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+struct CompactorImpl final : vm::NoCopy, vm::NoMove
+{
+	CompactorImpl( CompactorOptions const &opts ) :
+	  input( opts.input, ios::ate | ios::binary ),
+	  output( opts.output, ios::binary ),
+	  body_writer( output, sizeof( Header ) )
+	{
+		if ( not input.is_open() ) {
+			throw runtime_error( vm::fmt( "can not open input file: {}", opts.input ) );
+		}
+		if ( not output.is_open() ) {
+			throw runtime_error( "can not open output file" );
+		}
+	}
+
+	bool compact()
+	{
+		StreamReader reader( input, 0, input.tellg() );
+		UnarchiverData archive( reader );
+		auto &footer = archive.footer;
+
+		/* frames still referenced by a block or residual */
+		vector<char> used( footer.frame_count(), false );
+		for ( uint32_t c = 0; c != footer.channels(); ++c ) {
+			for ( auto &entry : footer.index( c ) ) {
+				if ( entry.second.codec == BlockCodec::Empty ) continue;
+				std::fill( used.begin() + entry.second.first_frame,
+						   used.begin() + entry.second.last_frame + 1, true );
+			}
+		}
+		for ( auto &index : footer.residual_idx ) {
+			for ( auto &entry : index ) {
+				used[ entry.second ] = true;
+			}
+		}
+
+		/* copies runs of used frames, keeping their order */
+		Footer compacted;
+		vector<uint32_t> remap( footer.frame_count() );
+		vector<char> buffer;
+		for ( uint32_t f = 0; f != footer.frame_count(); ) {
+			if ( not used[ f ] ) {
+				++f;
+				continue;
+			}
+			/* the run stays at its offset modulo the frame alignment */
+			align_copied_frames( body_writer, compacted, footer.frame_offset[ f ],
+								 archive.header.frame_alignment(), not footer.frame_crc.empty() );
+			auto end = f;
+			while ( end != footer.frame_count() && used[ end ] ) {
+				remap[ end ] = compacted.frame_count() + end - f;
+				if ( not footer.frame_crc.empty() ) {
+					compacted.frame_crc.emplace_back( footer.frame_crc[ end ] );
+				}
+				++end;
+			}
+			const auto base = compacted.frame_offset.back() - footer.frame_offset[ f ];
+			for ( auto g = f + 1; g <= end; ++g ) {
+				compacted.frame_offset.emplace_back( footer.frame_offset[ g ] + base );
+			}
+			buffer.resize( footer.frame_offset[ end ] - footer.frame_offset[ f ] );
+			archive.content.seek( footer.frame_offset[ f ] );
+			if ( archive.content.read( buffer.data(), buffer.size() ) != buffer.size() ) {
+				throw runtime_error( "unexpected end of archive body" );
+			}
+			body_writer.write( buffer.data(), buffer.size() );
+			f = end;
+		}
+
+		compacted.block_idx = std::move( footer.block_idx );
+		compacted.channel_idx = std::move( footer.channel_idx );
+		compacted.residual_idx = std::move( footer.residual_idx );
+		compacted.transfer = std::move( footer.transfer );
+		compacted.stats_idx = std::move( footer.stats_idx );
+		compacted.histogram_bins = footer.histogram_bins;
+		compacted.preview_dim = footer.preview_dim;
+		compacted.preview_scale = footer.preview_scale;
+		compacted.preview = std::move( footer.preview );
+		for ( uint32_t c = 0; c != compacted.channels(); ++c ) {
+			for ( auto &entry : compacted.index( c ) ) {
+				if ( entry.second.codec == BlockCodec::Empty ) continue;
+				entry.second.first_frame = remap[ entry.second.first_frame ];
+				entry.second.last_frame = remap[ entry.second.last_frame ];
+			}
+		}
+		for ( auto &index : compacted.residual_idx ) {
+			for ( auto &entry : index ) {
+				entry.second = remap[ entry.second ];
+			}
+		}
+		vm::println( "kept {} / {} frame(s), {} / {} byte(s)",
+					 compacted.frame_count(), footer.frame_count(),
+					 compacted.frame_offset.back(), archive.content.size() );
+		compacted.write_to( body_writer, archive.header );
+
+		auto header = archive.header;
+		header.version = archive_version;
+		StreamWriter writer( output, 0, sizeof( Header ) );
+		writer.write_typed( header );
+		output.flush();
+
+		return true;
+	}
+
+private:
+	ifstream input;
+	ofstream output;
+	UnboundedStreamWriter body_writer;
+};
+
+VM_EXPORT
+{
+	Compactor::Compactor( CompactorOptions const &opts ) :
+	  _( new CompactorImpl( opts ) )
+	{
+	}
+	Compactor::~Compactor()
+	{
+	}
+	bool Compactor::compact()
+	{
+		return _->compact();
+	}
+}
+
+VM_END_MODULE()
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <VMUtils/modules.hpp>
+#include <varch/utils/common.hpp>
+#include <varch/utils/io.hpp>
+#include "../unarchive/crc32c.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+/* the bytes of filler that take a body ending at pos to an offset
+   congruent to target modulo alignment, none or at least the filler
+   word, see frame_filler */
+inline uint32_t filler_size( uint64_t pos, uint64_t target, uint32_t alignment )
+{
+	if ( alignment <= 1 ) {
+		return 0;
+	}
+	auto n = uint32_t( ( target % alignment + alignment - pos % alignment ) % alignment );
+	if ( n && n < sizeof( frame_filler ) ) {
+		n += alignment;
+	}
+	return n;
+}
+
+/* n bytes of filler as decoders skip them, none for n = 0 */
+inline std::vector<char> make_filler( uint32_t n )
+{
+	std::vector<char> filler( n );
+	if ( n == 0 ) {
+		return filler;
+	}
+	const uint32_t word = frame_filler | ( n - sizeof( frame_filler ) );
+	std::memcpy( filler.data(), &word, sizeof( word ) );
+	return filler;
+}
+
+/* appends a frame no block refers to so that frames copied from offset
+   src of another body into footer keep their offset modulo alignment,
+   i.e. stay aligned in the file, with a checksum if checksummed */
+inline void align_copied_frames( Writer &body, Footer &footer, uint64_t src,
+								 uint32_t alignment, bool checksummed )
+{
+	const auto n = filler_size( footer.frame_offset.back(), src, alignment );
+	if ( n == 0 ) {
+		return;
+	}
+	const auto filler = make_filler( n );
+	body.write( filler.data(), n );
+	footer.frame_offset.emplace_back( footer.frame_offset.back() + n );
+	if ( checksummed ) {
+		footer.frame_crc.emplace_back( crc32c( filler.data(), n ) );
+	}
+}
+
+VM_END_MODULE()
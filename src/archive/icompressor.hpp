@@ -0,0 +1,29 @@
+#pragma once
+
+#include <VMUtils/modules.hpp>
+#include <VMUtils/concepts.hpp>
+#include <varch/utils/common.hpp>
+#include <varch/utils/io.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+/* turns a stream of blocks into frames appended to the archive body */
+struct ICompressor : vm::Dynamic, vm::NoCopy, vm::NoMove
+{
+	/* the reader may refer to memory of the caller until the next flush */
+	virtual BlockIndex accept( vm::Arc<Reader> &&reader ) = 0;
+	virtual void flush( bool wait = false ) = 0;
+	virtual void wait() = 0;
+	virtual uint32_t frame_size() const = 0;
+	/* recorded in the header, so that readers pick a decoder for the codec */
+	virtual FrameCodec codec() const = 0;
+	virtual FramePacking packing() const = 0;
+	/* frames are padded to file offsets aligned to this, 0 if not */
+	virtual uint32_t frame_alignment() const { return 0; }
+	virtual uint16_t frame_width() const { return 0; }
+	virtual uint16_t frame_height() const { return 0; }
+	virtual std::vector<uint64_t> const &frame_offset() const = 0;
+	uint32_t frame_count() const { return frame_offset().size() - 1; }
+};
+
+VM_END_MODULE()
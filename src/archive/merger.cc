@@ -0,0 +1,288 @@
+#include <fstream>
+#ifdef WIN32
+#include <direct.h>
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+#include <varch/archive/merger.hpp>
+#include <varch/utils/unbounded_io.hpp>
+#include "frame_filler.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+/* the footer of a manifest follows the frames of all shards in the
+   archive it describes, so its offsets are shifted by their length */
+struct ShiftedWriter : Writer
+{
+	ShiftedWriter( Writer &_, uint64_t shift ) :
+	  _( _ ),
+	  shift( shift )
+	{
+	}
+
+	void seek( size_t pos ) override
+	{
+		_.seek( pos - shift );
+	}
+	size_t tell() const override
+	{
+		return _.tell() + shift;
+	}
+	size_t size() const override
+	{
+		return _.size();
+	}
+	void write( char const *src, size_t len ) override
+	{
+		_.write( src, len );
+	}
+
+private:
+	Writer &_;
+	uint64_t shift;
+};
+
+struct MergerImpl final : vm::NoCopy, vm::NoMove
+{
+	MergerImpl( MergerOptions const &opts ) :
+	  inputs( opts.inputs ),
+	  manifest( opts.manifest ),
+	  output_path( opts.output ),
+	  output( opts.output, ios::binary ),
+	  body_writer( output, sizeof( Header ) )
+	{
+		if ( inputs.empty() ) {
+			throw runtime_error( "no input archives to merge" );
+		}
+		if ( not output.is_open() ) {
+			throw runtime_error( "can not open output file" );
+		}
+	}
+
+	static bool is_compatible( Header const &a, Header const &b )
+	{
+		return a.version == b.version &&
+			   a.raw == b.raw &&
+			   a.dim == b.dim &&
+			   a.adjusted == b.adjusted &&
+			   a.log_block_size == b.log_block_size &&
+			   a.block_size == b.block_size &&
+			   a.block_inner == b.block_inner &&
+			   a.padding == b.padding &&
+			   a.encode_method == b.encode_method &&
+			   a.codec == b.codec &&
+			   a.packing == b.packing &&
+			   a.frame_size == b.frame_size &&
+			   a.frame_width == b.frame_width &&
+			   a.frame_height == b.frame_height;
+	}
+
+	void append_body( Reader &content, uint64_t len )
+	{
+		vector<char> buffer( std::min( len, uint64_t( 64 ) << 20 /*64 Mb*/ ) );
+		content.seek( 0 );
+		while ( len ) {
+			auto nread = content.read( buffer.data(), std::min( len, uint64_t( buffer.size() ) ) );
+			if ( not nread ) {
+				throw runtime_error( "unexpected end of archive body" );
+			}
+			body_writer.write( buffer.data(), nread );
+			len -= nread;
+		}
+	}
+
+	bool merge()
+	{
+		Header header;
+		Footer merged;
+		bool checksummed = true, with_stats = true, with_preview = true;
+
+		for ( int i = 0; i != inputs.size(); ++i ) {
+			ifstream is( inputs[ i ], ios::ate | ios::binary );
+			if ( not is.is_open() ) {
+				throw runtime_error( vm::fmt( "can not open input file: {}", inputs[ i ] ) );
+			}
+			StreamReader reader( is, 0, is.tellg() );
+
+			Header part_header;
+			reader.seek( 0 );
+			reader.read_typed( part_header );
+			part_header.upgrade();
+			if ( part_header.version > archive_version ) {
+				throw runtime_error( vm::fmt( "unsupported archive version: {} > {}",
+											  part_header.version, archive_version ) );
+			}
+			if ( part_header.sharded ) {
+				throw runtime_error( vm::fmt( "can not merge manifest: {}", inputs[ i ] ) );
+			}
+			if ( i == 0 ) {
+				header = part_header;
+			} else if ( not is_compatible( header, part_header ) ) {
+				throw runtime_error( vm::fmt( "incompatible archive: {}", inputs[ i ] ) );
+			} else if ( part_header.log_frame_alignment != header.log_frame_alignment ) {
+				header.log_frame_alignment = 0;
+			}
+
+			PartReader content( reader, sizeof( Header ), reader.size() - sizeof( Header ) );
+			Footer part;
+			part.read_from( content, part_header.version );
+			if ( i == 0 ) {
+				merged.channel_idx.resize( part.channel_idx.size() );
+				merged.residual_idx.resize( part.residual_idx.size() );
+				merged.transfer = part.transfer;
+				merged.histogram_bins = part.histogram_bins;
+				merged.preview_dim = part.preview_dim;
+				merged.preview_scale = part.preview_scale;
+				merged.preview.resize( part.preview.size() );
+			} else if ( part.channels() != merged.channels() ||
+						part.has_residuals() != merged.has_residuals() ||
+						part.transfer != merged.transfer ) {
+				throw runtime_error( vm::fmt( "incompatible archive: {}", inputs[ i ] ) );
+			}
+
+			/* a filler frame keeps the frames of an aligned part aligned
+			   after the frames before it, shards keep their offsets */
+			if ( not manifest ) {
+				align_copied_frames( body_writer, merged, 0, part_header.frame_alignment(), true );
+			}
+			/* every partial archive ends at a frame boundary, so blocks
+			   never span two parts and only need to be rebased */
+			const auto frame_base = merged.frame_count();
+			const auto byte_base = merged.frame_offset.back();
+			if ( manifest ) {
+				/* the part stays where it is and becomes a shard */
+				merged.shards.emplace_back( shard_path( inputs[ i ] ) );
+				merged.shard_offset.emplace_back( sizeof( Header ) );
+				merged.frame_shard.resize( merged.frame_shard.size() + part.frame_count(), i );
+			} else {
+				append_body( content, part.frame_offset.back() );
+			}
+			for ( int j = 1; j < part.frame_offset.size(); ++j ) {
+				merged.frame_offset.emplace_back( byte_base + part.frame_offset[ j ] );
+			}
+			/* checksums are kept only if every part has them */
+			checksummed = checksummed && part.frame_crc.size() == part.frame_count();
+			merged.frame_crc.insert( merged.frame_crc.end(), part.frame_crc.begin(), part.frame_crc.end() );
+			/* and statistics only if every part has them, with the same histogram */
+			with_stats = with_stats && part.has_stats() && part.histogram_bins == merged.histogram_bins;
+			merged.stats_idx.resize( with_stats ? part.channels() : 0 );
+			/* and the preview, each of its voxels sampled by a single block
+			   and zero in the parts without that block */
+			with_preview = with_preview && part.has_preview() && part.preview.size() == merged.preview.size();
+			if ( with_preview ) {
+				std::transform( part.preview.begin(), part.preview.end(), merged.preview.begin(), merged.preview.begin(),
+								[]( char a, char b ) { return char( a | b ); } );
+			}
+			for ( uint32_t c = 0; c != part.channels(); ++c ) {
+				for ( auto &entry : part.index( c ) ) {
+					auto idx = entry.second;
+					if ( idx.codec != BlockCodec::Empty ) {
+						idx.first_frame += frame_base;
+						idx.last_frame += frame_base;
+					}
+					auto res = merged.index( c ).emplace( entry.first, idx );
+					if ( not res.second ) {
+						if ( idx.codec == BlockCodec::Empty ) continue;
+						/* sparse parts mark the rest of the grid as empty */
+						if ( res.first->second.codec != BlockCodec::Empty ) {
+							throw runtime_error( vm::fmt( "block {} exists in more than one archive", entry.first ) );
+						}
+						res.first->second = idx;
+					}
+					if ( with_stats ) {
+						merged.stats_idx[ c ][ entry.first ] = part.stats_idx[ c ].at( entry.first );
+					}
+				}
+			}
+			for ( uint32_t c = 0; c != part.residual_idx.size(); ++c ) {
+				for ( auto &entry : part.residual_idx[ c ] ) {
+					merged.residual_idx[ c ][ entry.first ] = entry.second + frame_base;
+				}
+			}
+			vm::println( "merged {}: {} frame(s), {} block(s)",
+						 inputs[ i ], part.frame_count(), part.block_idx.size() );
+		}
+
+		if ( merged.block_idx.size() != header.dim.total() ) {
+			vm::eprintln( "merged archive covers {} / {} block(s)",
+						  merged.block_idx.size(), header.dim.total() );
+		}
+
+		if ( not checksummed ) {
+			merged.frame_crc.clear();
+		}
+		if ( not with_preview ) {
+			merged.preview_dim = Idx{};
+			merged.preview_scale = 0;
+			merged.preview.clear();
+		}
+		if ( not with_stats ) {
+			merged.histogram_bins = 0;
+		}
+		if ( manifest ) {
+			ShiftedWriter footer_writer( body_writer, merged.frame_offset.back() );
+			merged.write_to( footer_writer, header );
+		} else {
+			merged.write_to( body_writer, header );
+		}
+		header.version = archive_version;
+		header.sharded = manifest;
+
+		StreamWriter writer( output, 0, sizeof( Header ) );
+		writer.write_typed( header );
+		output.flush();
+
+		return true;
+	}
+
+	/* relative to the directory of the manifest if below it, so that both
+	   can be moved, absolute otherwise */
+	string shard_path( string const &input ) const
+	{
+		const auto path = absolute_path( input );
+		const auto manifest = absolute_path( output_path );
+		const auto dir = manifest.substr( 0, manifest.find_last_of( "/\\" ) + 1 );
+		return path.compare( 0, dir.size(), dir ) == 0 ? path.substr( dir.size() ) : path;
+	}
+
+	static string absolute_path( string const &path )
+	{
+		const bool absolute = not path.empty() && ( path[ 0 ] == '/' || path[ 0 ] == '\\' ||
+													path.size() > 1 && path[ 1 ] == ':' );
+		if ( absolute ) {
+			return path;
+		}
+		char cwd[ 4096 ];
+		if ( not getcwd( cwd, sizeof( cwd ) ) ) {
+			throw runtime_error( "can not get the working directory" );
+		}
+		return string( cwd ) + "/" + path;
+	}
+
+private:
+	vector<string> inputs;
+	bool manifest;
+	string output_path;
+	ofstream output;
+	UnboundedStreamWriter body_writer;
+};
+
+VM_EXPORT
+{
+	Merger::Merger( MergerOptions const &opts ) :
+	  _( new MergerImpl( opts ) )
+	{
+	}
+	Merger::~Merger()
+	{
+	}
+	bool Merger::merge()
+	{
+		return _->merge();
+	}
+}
+
+VM_END_MODULE()
@@ -0,0 +1,151 @@
+#include <map>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include "backends/palette/palette_encoder.hpp"
+#include "palette_compressor.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+struct PaletteCompressorImpl
+{
+	struct Job
+	{
+		uint32_t frame;
+		vector<uint32_t> block;
+	};
+
+	PaletteCompressorImpl( Writer &out, size_t nvoxels_per_block, EncodeOptions const &opts ) :
+	  out( out ),
+	  nvoxels_per_block( nvoxels_per_block )
+	{
+		auto nthreads = opts.threads ? opts.threads : std::max( thread::hardware_concurrency(), 1u );
+		/* bounds the blocks held in memory while the writer lags behind */
+		max_pending = nthreads * 4;
+		for ( unsigned i = 0; i != nthreads; ++i ) {
+			workers.emplace_back( [this] { work_loop(); } );
+		}
+	}
+
+	~PaletteCompressorImpl()
+	{
+		{
+			unique_lock<mutex> lk( mut );
+			should_stop = true;
+			job_cv.notify_all();
+		}
+		for ( auto &worker : workers ) {
+			worker.join();
+		}
+	}
+
+	void work_loop()
+	{
+		PaletteEncoder encoder;
+		while ( true ) {
+			Job job;
+			{
+				unique_lock<mutex> lk( mut );
+				job_cv.wait( lk, [this] { return should_stop || jobs.size(); } );
+				if ( jobs.empty() ) return;
+				job = std::move( jobs.front() );
+				jobs.pop_front();
+			}
+			vector<unsigned char> chunk;
+			encoder.encode( job.block.data(), job.block.size(), chunk );
+			{
+				unique_lock<mutex> lk( mut );
+				encoded[ job.frame ] = std::move( chunk );
+				/* frames are written in the order they were accepted */
+				for ( auto it = encoded.begin();
+					  it != encoded.end() && it->first == written_frames;
+					  it = encoded.erase( it ) ) {
+					const auto len = uint32_t( it->second.size() );
+					out.write_typed( len );
+					out.write( reinterpret_cast<char const *>( it->second.data() ), len );
+					frame_offset.emplace_back( frame_offset.back() + sizeof( len ) + len );
+					++written_frames;
+				}
+				done_cv.notify_all();
+			}
+		}
+	}
+
+	BlockIndex accept( vm::Arc<Reader> const &reader )
+	{
+		Job job;
+		job.block.resize( nvoxels_per_block );
+		const auto nbytes = nvoxels_per_block * sizeof( uint32_t );
+		if ( reader->read( reinterpret_cast<char *>( job.block.data() ), nbytes ) != nbytes ) {
+			throw runtime_error( vm::fmt( "label block shorter than {} byte(s)", nbytes ) );
+		}
+
+		unique_lock<mutex> lk( mut );
+		done_cv.wait( lk, [this] { return accepted_frames - written_frames < max_pending; } );
+		job.frame = accepted_frames++;
+		jobs.emplace_back( std::move( job ) );
+		job_cv.notify_one();
+		return BlockIndex{}
+		  .set_first_frame( accepted_frames - 1 )
+		  .set_last_frame( accepted_frames - 1 )
+		  .set_offset( 0 )
+		  .set_codec( BlockCodec::Palette );
+	}
+
+	void wait()
+	{
+		unique_lock<mutex> lk( mut );
+		done_cv.wait( lk, [this] { return written_frames == accepted_frames; } );
+	}
+
+public:
+	Writer &out;
+	size_t nvoxels_per_block;
+	size_t max_pending;
+	uint32_t accepted_frames = 0, written_frames = 0;
+	vector<uint64_t> frame_offset = { 0 };
+	deque<Job> jobs;
+	map<uint32_t, vector<unsigned char>> encoded;
+	bool should_stop = false;
+
+	mutex mut;
+	condition_variable job_cv, done_cv;
+	vector<thread> workers;
+};
+
+PaletteCompressor::PaletteCompressor( Writer &out, size_t nvoxels_per_block, EncodeOptions const &opts ) :
+  _( new PaletteCompressorImpl( out, nvoxels_per_block, opts ) )
+{
+}
+
+PaletteCompressor::~PaletteCompressor()
+{
+}
+
+BlockIndex PaletteCompressor::accept( vm::Arc<Reader> &&reader )
+{
+	return _->accept( reader );
+}
+/* accepted blocks are copied, so only waiting is left to do */
+void PaletteCompressor::flush( bool wait )
+{
+	if ( wait ) {
+		_->wait();
+	}
+}
+void PaletteCompressor::wait()
+{
+	_->wait();
+}
+uint32_t PaletteCompressor::frame_size() const
+{
+	return _->nvoxels_per_block * sizeof( uint32_t );
+}
+vector<uint64_t> const &PaletteCompressor::frame_offset() const
+{
+	return _->frame_offset;
+}
+
+VM_END_MODULE()
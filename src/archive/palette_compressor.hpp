@@ -0,0 +1,31 @@
+#pragma once
+
+#include <VMUtils/nonnull.hpp>
+#include <VMUtils/attributes.hpp>
+#include "icompressor.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+struct PaletteCompressorImpl;
+
+/* lossless compressor of uint32 label blocks, one frame per block,
+   blocks are encoded by a pool of cpu threads and written in order */
+struct PaletteCompressor final : ICompressor
+{
+	PaletteCompressor( Writer &out, std::size_t nvoxels_per_block,
+					   EncodeOptions const &_ = EncodeOptions{} );
+	~PaletteCompressor();
+
+	BlockIndex accept( vm::Arc<Reader> &&reader ) override;
+	void flush( bool wait = false ) override;
+	void wait() override;
+	uint32_t frame_size() const override;
+	FrameCodec codec() const override { return FrameCodec::Palette; }
+	FramePacking packing() const override { return FramePacking::Block; }
+	std::vector<uint64_t> const &frame_offset() const override;
+
+private:
+	vm::Box<PaletteCompressorImpl> _;
+};
+
+VM_END_MODULE()
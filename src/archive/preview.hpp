@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <varch/utils/common.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+/* fills the preview volume of the footer from blocks as they are archived.
+   preview voxel p stands for raw voxels [ p * scale, ( p + 1 ) * scale )
+   and holds the block voxel covering the one at their center, clamped to
+   raw, which lies in the inner voxels of exactly one block. that is the
+   raw voxel itself for level 0 blocks and the box filtered voxel of the
+   node for homogeneous octree blocks of higher levels */
+struct PreviewSampler
+{
+	PreviewSampler( Idx const &raw, uint32_t scale, uint64_t block_size,
+					uint64_t block_inner, uint64_t padding ) :
+	  scale( scale ),
+	  raw( raw ),
+	  block_size( block_size ),
+	  block_inner( block_inner ),
+	  padding( padding )
+	{
+		if ( scale ) {
+			dim = Idx{}
+					.set_x( ( raw.x + scale - 1 ) / scale )
+					.set_y( ( raw.y + scale - 1 ) / scale )
+					.set_z( ( raw.z + scale - 1 ) / scale );
+		}
+	}
+
+	/* the smallest scale that fits raw into size^3, 0 for no preview,
+	   also if raw fits already, where it would be a copy of raw */
+	static uint32_t scale_for( Idx const &raw, uint32_t size )
+	{
+		if ( not size ) {
+			return 0;
+		}
+		const auto longest = std::max( { raw.x, raw.y, raw.z } );
+		const auto scale = ( longest + size - 1 ) / size;
+		return scale > 1 ? scale : 0;
+	}
+
+	uint32_t center( uint32_t p, uint32_t extent ) const
+	{
+		return std::min( uint64_t( p ) * scale + scale / 2, uint64_t( extent ) - 1 );
+	}
+
+	/* copies the samples within block idx of octree level level to the
+	   preview dst of a channel, src holding block_size^3 voxels of
+	   voxel_bytes each, stride bytes apart */
+	void sample( Idx const &idx, unsigned level, char const *src,
+				 size_t voxel_bytes, size_t stride, char *dst ) const
+	{
+		for_each_sample( idx, level, [&]( uint64_t d, uint64_t s ) {
+			memcpy( dst + d * voxel_bytes, src + s * stride, voxel_bytes );
+		} );
+	}
+
+	/* the same for a level 0 brick read from its current position, which
+	   seeks to the few samples only and leaves it where it was */
+	void sample( Idx const &idx, Reader &src, size_t voxel_bytes, char *dst ) const
+	{
+		const auto base = src.tell();
+		for_each_sample( idx, 0, [&]( uint64_t d, uint64_t s ) {
+			src.seek( base + s * voxel_bytes );
+			if ( src.read( dst + d * voxel_bytes, voxel_bytes ) != voxel_bytes ) {
+				throw runtime_error( vm::fmt( "unexpected end of brick {}", idx ) );
+			}
+		} );
+		src.seek( base );
+	}
+
+	/* zeroes the samples of grid slices [ slice, ... ) in a channel */
+	void clear_from( uint32_t slice, size_t voxel_bytes, char *dst ) const
+	{
+		uint32_t p = 0;
+		while ( p != dim.z && center( p, raw.z ) < uint64_t( slice ) * block_inner ) {
+			++p;
+		}
+		const auto plane = uint64_t( dim.x ) * dim.y * voxel_bytes;
+		std::fill( dst + p * plane, dst + dim.z * plane, 0 );
+	}
+
+public:
+	uint32_t scale;
+	/* zero without a preview */
+	Idx dim = Idx{};
+
+private:
+	/* calls f( preview voxel, block voxel ) for every sample in the block */
+	template <typename F>
+	void for_each_sample( Idx const &idx, unsigned level, F const &f ) const
+	{
+		if ( not scale ) {
+			return;
+		}
+		/* preview and block voxel of every sample along an axis */
+		auto samples = [&]( uint32_t i, uint32_t extent, uint32_t n, vector<pair<uint32_t, uint32_t>> &out ) {
+			out.clear();
+			const uint64_t beg = uint64_t( i ) * block_inner;
+			const uint64_t end = beg + ( block_inner << level );
+			for ( auto p = uint32_t( std::min<uint64_t>( beg / scale, n ) ); p != n; ++p ) {
+				const auto c = center( p, extent );
+				if ( c >= end ) break;
+				if ( c < beg ) continue;
+				out.emplace_back( p, uint32_t( ( c - beg + padding ) >> level ) );
+			}
+		};
+		samples( idx.x, raw.x, dim.x, xs );
+		samples( idx.y, raw.y, dim.y, ys );
+		samples( idx.z, raw.z, dim.z, zs );
+		for ( auto &z : zs ) {
+			for ( auto &y : ys ) {
+				for ( auto &x : xs ) {
+					f( ( uint64_t( z.first ) * dim.y + y.first ) * dim.x + x.first,
+					   ( uint64_t( z.second ) * block_size + y.second ) * block_size + x.second );
+				}
+			}
+		}
+	}
+
+private:
+	Idx raw;
+	uint64_t block_size, block_inner, padding;
+	mutable vector<pair<uint32_t, uint32_t>> xs, ys, zs;
+};
+
+VM_END_MODULE()
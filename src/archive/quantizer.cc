@@ -0,0 +1,94 @@
+#include <cmath>
+#include <random>
+#include "quantizer.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+void Quantizer::build( RegionSource const &input, Idx const &raw, size_t channels,
+					   QuantizeOptions const &opts )
+{
+	/* fixed seed, every process archiving a slice range samples alike */
+	vector<uint64_t> hist( 1 << 16 );
+	mt19937 rng( 0 );
+	const auto size = Idx{}
+						.set_x( std::min( raw.x, 32u ) )
+						.set_y( std::min( raw.y, 32u ) )
+						.set_z( std::min( raw.z, 32u ) );
+	vector<uint16_t> region( size.total() * channels );
+	for ( uint32_t i = 0; i != opts.samples; ++i ) {
+		const auto start = Idx{}
+							 .set_x( rng() % ( raw.x - size.x + 1 ) )
+							 .set_y( rng() % ( raw.y - size.y + 1 ) )
+							 .set_z( rng() % ( raw.z - size.z + 1 ) );
+		input( start, size, reinterpret_cast<unsigned char *>( region.data() ) );
+		for ( auto v : region ) {
+			++hist[ v ];
+		}
+	}
+	uint64_t total = 0;
+	for ( auto n : hist ) {
+		total += n;
+	}
+
+	lut.resize( hist.size() );
+	transfer.assign( 256, 0.f );
+	if ( opts.mode == Quantize::Window ) {
+		uint32_t lo = opts.window_lo, hi = opts.window_hi;
+		if ( lo >= hi ) {
+			/* percentiles of the sampled histogram */
+			const auto clip = uint64_t( total * opts.clip_percent / 100 );
+			uint64_t acc = 0;
+			for ( lo = 0; lo + 1 < hist.size() && acc + hist[ lo ] <= clip; ++lo ) {
+				acc += hist[ lo ];
+			}
+			acc = 0;
+			for ( hi = hist.size() - 1; hi > lo && acc + hist[ hi ] <= clip; --hi ) {
+				acc += hist[ hi ];
+			}
+			hi = std::max( hi, lo + 1 );
+		}
+		const double scale = 255.0 / ( hi - lo );
+		for ( uint32_t v = 0; v != lut.size(); ++v ) {
+			const auto c = std::round( ( double( v ) - lo ) * scale );
+			lut[ v ] = c < 0 ? 0 : c > 255 ? 255 : (unsigned char)c;
+		}
+		for ( uint32_t c = 0; c != 256; ++c ) {
+			transfer[ c ] = lo + c / scale;
+		}
+		vm::println( "quantize window: [{}, {}]", lo, hi );
+	} else if ( opts.mode == Quantize::Equalize ) {
+		uint64_t acc = 0;
+		for ( uint32_t v = 0; v != lut.size(); ++v ) {
+			/* centre of the voxel's cdf step */
+			const auto c = total ? ( acc + hist[ v ] / 2.0 ) * 256 / total : 0.0;
+			lut[ v ] = c > 255 ? 255 : (unsigned char)c;
+			acc += hist[ v ];
+		}
+		/* mean sampled value of each code, the centre of its range if unsampled */
+		vector<double> sum( 256 ), count( 256 );
+		vector<uint32_t> first( 256, lut.size() ), last( 256, 0 );
+		for ( uint32_t v = 0; v != lut.size(); ++v ) {
+			const auto c = lut[ v ];
+			sum[ c ] += double( v ) * hist[ v ];
+			count[ c ] += hist[ v ];
+			first[ c ] = std::min( first[ c ], v );
+			last[ c ] = std::max( last[ c ], v );
+		}
+		for ( uint32_t c = 0; c != 256; ++c ) {
+			if ( count[ c ] ) {
+				transfer[ c ] = sum[ c ] / count[ c ];
+			} else if ( first[ c ] <= last[ c ] ) {
+				transfer[ c ] = ( first[ c ] + last[ c ] ) / 2.0;
+			} else {
+				transfer[ c ] = c ? transfer[ c - 1 ] : 0.f;
+			}
+		}
+		vm::println( "quantize equalize: {} sampled voxel(s)", total );
+	} else {
+		throw runtime_error( vm::fmt( "unknown quantize mode: {}", int( opts.mode ) ) );
+	}
+}
+
+VM_END_MODULE()
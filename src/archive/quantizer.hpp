@@ -0,0 +1,27 @@
+#pragma once
+
+#include <varch/archive/archiver.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+/* maps uint16 voxels to 8 bits through a lut built from a sampled histogram */
+struct Quantizer
+{
+	/* input yields uint16 voxels with channels interleaved */
+	void build( RegionSource const &input, Idx const &raw, std::size_t channels,
+				QuantizeOptions const &opts );
+
+	void map( uint16_t const *src, unsigned char *dst, std::size_t n ) const
+	{
+		for ( std::size_t i = 0; i != n; ++i ) {
+			dst[ i ] = lut[ src[ i ] ];
+		}
+	}
+
+public:
+	std::vector<unsigned char> lut;
+	/* physical value of each 8-bit code, stored in the footer */
+	std::vector<float> transfer;
+};
+
+VM_END_MODULE()
@@ -0,0 +1,202 @@
+#include <future>
+#include <fstream>
+#include <varch/archive/transcoder.hpp>
+#include <varch/unarchive/unarchiver.hpp>
+#include <varch/utils/unbounded_io.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+static ifstream open_input( string const &path )
+{
+	ifstream is( path, ios::ate | ios::binary );
+	if ( not is.is_open() ) {
+		throw runtime_error( vm::fmt( "can not open input file: {}", path ) );
+	}
+	return is;
+}
+
+static ofstream open_output( string const &path )
+{
+	ofstream os( path, ios::binary );
+	if ( not os.is_open() ) {
+		throw runtime_error( "can not open output file" );
+	}
+	return os;
+}
+
+struct TranscoderImpl final : vm::NoCopy, vm::NoMove
+{
+	TranscoderImpl( TranscoderOptions const &opts ) :
+	  input_file( open_input( opts.input ) ),
+	  reader( input_file, 0, input_file.tellg() ),
+	  unarchiver( reader, opts.decode_opts ),
+	  raw( unarchiver.raw() ),
+	  src_dim( unarchiver.dim() ),
+	  src_block_size( unarchiver.block_size() ),
+	  src_inner( unarchiver.block_inner() ),
+	  src_padding( unarchiver.padding() ),
+	  voxel_size( unarchiver.voxel_size() ),
+	  channels( unarchiver.channels() ),
+	  output_file( open_output( opts.output ) ),
+	  writer( output_file ),
+	  archiver( ArchiverOptions( opts.archive_opts )
+				  .set_x( raw.x )
+				  .set_y( raw.y )
+				  .set_z( raw.z )
+				  .set_channels( channels )
+				  .set_encode_method( unarchiver.encode_method() )
+				  .set_quantize( QuantizeOptions{} )
+				  .set_transfer( unarchiver.transfer() ),
+				[this]( Idx const &start, Idx const &size, unsigned char *dst ) {
+					read_region( start, size, dst );
+				},
+				writer )
+	{
+	}
+
+	~TranscoderImpl()
+	{
+		if ( prefetch.valid() ) {
+			prefetch.wait();
+		}
+	}
+
+	bool transcode()
+	{
+		auto res = archiver.convert();
+		if ( prefetch.valid() ) {
+			prefetch.get();
+		}
+		layers.clear();
+		return res;
+	}
+
+private:
+	/* regions of a strided convert advance monotonically in z */
+	void read_region( Idx const &start, Idx const &size, unsigned char *dst )
+	{
+		const auto row_bytes = size_t( size.x ) * voxel_size * channels;
+		const auto first = start.z / src_inner;
+		const auto last = ( start.z + size.z - 1 ) / src_inner;
+		for ( auto it = layers.begin(); it != layers.end() && it->first < first; ) {
+			if ( is_prefetching( it->first ) ) break;
+			it = layers.erase( it );
+		}
+		for ( uint32_t z = 0; z != size.z; ++z ) {
+			const auto gz = start.z + z;
+			auto &src = layer( gz / src_inner );
+			for ( uint32_t y = 0; y != size.y; ++y ) {
+				const auto offset = ( size_t( gz % src_inner ) * raw.y + start.y + y ) * raw.x + start.x;
+				memcpy( dst, src.data() + offset * voxel_size * channels, row_bytes );
+				dst += row_bytes;
+			}
+		}
+		start_prefetch( last + 1 );
+	}
+
+	vector<unsigned char> &layer( uint32_t k )
+	{
+		/* the unarchiver decodes on one thread at a time */
+		if ( prefetch.valid() ) {
+			prefetch.get();
+		}
+		auto it = layers.find( k );
+		if ( it == layers.end() ) {
+			it = layers.emplace( k, vector<unsigned char>() ).first;
+			decode_layer( k, it->second );
+		}
+		return it->second;
+	}
+
+	bool is_prefetching( uint32_t k ) const
+	{
+		return prefetch.valid() && prefetching == k;
+	}
+
+	void start_prefetch( uint32_t k )
+	{
+		if ( k >= src_dim.z || layers.count( k ) ) {
+			return;
+		}
+		if ( prefetch.valid() ) {
+			prefetch.get();
+		}
+		auto &dst = layers[ k ];
+		prefetching = k;
+		prefetch = std::async( std::launch::async, [this, k, &dst] { decode_layer( k, dst ); } );
+	}
+
+	/* the inner voxels of block layer k, x-major with channels interleaved */
+	void decode_layer( uint32_t k, vector<unsigned char> &dst )
+	{
+		const auto nz = std::min( src_inner, raw.z - k * src_inner );
+		const auto stride = voxel_size * channels;
+		dst.resize( size_t( raw.x ) * raw.y * nz * stride );
+
+		vector<Idx> blocks;
+		for ( uint32_t j = 0; j != src_dim.y; ++j ) {
+			for ( uint32_t i = 0; i != src_dim.x; ++i ) {
+				blocks.emplace_back( Idx{}.set_x( i ).set_y( j ).set_z( k ) );
+			}
+		}
+		for ( uint32_t c = 0; c != channels; ++c ) {
+			unarchiver.batch_unarchive( blocks, c, [&]( Idx const &idx, unsigned char const *block ) {
+				const auto nx = std::min( src_inner, raw.x - idx.x * src_inner );
+				const auto ny = std::min( src_inner, raw.y - idx.y * src_inner );
+				for ( uint32_t z = 0; z != nz; ++z ) {
+					for ( uint32_t y = 0; y != ny; ++y ) {
+						auto src = block + ( ( ( z + src_padding ) * src_block_size + y + src_padding ) *
+											   src_block_size +
+											 src_padding ) *
+											 voxel_size;
+						auto p = dst.data() +
+								 ( ( size_t( z ) * raw.y + idx.y * src_inner + y ) * raw.x + idx.x * src_inner ) * stride +
+								 c * voxel_size;
+						if ( channels == 1 ) {
+							memcpy( p, src, nx * voxel_size );
+							continue;
+						}
+						for ( uint32_t x = 0; x != nx; ++x, p += stride, src += voxel_size ) {
+							memcpy( p, src, voxel_size );
+						}
+					}
+				}
+			} );
+		}
+	}
+
+private:
+	ifstream input_file;
+	StreamReader reader;
+	Unarchiver unarchiver;
+	const Idx raw, src_dim;
+	const uint32_t src_block_size, src_inner, src_padding, voxel_size, channels;
+
+	/* decoded block layers by z, erased once behind the regions read */
+	map<uint32_t, vector<unsigned char>> layers;
+	uint32_t prefetching = 0;
+	std::future<void> prefetch;
+
+	ofstream output_file;
+	UnboundedStreamWriter writer;
+	Archiver archiver;
+};
+
+VM_EXPORT
+{
+	Transcoder::Transcoder( TranscoderOptions const &opts ) :
+	  _( new TranscoderImpl( opts ) )
+	{
+	}
+	Transcoder::~Transcoder()
+	{
+	}
+	bool Transcoder::transcode()
+	{
+		return _->transcode();
+	}
+}
+
+VM_END_MODULE()
@@ -0,0 +1,250 @@
+#include <fstream>
+#include <varch/archive/updater.hpp>
+#include <varch/unarchive/unarchiver.hpp>
+#include <varch/utils/unbounded_io.hpp>
+#include <varch/utils/unbounded_vector_writer.hpp>
+#include "../unarchive/crc32c.hpp"
+#include "frame_filler.hpp"
+#include "preview.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+struct UpdaterImpl final : vm::NoCopy, vm::NoMove
+{
+	UpdaterImpl( UpdaterOptions const &opts ) :
+	  path( opts.archive ),
+	  archive_opts( opts.archive_opts )
+	{
+	}
+
+	bool update( Idx const &start, Idx const &size, unsigned char const *src )
+	{
+		ifstream is( path, ios::ate | ios::binary );
+		if ( not is.is_open() ) {
+			throw runtime_error( vm::fmt( "can not open archive: {}", path ) );
+		}
+		StreamReader reader( is, 0, is.tellg() );
+		UnarchiverData archive( reader );
+		auto &header = archive.header;
+		auto &footer = archive.footer;
+		const auto body_size = archive.content.size();
+		if ( not size.total() ||
+			 uint64_t( start.x ) + size.x > header.raw.x ||
+			 uint64_t( start.y ) + size.y > header.raw.y ||
+			 uint64_t( start.z ) + size.z > header.raw.z ) {
+			throw runtime_error( vm::fmt( "region {} + {} out of raw {}", start, size, header.raw ) );
+		}
+
+		vector<Idx> blocks;
+		vector<vector<char>> bricks;
+		{
+			/* unchanged voxels of the affected blocks are kept exact if possible */
+			Unarchiver unarchiver( reader, DecodeOptions{}
+											 .set_device( archive_opts.compress_opts.device )
+											 .set_refine( true ) );
+			patch_blocks( unarchiver, start, size, src, blocks, bricks );
+		}
+		/* the old footer becomes a frame, checksummed like the others, and
+		   is padded so that the appended frames stay aligned */
+		const auto filler = make_filler( filler_size( body_size, 0, header.frame_alignment() ) );
+		const auto part_base = body_size + filler.size();
+		const bool checksummed = footer.frame_crc.size() == footer.frame_count();
+		uint32_t gap_crc = 0;
+		if ( checksummed ) {
+			vector<char> gap( body_size - footer.frame_offset.back() );
+			archive.content.seek( footer.frame_offset.back() );
+			if ( archive.content.read( gap.data(), gap.size() ) != gap.size() ) {
+				throw runtime_error( "unexpected end of archive body" );
+			}
+			gap_crc = crc32c( filler.data(), filler.size(), crc32c( gap.data(), gap.size() ) );
+		}
+		is.close();
+
+		if ( footer.has_preview() ) {
+			PreviewSampler sampler( header.raw, footer.preview_scale, header.block_size, header.block_inner, header.padding );
+			const auto voxel_size = header.voxel_size();
+			const auto channel_bytes = footer.preview.size() / footer.channels();
+			for ( size_t i = 0; i != blocks.size(); ++i ) {
+				for ( uint32_t c = 0; c != footer.channels(); ++c ) {
+					sampler.sample( blocks[ i ], 0, bricks[ i ].data() + c * voxel_size, voxel_size,
+									voxel_size * footer.channels(), footer.preview.data() + c * channel_bytes );
+				}
+			}
+		}
+
+		vector<char> part;
+		archive_blocks( header, footer, blocks, bricks, part );
+		bricks.clear();
+
+		SliceReader part_reader( part.data(), part.size() );
+		UnarchiverData updated( part_reader );
+		if ( updated.header.frame_size != header.frame_size ) {
+			throw runtime_error( vm::fmt( "frame size {} of the updated blocks differs from the archive's {}",
+										  updated.header.frame_size, header.frame_size ) );
+		}
+
+		/* the old footer lies between the old and the appended frames,
+		   it becomes a frame that no block refers to */
+		footer.frame_offset.emplace_back( part_base );
+		const auto frame_base = footer.frame_count();
+		for ( int j = 1; j < updated.footer.frame_offset.size(); ++j ) {
+			footer.frame_offset.emplace_back( part_base + updated.footer.frame_offset[ j ] );
+		}
+		if ( checksummed ) {
+			footer.frame_crc.emplace_back( gap_crc );
+			footer.frame_crc.insert( footer.frame_crc.end(), updated.footer.frame_crc.begin(), updated.footer.frame_crc.end() );
+		} else {
+			footer.frame_crc.clear();
+		}
+		for ( uint32_t c = 0; c != footer.channels(); ++c ) {
+			for ( auto &entry : updated.footer.index( c ) ) {
+				auto idx = entry.second;
+				if ( idx.codec == BlockCodec::Empty ) continue;
+				idx.first_frame += frame_base;
+				idx.last_frame += frame_base;
+				footer.index( c )[ entry.first ] = idx;
+				if ( footer.has_stats() ) {
+					footer.stats_idx[ c ][ entry.first ] = updated.footer.stats_idx[ c ].at( entry.first );
+				}
+				if ( footer.has_residuals() ) {
+					footer.residual_idx[ c ].erase( entry.first );
+				}
+			}
+		}
+		for ( uint32_t c = 0; c != updated.footer.residual_idx.size(); ++c ) {
+			for ( auto &entry : updated.footer.residual_idx[ c ] ) {
+				footer.residual_idx[ c ][ entry.first ] = entry.second + frame_base;
+			}
+		}
+
+		fstream os( path, ios::in | ios::out | ios::binary );
+		if ( not os.is_open() ) {
+			throw runtime_error( vm::fmt( "can not open archive for writing: {}", path ) );
+		}
+		UnboundedStreamWriter body_writer( os, sizeof( Header ) );
+		body_writer.seek( body_size );
+		body_writer.write( filler.data(), filler.size() );
+		body_writer.write( part.data() + sizeof( Header ), updated.footer.frame_offset.back() );
+		footer.write_to( body_writer, header );
+
+		header.version = archive_version;
+		StreamWriter header_writer( os, 0, sizeof( Header ) );
+		header_writer.write_typed( header );
+		os.flush();
+
+		vm::println( "updated {} block(s), appended {} frame(s)", blocks.size(), updated.footer.frame_count() );
+		return true;
+	}
+
+private:
+	/* decodes every block overlapping the region, padding included,
+	   and overwrites the overlap with the new voxels */
+	void patch_blocks( Unarchiver &unarchiver, Idx const &start, Idx const &size, unsigned char const *src,
+					   vector<Idx> &blocks, vector<vector<char>> &bricks )
+	{
+		const int64_t N = unarchiver.block_size();
+		const int64_t inner = unarchiver.block_inner();
+		const int64_t padding = unarchiver.padding();
+		const auto stride = unarchiver.voxel_size() * unarchiver.channels();
+		const auto dim = unarchiver.dim();
+
+		/* block i covers [ i * inner - padding, i * inner - padding + N ) */
+		auto blocks_along = [&]( int64_t start, int64_t size, int64_t dim ) {
+			const auto before = start + padding - N;
+			const auto first = before < 0 ? 0 : before / inner + 1;
+			const auto last = std::min( ( start + size + padding - 1 ) / inner + 1, dim );
+			return make_pair( uint32_t( first ), uint32_t( last ) );
+		};
+		const auto xs = blocks_along( start.x, size.x, dim.x );
+		const auto ys = blocks_along( start.y, size.y, dim.y );
+		const auto zs = blocks_along( start.z, size.z, dim.z );
+
+		for ( auto k = zs.first; k < zs.second; ++k ) {
+			for ( auto j = ys.first; j < ys.second; ++j ) {
+				for ( auto i = xs.first; i < xs.second; ++i ) {
+					const auto idx = Idx{}.set_x( i ).set_y( j ).set_z( k );
+					if ( unarchiver.block_level( idx ) || !( unarchiver.resolve( idx ) == idx ) ) {
+						throw runtime_error( vm::fmt( "block {} is merged by adaptive bricking, not updatable", idx ) );
+					}
+					bricks.emplace_back( N * N * N * stride );
+					auto brick = reinterpret_cast<unsigned char *>( bricks.back().data() );
+					unarchiver.unarchive_interleaved_to( idx, cufx::MemoryView1D<unsigned char>( brick, bricks.back().size() ) );
+
+					/* overlap of the block and the region in raw coordinates */
+					const int64_t origin[ 3 ] = { i * inner - padding, j * inner - padding, k * inner - padding };
+					const int64_t rs[ 3 ] = { start.x, start.y, start.z };
+					const int64_t re[ 3 ] = { rs[ 0 ] + size.x, rs[ 1 ] + size.y, rs[ 2 ] + size.z };
+					int64_t lo[ 3 ], hi[ 3 ];
+					for ( int a = 0; a != 3; ++a ) {
+						lo[ a ] = std::max( origin[ a ], rs[ a ] );
+						hi[ a ] = std::min( origin[ a ] + N, re[ a ] );
+					}
+					const auto row_bytes = ( hi[ 0 ] - lo[ 0 ] ) * stride;
+					for ( auto z = lo[ 2 ]; z < hi[ 2 ]; ++z ) {
+						for ( auto y = lo[ 1 ]; y < hi[ 1 ]; ++y ) {
+							auto dst = brick + ( ( ( z - origin[ 2 ] ) * N + y - origin[ 1 ] ) * N + lo[ 0 ] - origin[ 0 ] ) * stride;
+							auto s = src + ( ( ( z - rs[ 2 ] ) * size.y + y - rs[ 1 ] ) * size.x + lo[ 0 ] - rs[ 0 ] ) * stride;
+							memcpy( dst, s, row_bytes );
+						}
+					}
+					blocks.emplace_back( idx );
+				}
+			}
+		}
+	}
+
+	/* encodes the patched blocks as a sparse archive of the same geometry */
+	void archive_blocks( Header const &header, Footer const &footer, vector<Idx> const &blocks,
+						 vector<vector<char>> const &bricks, vector<char> &part )
+	{
+		auto opts = ArchiverOptions( archive_opts )
+					  .set_x( header.raw.x )
+					  .set_y( header.raw.y )
+					  .set_z( header.raw.z )
+					  .set_log_block_size( header.log_block_size )
+					  .set_padding( header.padding )
+					  .set_channels( footer.channels() )
+					  .set_encode_method( header.encode_method )
+					  .set_residual( footer.has_residuals() )
+					  .set_quantize( QuantizeOptions{} )
+					  .set_block_stats( footer.has_stats() )
+					  .set_histogram_bins( footer.histogram_bins )
+					  .set_preview_size( 0 )
+					  .set_frame_alignment( header.frame_alignment() )
+					  .set_max_block_level( 0 )
+					  .set_slice_begin( 0 )
+					  .set_slice_end( size_t( -1 ) );
+		UnboundedVectorWriter writer( part );
+		Archiver archiver( opts, writer );
+		size_t i = 0;
+		archiver.convert_sparse( [&]( Idx &idx, vm::Arc<Reader> &brick ) {
+			if ( i == blocks.size() ) return false;
+			idx = blocks[ i ];
+			brick.reset( new SliceReader( bricks[ i ].data(), bricks[ i ].size() ) );
+			return ++i, true;
+		} );
+	}
+
+private:
+	string path;
+	ArchiverOptions archive_opts;
+};
+
+VM_EXPORT
+{
+	Updater::Updater( UpdaterOptions const &opts ) :
+	  _( new UpdaterImpl( opts ) )
+	{
+	}
+	Updater::~Updater()
+	{
+	}
+	bool Updater::update( Idx const &start, Idx const &size, unsigned char const *src )
+	{
+		return _->update( start, size, src );
+	}
+}
+
+VM_END_MODULE()
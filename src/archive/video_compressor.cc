@@ -5,10 +5,12 @@
 #include <varch/utils/padded_reader.hpp>
 #include <varch/utils/filter_reader.hpp>
 #include <varch/utils/self_owned_reader.hpp>
+#include <varch/utils/unbounded_vector_writer.hpp>
 #include "backends/nvenc/nvencoder_wrapper.hpp"
 #ifdef VARCH_OPENH264_CODEC
 #include "backends/openh264/isvc_encoder_wrapper.hpp"
 #endif
+#include "frame_filler.hpp"
 #include "video_compressor.hpp"
 
 VM_BEGIN_MODULE( vol )
@@ -17,8 +19,11 @@ using namespace std;
 
 struct VideoCompressorImpl
 {
-	VideoCompressorImpl( Writer &out, EncodeOptions const &opts ) :
-	  out( out )
+	VideoCompressorImpl( Writer &out, EncodeOptions const &opts, uint32_t alignment ) :
+	  out( out ),
+	  width( opts.width ),
+	  height( opts.height ),
+	  alignment( alignment )
 	{
 		static mutex mut;
 		unique_lock<mutex> lk( mut );
@@ -99,9 +104,21 @@ struct VideoCompressorImpl
 					part_reader.seek( 0 );
 					vector<uint32_t> frame_len;
 					// vm::println( "encode with {} blocks", input_readers.size() );
-					this->encoder->encode( part_reader, out, frame_len );
-					for ( auto &len : frame_len ) {
-						frame_offset.emplace_back( frame_offset.back() + len );
+					if ( alignment ) {
+						UnboundedVectorWriter staged_writer( staged );
+						this->encoder->encode( part_reader, staged_writer, frame_len );
+						uint64_t pos = 0;
+						for ( auto &len : frame_len ) {
+							out.write( staged.data() + pos, len );
+							pos += len;
+							len += write_filler( frame_offset.back() + len );
+							frame_offset.emplace_back( frame_offset.back() + len );
+						}
+					} else {
+						this->encoder->encode( part_reader, out, frame_len );
+						for ( auto &len : frame_len ) {
+							frame_offset.emplace_back( frame_offset.back() + len );
+						}
 					}
 				}
 				finish_cv.notify_one();
@@ -152,6 +169,18 @@ struct VideoCompressorImpl
 		// vm::println( "{}", frame_offset );
 	}
 
+	/* pads the body up to the next aligned file offset from end,
+	   returns the bytes written */
+	uint32_t write_filler( uint64_t end )
+	{
+		const auto n = filler_size( sizeof( Header ) + end, 0, alignment );
+		if ( n ) {
+			const auto filler = make_filler( n );
+			out.write( filler.data(), n );
+		}
+		return n;
+	}
+
 	void wait()
 	{
 		input_mut.lock();
@@ -175,12 +204,15 @@ struct VideoCompressorImpl
 public:
 	// EncodeOptions opts;
 	Writer &out;
+	unsigned width, height;
 	shared_ptr<IEncoder> encoder;
 	vector<vm::Arc<Reader>> readers;
 	size_t total_size = 0;
 	size_t frame_size, nframe_batch;
 	size_t emitted_frames = 0;
 	vector<uint64_t> frame_offset = { 0 };
+	uint32_t alignment;
+	vector<char> staged;
 	bool should_stop = false, should_flush = false;
 
 	mutex input_mut, work_mut;
@@ -188,8 +220,8 @@ public:
 	unique_ptr<thread> worker;
 };
 
-VideoCompressor::VideoCompressor( Writer &out, EncodeOptions const &opts ) :
-  _( new VideoCompressorImpl( out, opts ) )
+VideoCompressor::VideoCompressor( Writer &out, EncodeOptions const &opts, uint32_t alignment ) :
+  _( new VideoCompressorImpl( out, opts, alignment ) )
 {
 }
 
@@ -217,5 +249,17 @@ vector<uint64_t> const &VideoCompressor::frame_offset() const
 {
 	return _->frame_offset;
 }
+uint32_t VideoCompressor::frame_alignment() const
+{
+	return _->alignment;
+}
+uint16_t VideoCompressor::frame_width() const
+{
+	return _->width;
+}
+uint16_t VideoCompressor::frame_height() const
+{
+	return _->height;
+}
 
 VM_END_MODULE()
@@ -1,26 +1,30 @@
 #pragma once
 
 #include <VMUtils/nonnull.hpp>
-#include <VMUtils/concepts.hpp>
 #include <VMUtils/attributes.hpp>
-#include <varch/utils/common.hpp>
-#include <varch/utils/io.hpp>
+#include "icompressor.hpp"
 
 VM_BEGIN_MODULE( vol )
 
 struct VideoCompressorImpl;
 
-struct VideoCompressor final : vm::NoCopy
+struct VideoCompressor final : ICompressor
 {
-	VideoCompressor( Writer &out, EncodeOptions const &_ = EncodeOptions{} );
+	/* with alignment every frame but the first starts at a multiple of
+	   alignment in the archive file, out being its body after the header */
+	VideoCompressor( Writer &out, EncodeOptions const &_ = EncodeOptions{}, uint32_t alignment = 0 );
 	~VideoCompressor();
 
-	BlockIndex accept( vm::Arc<Reader> &&reader );
-	void flush( bool wait = false );
-	void wait();
-	uint32_t frame_size() const;
-	std::vector<uint64_t> const &frame_offset() const;
-	uint32_t frame_count() const { return frame_offset().size() - 1; }
+	BlockIndex accept( vm::Arc<Reader> &&reader ) override;
+	void flush( bool wait = false ) override;
+	void wait() override;
+	uint32_t frame_size() const override;
+	FrameCodec codec() const override { return FrameCodec::H264; }
+	FramePacking packing() const override { return FramePacking::Nv12; }
+	uint32_t frame_alignment() const override;
+	uint16_t frame_width() const override;
+	uint16_t frame_height() const override;
+	std::vector<uint64_t> const &frame_offset() const override;
 
 private:
 	vm::Box<VideoCompressorImpl> _;
@@ -312,6 +312,10 @@ void NvDecoderAsyncImpl::decode( Reader &reader, Consumer const &consumer )
 	  [&] {
 		  uint32_t frame_len;
 		  while ( reader.read( reinterpret_cast<char *>( &frame_len ), sizeof( uint32_t ) ) ) {
+			  if ( frame_len & frame_filler ) {
+				  reader.seek( reader.tell() + ( frame_len & ~frame_filler ) );
+				  continue;
+			  }
 			  auto packet = get_packet( frame_len );
 			  reader.read( reinterpret_cast<char *>( packet ), frame_len );
 			  //   vm::println( "#dec_src: { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} ...",
@@ -120,6 +120,10 @@ public:
 		out.id = 0;
 		uint32_t frame_len;
 		while ( reader.read_typed( frame_len ) ) {
+			if ( frame_len & frame_filler ) {
+				reader.seek( reader.tell() + ( frame_len & ~frame_filler ) );
+				continue;
+			}
 			auto packet = get_packet( frame_len );
 			reader.read( reinterpret_cast<char *>( packet ), frame_len );
 			// vm::println( "#dec_src: { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} { >#x2} ...",
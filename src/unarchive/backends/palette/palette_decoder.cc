@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstring>
+#include "palette_decoder.hpp"
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+namespace
+{
+struct ChunkReader
+{
+	unsigned char const *p, *end;
+
+	void require( size_t n ) const
+	{
+		if ( size_t( end - p ) < n ) {
+			throw runtime_error( "truncated palette chunk" );
+		}
+	}
+
+	template <typename T>
+	T get()
+	{
+		T x;
+		require( sizeof( T ) );
+		memcpy( &x, p, sizeof( T ) );
+		p += sizeof( T );
+		return x;
+	}
+
+	uint32_t get_varint()
+	{
+		uint32_t x = 0;
+		for ( unsigned shift = 0; shift < 35; shift += 7 ) {
+			require( 1 );
+			const auto b = *p++;
+			x |= uint32_t( b & 0x7f ) << shift;
+			if ( not( b & 0x80 ) ) return x;
+		}
+		throw runtime_error( "invalid varint in palette chunk" );
+	}
+};
+
+}  // namespace
+
+template <typename T>
+void PaletteDecoder::decode( unsigned char const *chunk, size_t len,
+							 T *dst, size_t n ) const
+{
+	ChunkReader reader{ chunk, chunk + len };
+	const auto npalette = reader.get<uint32_t>();
+	reader.require( size_t( npalette ) * sizeof( T ) );
+	auto palette = reinterpret_cast<T const *>( reader.p );
+	reader.p += size_t( npalette ) * sizeof( T );
+
+	switch ( reader.get<PaletteMode>() ) {
+	case PaletteMode::Bitpack: {
+		const auto bits = reader.get<uint8_t>();
+		if ( not bits ) {
+			if ( npalette != 1 ) {
+				throw runtime_error( "invalid palette chunk" );
+			}
+			std::fill( dst, dst + n, palette[ 0 ] );
+			return;
+		}
+		if ( bits > 32 || 64 % bits ) {
+			throw runtime_error( vm::fmt( "invalid palette index width: {}", int( bits ) ) );
+		}
+		const unsigned per_word = 64 / bits;
+		const uint64_t mask = ( uint64_t( 1 ) << bits ) - 1;
+		reader.require( ( n + per_word - 1 ) / per_word * sizeof( uint64_t ) );
+		for ( size_t i = 0; i < n; ) {
+			auto word = reader.get<uint64_t>();
+			const auto m = std::min( size_t( per_word ), n - i );
+			for ( size_t k = 0; k < m; ++k, word >>= bits ) {
+				const auto j = word & mask;
+				if ( j >= npalette ) {
+					throw runtime_error( "palette index out of range" );
+				}
+				dst[ i++ ] = palette[ j ];
+			}
+		}
+	} break;
+	case PaletteMode::Rle: {
+		const auto nruns = reader.get<uint32_t>();
+		size_t i = 0;
+		for ( uint32_t r = 0; r < nruns; ++r ) {
+			const size_t run = size_t( reader.get_varint() ) + 1;
+			const auto j = reader.get_varint();
+			if ( j >= npalette || run > n - i ) {
+				throw runtime_error( "invalid run in palette chunk" );
+			}
+			std::fill( dst + i, dst + i + run, palette[ j ] );
+			i += run;
+		}
+		if ( i != n ) {
+			throw runtime_error( vm::fmt( "palette chunk holds {} voxel(s), expected {}", i, n ) );
+		}
+	} break;
+	default: throw runtime_error( "unknown palette chunk mode" );
+	}
+}
+
+template void PaletteDecoder::decode( unsigned char const *, size_t, uint8_t *, size_t ) const;
+template void PaletteDecoder::decode( unsigned char const *, size_t, uint32_t *, size_t ) const;
+
+VM_END_MODULE()
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <varch/utils/common.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+/* decodes a palette chunk of n uint8 or uint32 voxels, see PaletteMode for the layout */
+struct PaletteDecoder final
+{
+	template <typename T>
+	void decode( unsigned char const *chunk, std::size_t len,
+				 T *dst, std::size_t n ) const;
+};
+
+VM_END_MODULE()
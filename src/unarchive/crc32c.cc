@@ -0,0 +1,101 @@
+#include <cstring>
+#include <array>
+#include "crc32c.hpp"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define VARCH_CRC32C_SSE42
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+/* slicing by 8 over the reflected polynomial 0x82f63b78 */
+static array<array<uint32_t, 256>, 8> make_tables()
+{
+	array<array<uint32_t, 256>, 8> t;
+	for ( uint32_t i = 0; i != 256; ++i ) {
+		uint32_t c = i;
+		for ( int k = 0; k != 8; ++k ) {
+			c = c & 1 ? ( c >> 1 ) ^ 0x82f63b78 : c >> 1;
+		}
+		t[ 0 ][ i ] = c;
+	}
+	for ( uint32_t i = 0; i != 256; ++i ) {
+		for ( int s = 1; s != 8; ++s ) {
+			t[ s ][ i ] = ( t[ s - 1 ][ i ] >> 8 ) ^ t[ 0 ][ t[ s - 1 ][ i ] & 0xff ];
+		}
+	}
+	return t;
+}
+
+static uint32_t crc32c_sw( uint32_t c, unsigned char const *p, size_t n )
+{
+	static const auto t = make_tables();
+	for ( ; n >= 8; n -= 8, p += 8 ) {
+		uint32_t lo, hi;
+		memcpy( &lo, p, 4 );
+		memcpy( &hi, p + 4, 4 );
+		lo ^= c;
+		c = t[ 7 ][ lo & 0xff ] ^ t[ 6 ][ ( lo >> 8 ) & 0xff ] ^
+			t[ 5 ][ ( lo >> 16 ) & 0xff ] ^ t[ 4 ][ lo >> 24 ] ^
+			t[ 3 ][ hi & 0xff ] ^ t[ 2 ][ ( hi >> 8 ) & 0xff ] ^
+			t[ 1 ][ ( hi >> 16 ) & 0xff ] ^ t[ 0 ][ hi >> 24 ];
+	}
+	while ( n-- ) {
+		c = ( c >> 8 ) ^ t[ 0 ][ ( c ^ *p++ ) & 0xff ];
+	}
+	return c;
+}
+
+#ifdef VARCH_CRC32C_SSE42
+
+#ifndef _MSC_VER
+__attribute__( ( target( "sse4.2" ) ) )
+#endif
+static uint32_t
+  crc32c_hw( uint32_t c, unsigned char const *p, size_t n )
+{
+	uint64_t c64 = c;
+	for ( ; n >= 8; n -= 8, p += 8 ) {
+		uint64_t v;
+		memcpy( &v, p, 8 );
+		c64 = _mm_crc32_u64( c64, v );
+	}
+	c = uint32_t( c64 );
+	while ( n-- ) {
+		c = _mm_crc32_u8( c, *p++ );
+	}
+	return c;
+}
+
+static bool has_sse42()
+{
+#ifdef _MSC_VER
+	int info[ 4 ];
+	__cpuid( info, 1 );
+	return info[ 2 ] & ( 1 << 20 );
+#else
+	return __builtin_cpu_supports( "sse4.2" );
+#endif
+}
+
+#endif
+
+uint32_t crc32c( void const *data, size_t len, uint32_t crc )
+{
+	auto p = static_cast<unsigned char const *>( data );
+#ifdef VARCH_CRC32C_SSE42
+	static const bool hw = has_sse42();
+	if ( hw ) {
+		return ~crc32c_hw( ~crc, p, len );
+	}
+#endif
+	return ~crc32c_sw( ~crc, p, len );
+}
+
+VM_END_MODULE()
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <VMUtils/modules.hpp>
+
+VM_BEGIN_MODULE( vol )
+
+/* crc32c ( castagnoli ) of len bytes continuing crc, the sse4.2 crc32
+   instruction is used when the cpu has it */
+uint32_t crc32c( void const *data, std::size_t len, uint32_t crc = 0 );
+
+VM_END_MODULE()
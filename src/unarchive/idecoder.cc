@@ -0,0 +1,52 @@
+#include <vector>
+#include <string>
+#include "idecoder.hpp"
+#include "backends/nvdec/nvdecoder_async.hpp"
+#ifdef VARCH_OPENH264_CODEC
+#include "backends/openh264/isvc_decoder_wrapper.hpp"
+#endif
+
+VM_BEGIN_MODULE( vol )
+
+using namespace std;
+
+struct DecoderBackend
+{
+	char const *name;
+	FrameCodec codec;
+	ComputeDevice device;
+	IDecoder *( *create )( DecodeOptions const &opts );
+};
+
+/* from the fastest, every backend compiled in is listed */
+static DecoderBackend const backends[] = {
+	{ "nvdec", FrameCodec::H264, ComputeDevice::Cuda,
+	  []( DecodeOptions const &opts ) -> IDecoder * { return new NvDecoderAsync( opts ); } },
+#ifdef VARCH_OPENH264_CODEC
+	{ "openh264", FrameCodec::H264, ComputeDevice::Cpu,
+	  []( DecodeOptions const &opts ) -> IDecoder * { return new IsvcDecoderWrapper( opts ); } },
+#endif
+};
+
+std::unique_ptr<IDecoder> create_decoder( DecodeOptions const &opts, FrameCodec codec )
+{
+	string errors;
+	for ( auto &backend : backends ) {
+		if ( backend.codec != codec ||
+			 opts.device != ComputeDevice::Default && opts.device != backend.device ) {
+			continue;
+		}
+		try {
+			return std::unique_ptr<IDecoder>( backend.create( opts ) );
+		} catch ( std::exception &e ) {
+			errors += vm::fmt( "\n  {}: {}", backend.name, e.what() );
+		}
+	}
+	if ( errors.empty() ) {
+		throw std::logic_error( vm::fmt( "no decoder for codec {} on device {} compiled in",
+										 int( codec ), int( opts.device ) ) );
+	}
+	throw std::runtime_error( vm::fmt( "no decoder for codec {} available:{}", int( codec ), errors ) );
+}
+
+VM_END_MODULE()
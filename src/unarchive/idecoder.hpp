@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <functional>
 #include <VMUtils/modules.hpp>
 #include <VMUtils/concepts.hpp>
@@ -14,4 +15,8 @@ struct IDecoder : vm::Dynamic, vm::NoCopy, vm::NoMove
 						 std::function<void( Packet const & )> const &consumer ) = 0;
 };
 
+/* the fastest backend for the codec that can be created on opts.device,
+   any device for ComputeDevice::Default, e.g. nvdec then openh264 */
+std::unique_ptr<IDecoder> create_decoder( DecodeOptions const &opts, FrameCodec codec = FrameCodec::H264 );
+
 VM_END_MODULE()
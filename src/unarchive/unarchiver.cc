@@ -1,11 +1,10 @@
 #include <algorithm>
+#include <cuda.h>
 #include <varch/unarchive/unarchiver.hpp>
 #include <varch/utils/linked_reader.hpp>
 #include "idecoder.hpp"
-#include "backends/nvdec/nvdecoder_async.hpp"
-#ifdef VARCH_OPENH264_CODEC
-#include "backends/openh264/isvc_decoder_wrapper.hpp"
-#endif
+#include "crc32c.hpp"
+#include "backends/palette/palette_decoder.hpp"
 
 VM_BEGIN_MODULE( vol )
 
@@ -13,37 +12,31 @@ using namespace std;
 
 struct UnarchiverImpl
 {
+	/* a block and its index entry */
+	using Entry = pair<Idx, BlockIndex>;
+
 	UnarchiverImpl( UnarchiverData &data, DecodeOptions const &opts ) :
-	  data( data )
+	  data( data ),
+	  refine( opts.refine && data.footer.has_residuals() ),
+	  verify_checksums( opts.verify_checksums && data.footer.has_checksums() )
 	{
-		switch ( opts.device ) {
-		case ComputeDevice::Cuda:
-			decoder.reset( new NvDecoderAsync( opts ) );
-			break;
-		case ComputeDevice::Cpu:
-		CPU:
-#ifdef VARCH_OPENH264_CODEC
-			decoder.reset( new IsvcDecoderWrapper( opts ) );
-#else
-			throw std::logic_error( "please recompile with openh264 codec support" );
-#endif
-			break;
-		default:
-			try {
-				decoder.reset( new NvDecoderAsync( opts ) );
-			} catch ( std::exception &e ) {
-				goto CPU;
-			}
+		if ( verify_checksums ) {
+			verified.resize( data.footer.frame_count(), false );
+		}
+		/* palette blocks are always decoded on the cpu */
+		if ( data.header.codec == FrameCodec::Palette ) {
+			return;
 		}
+		decoder = create_decoder( opts, data.header.codec );
 	}
 
 public:
-	void unarchive_to( std::vector<Idx> const &blocks_const,
+	void unarchive_to( uint32_t channel, std::vector<Idx> const &blocks_const,
 					   std::function<void( Idx const &idx, VoxelStreamPacket const & )> const &consumer )
 	{
 		auto blocks = blocks_const;
 		vector<int64_t> linked_block_offsets;
-		auto reader = sort_and_get_reader( blocks, linked_block_offsets );
+		auto reader = sort_and_get_reader( channel, blocks, linked_block_offsets );
 		int i = 0;
 		int64_t curr_block_offset = 0;
 		int64_t linked_read_pos = 0;
@@ -79,11 +72,49 @@ public:
 		  } );
 	}
 
-	std::size_t unarchive_to( Idx const &idx, cufx::MemoryView1D<unsigned char> const &dst )
+	std::size_t unarchive_to( uint32_t channel, Idx const &idx, cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		const auto entry = resolve( channel, idx );
+		auto &block = entry.second;
+		if ( block.codec == BlockCodec::Empty ) {
+			return fill_zeros( dst );
+		}
+		if ( block.level == 0 ) {
+			if ( refine && block.codec == BlockCodec::H264 ) {
+				auto &residuals = data.footer.residuals()[ channel ];
+				auto res = residuals.find( entry.first );
+				if ( res != residuals.end() ) {
+					return decode_refined( channel, entry.first, res->second, dst );
+				}
+			}
+			return decode_block( channel, entry, dst );
+		}
+		/* fine blocks of a merged node are usually fetched one after another */
+		if ( node_buffer.empty() || node_idx != entry.first || node_channel != channel ) {
+			node_buffer.resize( block_bytes() );
+			node_idx = entry.first;
+			node_channel = channel;
+			decode_block( channel, entry, node_buffer );
+		}
+		upsample( idx, entry.first, block.level );
+		return copy_to( dst, fine_buffer.data(), fine_buffer.size() );
+	}
+
+	/* h264 archives store blocks over the error bound as palette blocks */
+	std::size_t decode_block( uint32_t channel, Entry const &entry,
+							  cufx::MemoryView1D<unsigned char> const &dst )
 	{
-		std::size_t len;
+		if ( entry.second.codec == BlockCodec::Palette ) {
+			return decode_palette( entry.second, dst );
+		}
+		return decode_to( channel, entry.first, dst );
+	}
+
+	std::size_t decode_to( uint32_t channel, Idx const &idx, cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		std::size_t len = 0;
 		unarchive_to(
-		  { idx },
+		  channel, { idx },
 		  [&]( Idx const &, VoxelStreamPacket const &pkt ) {
 			  len += pkt.length;
 			  pkt.append_to( dst );
@@ -91,32 +122,456 @@ public:
 		return len;
 	}
 
+	/* a palette block is a single frame, decoded straight into host
+	   buffers and staged for device buffers */
+	std::size_t decode_palette( BlockIndex const &block, cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		const auto nbytes = block_bytes();
+		if ( dst.size() < nbytes ) {
+			throw std::logic_error(
+			  vm::fmt( "insufficient buffer size: {} < {}", dst.size(), nbytes ) );
+		}
+		const bool is_device = dst.device_id().is_device();
+		if ( is_device ) {
+			fine_buffer.resize( nbytes );
+		}
+		const auto ptr = is_device ? fine_buffer.data() : dst.ptr();
+		if ( data.header.voxel_size() == sizeof( uint32_t ) ) {
+			decode_palette_frame( block.first_frame, reinterpret_cast<uint32_t *>( ptr ), nbytes / sizeof( uint32_t ) );
+		} else {
+			decode_palette_frame( block.first_frame, reinterpret_cast<uint8_t *>( ptr ), nbytes );
+		}
+		return is_device ? copy_to( dst, fine_buffer.data(), nbytes ) : nbytes;
+	}
+
+	template <typename T>
+	void decode_palette_frame( uint32_t frame, T *dst, std::size_t n )
+	{
+		const auto beg = data.footer.frame_offset[ frame ];
+		const auto len = data.footer.frame_offset[ frame + 1 ] - beg;
+		uint32_t chunk_len = 0;
+		chunk_buffer.resize( len );
+		bool complete = true;
+		if ( auto src = planned_frames( frame, frame ) ) {
+			memcpy( chunk_buffer.data(), src, len );
+		} else {
+			data.content.seek( beg );
+			complete = data.content.read( reinterpret_cast<char *>( chunk_buffer.data() ), len ) == len;
+		}
+		if ( complete ) {
+			verify_frame( frame, chunk_buffer.data(), len );
+			memcpy( &chunk_len, chunk_buffer.data(), sizeof( chunk_len ) );
+		}
+		if ( chunk_len + sizeof( chunk_len ) != len ) {
+			throw std::runtime_error( vm::fmt( "corrupted frame {}", frame ) );
+		}
+		palette_decoder.decode( chunk_buffer.data() + sizeof( chunk_len ), chunk_len, dst, n );
+	}
+
+	/* the residual is ( original - decoded ) mod 256 */
+	std::size_t decode_refined( uint32_t channel, Idx const &idx, uint32_t residual_frame,
+								cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		const auto nbytes = block_bytes();
+		fine_buffer.resize( nbytes );
+		residual_buffer.resize( nbytes );
+		decode_to( channel, idx, fine_buffer );
+		decode_palette_frame( residual_frame, residual_buffer.data(), nbytes );
+		for ( std::size_t i = 0; i != nbytes; ++i ) {
+			fine_buffer[ i ] += residual_buffer[ i ];
+		}
+		return copy_to( dst, fine_buffer.data(), nbytes );
+	}
+
+	/* nearest sample of the merged node for every voxel of fine block idx */
+	void upsample( Idx const &idx, Idx const &node, unsigned level )
+	{
+		const size_t N = data.header.block_size;
+		const size_t N_i = data.header.block_inner;
+		fine_buffer.resize( block_bytes() );
+		auto dst = fine_buffer.data();
+		for ( size_t z = 0; z < N; ++z ) {
+			const auto nz = ( ( idx.z - node.z ) * N_i + z ) >> level;
+			for ( size_t y = 0; y < N; ++y ) {
+				const auto ny = ( ( idx.y - node.y ) * N_i + y ) >> level;
+				auto src = node_buffer.data() + ( nz * N + ny ) * N;
+				for ( size_t x = 0; x < N; ++x ) {
+					*dst++ = src[ ( ( idx.x - node.x ) * N_i + x ) >> level ];
+				}
+			}
+		}
+	}
+
+	std::size_t block_bytes() const
+	{
+		return data.header.block_size * data.header.block_size * data.header.block_size *
+			   data.header.voxel_size();
+	}
+
+	std::size_t copy_to( cufx::MemoryView1D<unsigned char> const &dst,
+						 unsigned char const *src, std::size_t len )
+	{
+		if ( dst.size() < len ) {
+			throw std::logic_error(
+			  vm::fmt( "insufficient buffer size: {} < {}", dst.size(), len ) );
+		}
+		if ( dst.device_id().is_device() ) {
+			cuMemcpyHtoD( (CUdeviceptr)dst.ptr(), src, len );
+		} else {
+			memcpy( dst.ptr(), src, len );
+		}
+		return len;
+	}
+
+	std::size_t fill_zeros( cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		if ( dst.size() < block_bytes() ) {
+			throw std::logic_error(
+			  vm::fmt( "insufficient buffer size: {} < {}", dst.size(), block_bytes() ) );
+		}
+		if ( dst.device_id().is_device() ) {
+			cuMemsetD8( (CUdeviceptr)dst.ptr(), 0, block_bytes() );
+		} else {
+			memset( dst.ptr(), 0, block_bytes() );
+		}
+		return block_bytes();
+	}
+
+	/* the octree node covering idx is keyed by idx rounded down to 2^level,
+	   archives without adaptive bricking only have level 0 nodes */
+	Entry resolve( uint32_t channel, Idx const &idx ) const
+	{
+		check_channel( channel );
+		auto &dim = data.header.dim;
+		if ( not( idx.x < dim.x && idx.y < dim.y && idx.z < dim.z ) ) {
+			throw std::logic_error( vm::fmt( "block {} out of grid {}", idx, dim ) );
+		}
+		Entry entry;
+		if ( not try_resolve( channel, idx, entry ) ) {
+			throw std::logic_error( vm::fmt( "block {} not found in archive", idx ) );
+		}
+		return entry;
+	}
+
+	bool try_resolve( uint32_t channel, Idx const &idx, Entry &entry ) const
+	{
+		for ( unsigned l = 0; l < 32; ++l ) {
+			auto key = Idx{}
+						 .set_x( idx.x >> l << l )
+						 .set_y( idx.y >> l << l )
+						 .set_z( idx.z >> l << l );
+			BlockIndex block;
+			if ( data.footer.find( channel, key, block ) &&
+				 not( ( idx.x - key.x ) >> block.level ) &&
+				 not( ( idx.y - key.y ) >> block.level ) &&
+				 not( ( idx.z - key.z ) >> block.level ) ) {
+				entry = Entry( key, block );
+				return true;
+			}
+			if ( key == Idx{} ) break;
+		}
+		return false;
+	}
+
+	Entry find_block( uint32_t channel, Idx const &idx ) const
+	{
+		check_channel( channel );
+		BlockIndex block;
+		if ( not data.footer.find( channel, idx, block ) ) {
+			throw std::logic_error( vm::fmt( "block {} not found in archive", idx ) );
+		}
+		return Entry( idx, block );
+	}
+
+public:
+	/* statistics are stored for the block resolve( idx ) covers idx with */
+	bool block_stats( uint32_t channel, Idx const &idx, BlockStats &stats ) const
+	{
+		if ( not data.footer.has_stats() ) {
+			return false;
+		}
+		return data.footer.find_stats( channel, resolve( channel, idx ).first, stats );
+	}
+
+	vector<Idx> blocks_in_range( uint32_t channel, uint32_t lo, uint32_t hi ) const
+	{
+		check_channel( channel );
+		if ( not data.footer.has_stats() ) {
+			throw std::logic_error( "archive has no block statistics" );
+		}
+		vector<Idx> blocks;
+		Entry entry;
+		BlockStats stats;
+		const auto dim = data.header.dim;
+		for ( uint32_t z = 0; z != dim.z; ++z ) {
+			for ( uint32_t y = 0; y != dim.y; ++y ) {
+				for ( uint32_t x = 0; x != dim.x; ++x ) {
+					const auto idx = Idx{}.set_x( x ).set_y( y ).set_z( z );
+					/* grid positions outside the slice range of a partial archive are skipped */
+					if ( try_resolve( channel, idx, entry ) &&
+						 data.footer.find_stats( channel, entry.first, stats ) &&
+						 stats.min <= hi && stats.max >= lo ) {
+						blocks.emplace_back( idx );
+					}
+				}
+			}
+		}
+		return blocks;
+	}
+
+	RegionPlan plan_region( uint32_t channel, Idx const &start, Idx const &size ) const
+	{
+		check_channel( channel );
+		auto &raw = data.header.raw;
+		if ( not size.total() ||
+			 uint64_t( start.x ) + size.x > raw.x ||
+			 uint64_t( start.y ) + size.y > raw.y ||
+			 uint64_t( start.z ) + size.z > raw.z ) {
+			throw std::logic_error( vm::fmt( "region {} + {} out of raw {}", start, size, raw ) );
+		}
+		RegionPlan plan;
+		plan.start = start;
+		plan.size = size;
+		plan.channel = channel;
+
+		/* blocks sharing a node are decoded one after another */
+		const auto inner = data.header.block_inner;
+		vector<pair<Entry, Idx>> covering;
+		for ( auto z = start.z / inner; z <= ( start.z + size.z - 1 ) / inner; ++z ) {
+			for ( auto y = start.y / inner; y <= ( start.y + size.y - 1 ) / inner; ++y ) {
+				for ( auto x = start.x / inner; x <= ( start.x + size.x - 1 ) / inner; ++x ) {
+					const auto idx = Idx{}.set_x( x ).set_y( y ).set_z( z );
+					covering.emplace_back( resolve( channel, idx ), idx );
+				}
+			}
+		}
+		std::sort( covering.begin(), covering.end(), []( auto const &a, auto const &b ) {
+			return a.first.second < b.first.second ||
+				   not( b.first.second < a.first.second ) &&
+					 ( a.first.first < b.first.first || a.first.first == b.first.first && a.second < b.second );
+		} );
+
+		/* frames of level 0 h264 blocks are decoded together by batch_unarchive,
+		   every other node decodes its own */
+		vector<pair<uint32_t, uint32_t>> frames, batched;
+		for ( size_t i = 0; i != covering.size(); ++i ) {
+			auto &entry = covering[ i ].first;
+			auto &block = entry.second;
+			plan.blocks.emplace_back( covering[ i ].second );
+			if ( i && covering[ i - 1 ].first.first == entry.first || block.codec == BlockCodec::Empty ) {
+				continue;
+			}
+			if ( block.codec == BlockCodec::Palette ) {
+				frames.emplace_back( block.first_frame, block.first_frame );
+				plan.decoded_frames += 1;
+				plan.decoded_bytes += block_bytes();
+				continue;
+			}
+			frames.emplace_back( block.first_frame, block.last_frame );
+			const bool refined = refine && block.level == 0 && data.footer.residuals()[ channel ].count( entry.first );
+			if ( block.level == 0 && not refined ) {
+				batched.emplace_back( block.first_frame, block.last_frame );
+				continue;
+			}
+			plan.decoded_frames += block.last_frame - block.first_frame + 1;
+			plan.decoded_bytes += uint64_t( block.last_frame - block.first_frame + 1 ) * data.header.frame_size;
+			if ( refined ) {
+				const auto residual = data.footer.residuals()[ channel ].at( entry.first );
+				frames.emplace_back( residual, residual );
+				plan.decoded_frames += 1;
+				plan.decoded_bytes += block_bytes();
+			}
+		}
+		for ( auto &run : coalesce( batched ) ) {
+			plan.decoded_frames += run.second - run.first + 1;
+			plan.decoded_bytes += uint64_t( run.second - run.first + 1 ) * data.header.frame_size;
+		}
+		auto &frame_offset = data.footer.frame_offset;
+		for ( auto &run : coalesce( frames ) ) {
+			FrameRange range;
+			range.first_frame = run.first;
+			range.last_frame = run.second;
+			range.offset = frame_offset[ run.first ];
+			range.length = frame_offset[ run.second + 1 ] - range.offset;
+			plan.read_bytes += range.length;
+			plan.ranges.emplace_back( range );
+		}
+		return plan;
+	}
+
+	/* reads every range of the plan once and decodes its blocks like
+	   batch_unarchive, with all frames taken from the ranges read */
+	void unarchive_region( RegionPlan const &plan,
+						   std::function<void( Idx const &, unsigned char const * )> const &consumer )
+	{
+		auto &frame_offset = data.footer.frame_offset;
+		uint64_t total = 0;
+		for ( size_t i = 0; i != plan.ranges.size(); ++i ) {
+			auto &range = plan.ranges[ i ];
+			if ( range.first_frame > range.last_frame || range.last_frame >= data.footer.frame_count() ||
+				 i && range.first_frame <= plan.ranges[ i - 1 ].last_frame ||
+				 range.offset != frame_offset[ range.first_frame ] ||
+				 range.length != frame_offset[ range.last_frame + 1 ] - range.offset ) {
+				throw std::logic_error( "region plan of another archive" );
+			}
+			total += range.length;
+		}
+		region_src.clear();
+		auto src = data.content.mapped();
+		if ( not src ) {
+			region_buffer.resize( total );
+		}
+		uint64_t pos = 0;
+		for ( auto &range : plan.ranges ) {
+			if ( src ) {
+				region_src.emplace_back( src + range.offset );
+				continue;
+			}
+			data.content.seek( range.offset );
+			if ( data.content.read( region_buffer.data() + pos, range.length ) != range.length ) {
+				throw std::runtime_error( vm::fmt( "corrupted frames [{}, {}]", range.first_frame, range.last_frame ) );
+			}
+			region_src.emplace_back( region_buffer.data() + pos );
+			pos += range.length;
+		}
+		region = &plan.ranges;
+		try {
+			batch_unarchive( plan.channel, plan.blocks, consumer );
+		} catch ( ... ) {
+			region = nullptr;
+			throw;
+		}
+		region = nullptr;
+	}
+
+	/* frames [ first, last ] within the ranges read by unarchive_region,
+	   null when no region is being decoded */
+	char const *planned_frames( uint32_t first, uint32_t last ) const
+	{
+		if ( not region ) {
+			return nullptr;
+		}
+		auto it = std::upper_bound( region->begin(), region->end(), first,
+									[]( uint32_t frame, FrameRange const &range ) { return frame < range.first_frame; } );
+		if ( it == region->begin() || last > ( --it )->last_frame ) {
+			throw std::logic_error( vm::fmt( "frames [{}, {}] are not in the region plan", first, last ) );
+		}
+		return region_src[ it - region->begin() ] + data.footer.frame_offset[ first ] - it->offset;
+	}
+
+	/* sorted runs of frames, overlapping or adjacent ones merged */
+	static vector<pair<uint32_t, uint32_t>> coalesce( vector<pair<uint32_t, uint32_t>> &runs )
+	{
+		std::sort( runs.begin(), runs.end() );
+		vector<pair<uint32_t, uint32_t>> merged;
+		for ( auto &run : runs ) {
+			if ( not merged.empty() && run.first <= uint64_t( merged.back().second ) + 1 ) {
+				merged.back().second = std::max( merged.back().second, run.second );
+			} else {
+				merged.emplace_back( run );
+			}
+		}
+		return merged;
+	}
+
+	void check_channel( uint32_t channel ) const
+	{
+		if ( channel >= data.footer.channels() ) {
+			throw std::logic_error( vm::fmt( "channel {} out of {} channel(s)", channel, data.footer.channels() ) );
+		}
+	}
+
+	void batch_unarchive( uint32_t channel, vector<Idx> const &blocks,
+						  std::function<void( Idx const &, unsigned char const * )> const &consumer )
+	{
+		const auto nbytes = block_bytes();
+		batch_buffer.resize( nbytes );
+		/* h264 blocks are shared by frames, everything else decodes alone */
+		vector<Idx> batched;
+		for ( auto &idx : blocks ) {
+			const auto entry = resolve( channel, idx );
+			if ( entry.first == idx && entry.second.codec == BlockCodec::H264 && entry.second.level == 0 &&
+				 not( refine && data.footer.residuals()[ channel ].count( idx ) ) ) {
+				batched.emplace_back( idx );
+			} else {
+				unarchive_to( channel, idx, batch_buffer );
+				consumer( idx, batch_buffer.data() );
+			}
+		}
+		if ( batched.empty() ) {
+			return;
+		}
+		unarchive_to( channel, batched, [&]( Idx const &idx, VoxelStreamPacket const &pkt ) {
+			pkt.append_to( batch_buffer );
+			if ( pkt.offset + pkt.length == nbytes ) {
+				consumer( idx, batch_buffer.data() );
+			}
+		} );
+	}
+
+	/* decodes every channel of idx and interleaves them voxel by voxel */
+	std::size_t unarchive_interleaved_to( Idx const &idx, cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		const auto channels = data.footer.channels();
+		const auto nbytes = block_bytes();
+		const auto voxel_size = data.header.voxel_size();
+		if ( dst.size() < nbytes * channels ) {
+			throw std::logic_error(
+			  vm::fmt( "insufficient buffer size: {} < {}", dst.size(), nbytes * channels ) );
+		}
+		if ( channels == 1 ) {
+			return unarchive_to( 0, idx, dst );
+		}
+		channel_buffer.resize( nbytes );
+		interleaved_buffer.resize( nbytes * channels );
+		for ( uint32_t c = 0; c != channels; ++c ) {
+			unarchive_to( c, idx, channel_buffer );
+			auto src = channel_buffer.data();
+			auto p = interleaved_buffer.data() + c * voxel_size;
+			for ( std::size_t i = 0; i != nbytes; i += voxel_size, p += voxel_size * channels ) {
+				memcpy( p, src + i, voxel_size );
+			}
+		}
+		return copy_to( dst, interleaved_buffer.data(), interleaved_buffer.size() );
+	}
+
 public:
-	LinkedReader sort_and_get_reader( vector<Idx> &blocks, vector<int64_t> &linked_block_offsets )
+	LinkedReader sort_and_get_reader( uint32_t channel, vector<Idx> &blocks, vector<int64_t> &linked_block_offsets )
 	{
-		vector<map<Idx, BlockIndex>::const_iterator> sorted_blocks( blocks.size() );
+		vector<Entry> sorted_blocks( blocks.size() );
 		std::transform( blocks.begin(), blocks.end(), sorted_blocks.begin(),
-						[this]( Idx const &idx ) { return data.block_idx.find( idx ); } );
+						[&]( Idx const &idx ) {
+							auto entry = find_block( channel, idx );
+							if ( entry.second.codec != BlockCodec::H264 ) {
+								throw std::logic_error( vm::fmt( "block {} is not h264 encoded", idx ) );
+							}
+							return entry;
+						} );
 		std::sort( sorted_blocks.begin(), sorted_blocks.end(),
-				   [this]( auto const &x, auto const &y ) { return x->second < y->second; } );
+				   []( auto const &x, auto const &y ) { return x.second < y.second; } );
 		std::transform( sorted_blocks.begin(), sorted_blocks.end(), blocks.begin(),
-						[this]( map<Idx, BlockIndex>::const_iterator it ) { return it->first; } );
+						[]( Entry const &entry ) { return entry.first; } );
 
 		vector<vm::Arc<Reader>> readers;
 		int frame_count = 0, prev = 0;
 		for ( int i = 0; i < sorted_blocks.size(); ++i ) {
-			auto &prev_block = sorted_blocks[ prev ]->second;
-			auto &curr_block = sorted_blocks[ i ]->second;
+			auto &prev_block = sorted_blocks[ prev ].second;
+			auto &curr_block = sorted_blocks[ i ].second;
 
 			auto dframes = curr_block.first_frame - prev_block.first_frame;
-			linked_block_offsets.emplace_back( ( frame_count + dframes ) * data.header.frame_size + curr_block.offset );
+			linked_block_offsets.emplace_back( int64_t( frame_count + dframes ) * data.header.frame_size + curr_block.offset );
 
 			if ( i == sorted_blocks.size() - 1 ||
-				 sorted_blocks[ i + 1 ]->second.first_frame > curr_block.last_frame ) {
-				auto beg = data.frame_offset[ prev_block.first_frame ];
-				auto len = data.frame_offset[ curr_block.last_frame + 1 ] - beg;
-				// vm::println( "{} -> {} = {}", sorted_blocks[ i ]->first, make_pair( beg, len ), make_pair( prev_block.first_frame, curr_block.last_frame + 1 ) );
-				readers.emplace_back( vm::Arc<Reader>( new PartReader( data.content, beg, len ) ) );
+				 sorted_blocks[ i + 1 ].second.first_frame > curr_block.last_frame ) {
+				verify_frames( prev_block.first_frame, curr_block.last_frame );
+				auto beg = data.footer.frame_offset[ prev_block.first_frame ];
+				auto len = data.footer.frame_offset[ curr_block.last_frame + 1 ] - beg;
+				// vm::println( "{} -> {} = {}", sorted_blocks[ i ].first, make_pair( beg, len ), make_pair( prev_block.first_frame, curr_block.last_frame + 1 ) );
+				if ( auto src = planned_frames( prev_block.first_frame, curr_block.last_frame ) ) {
+					readers.emplace_back( vm::Arc<Reader>( new SliceReader( src, len ) ) );
+				} else {
+					readers.emplace_back( vm::Arc<Reader>( new PartReader( data.content, beg, len ) ) );
+				}
 				frame_count += curr_block.last_frame - prev_block.first_frame + 1;
 				prev = i + 1;
 			}
@@ -127,15 +582,91 @@ public:
 		return linked_reader;
 	}
 
+public:
+	/* every frame is checked once, before the first decode that reads it */
+	void verify_frames( uint32_t first, uint32_t last )
+	{
+		if ( not verify_checksums ) return;
+		for ( auto frame = first; frame <= last; ++frame ) {
+			if ( verified[ frame ] ) continue;
+			const auto beg = data.footer.frame_offset[ frame ];
+			const auto len = data.footer.frame_offset[ frame + 1 ] - beg;
+			if ( auto src = planned_frames( frame, frame ) ) {
+				verify_frame( frame, src, len );
+				continue;
+			}
+			if ( auto src = data.content.mapped() ) {
+				verify_frame( frame, src + beg, len );
+				continue;
+			}
+			crc_buffer.resize( len );
+			data.content.seek( beg );
+			if ( data.content.read( crc_buffer.data(), len ) != len ) {
+				throw std::runtime_error( vm::fmt( "corrupted frame {}", frame ) );
+			}
+			verify_frame( frame, crc_buffer.data(), len );
+		}
+	}
+
+	void verify_frame( uint32_t frame, void const *src, std::size_t len )
+	{
+		if ( not verify_checksums || verified[ frame ] ) return;
+		if ( crc32c( src, len ) != data.footer.checksums()[ frame ] ) {
+			throw std::runtime_error( vm::fmt( "frame {} fails its checksum", frame ) );
+		}
+		verified[ frame ] = true;
+	}
+
+	/* checks all frames regardless of DecodeOptions::verify_checksums */
+	vector<uint32_t> corrupted_frames()
+	{
+		vector<uint32_t> corrupted;
+		if ( not data.footer.has_checksums() ) {
+			return corrupted;
+		}
+		for ( uint32_t frame = 0; frame != data.footer.frame_count(); ++frame ) {
+			const auto beg = data.footer.frame_offset[ frame ];
+			const auto len = data.footer.frame_offset[ frame + 1 ] - beg;
+			auto src = data.content.mapped();
+			if ( src ) {
+				src += beg;
+			} else {
+				crc_buffer.resize( len );
+				data.content.seek( beg );
+				if ( data.content.read( crc_buffer.data(), len ) != len ) {
+					corrupted.emplace_back( frame );
+					continue;
+				}
+				src = crc_buffer.data();
+			}
+			if ( crc32c( src, len ) != data.footer.checksums()[ frame ] ) {
+				corrupted.emplace_back( frame );
+			}
+		}
+		return corrupted;
+	}
+
 public:
 	UnarchiverData &data;
 	std::unique_ptr<IDecoder> decoder;
+	PaletteDecoder palette_decoder;
+	bool refine;
+	bool verify_checksums;
+	vector<char> verified, crc_buffer;
+	/* the ranges of the plan unarchive_region decodes and their bytes */
+	vector<FrameRange> const *region = nullptr;
+	vector<char const *> region_src;
+	vector<char> region_buffer;
+	Idx node_idx;
+	uint32_t node_channel = 0;
+	vector<unsigned char> node_buffer, fine_buffer, chunk_buffer, residual_buffer;
+	vector<unsigned char> channel_buffer, interleaved_buffer, batch_buffer;
 };
 
 VM_EXPORT
 {
 	Unarchiver::Unarchiver( Reader & reader, DecodeOptions const &opts ) :
-	  data( reader ),
+	  data( reader, true ),
 	  _( new UnarchiverImpl( data, opts ) )
 	{
 	}
@@ -147,7 +678,75 @@ VM_EXPORT
 	std::size_t Unarchiver::unarchive_to( Idx const &idx,
 										  cufx::MemoryView1D<unsigned char> const &dst )
 	{
-		return _->unarchive_to( idx, dst );
+		return _->unarchive_to( 0, idx, dst );
+	}
+
+	std::size_t Unarchiver::unarchive_to( Idx const &idx, uint32_t channel,
+										  cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		return _->unarchive_to( channel, idx, dst );
+	}
+
+	std::size_t Unarchiver::unarchive_interleaved_to( Idx const &idx,
+													  cufx::MemoryView1D<unsigned char> const &dst )
+	{
+		return _->unarchive_interleaved_to( idx, dst );
+	}
+
+	bool Unarchiver::is_empty( Idx const &idx ) const
+	{
+		return _->resolve( 0, idx ).second.codec == BlockCodec::Empty;
+	}
+
+	Idx Unarchiver::resolve( Idx const &idx ) const
+	{
+		return _->resolve( 0, idx ).first;
+	}
+
+	unsigned Unarchiver::block_level( Idx const &idx ) const
+	{
+		return _->resolve( 0, idx ).second.level;
+	}
+
+	bool Unarchiver::block_stats( Idx const &idx, BlockStats &stats, uint32_t channel ) const
+	{
+		return _->block_stats( channel, idx, stats );
+	}
+
+	vector<Idx> Unarchiver::blocks_in_range( uint32_t lo, uint32_t hi, uint32_t channel ) const
+	{
+		return _->blocks_in_range( channel, lo, hi );
+	}
+
+	bool Unarchiver::preview( vector<unsigned char> &dst, uint32_t channel ) const
+	{
+		if ( not data.footer.has_preview() ) {
+			return false;
+		}
+		dst.resize( data.footer.preview_channel_bytes() );
+		return data.footer.read_preview( channel, reinterpret_cast<char *>( dst.data() ) );
+	}
+
+	void Unarchiver::batch_unarchive( vector<Idx> const &blocks, uint32_t channel,
+									  std::function<void( Idx const &, unsigned char const * )> const &consumer )
+	{
+		_->batch_unarchive( channel, blocks, consumer );
+	}
+
+	RegionPlan Unarchiver::plan_region( Idx const &start, Idx const &size, uint32_t channel ) const
+	{
+		return _->plan_region( channel, start, size );
+	}
+
+	void Unarchiver::unarchive_region( RegionPlan const &plan,
+									   std::function<void( Idx const &, unsigned char const * )> const &consumer )
+	{
+		_->unarchive_region( plan, consumer );
+	}
+
+	std::vector<uint32_t> Unarchiver::corrupted_frames()
+	{
+		return _->corrupted_frames();
 	}
 
 	// void Unarchiver::batch_unarchive( vector<Idx> const &blocks,
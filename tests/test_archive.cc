@@ -1,4 +1,8 @@
+#include <set>
 #include <fstream>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
 #include <gtest/gtest.h>
 #define private public
 #define protected public
@@ -6,13 +10,27 @@
 #include <VMat/numeric.h>
 #include <VMFoundation/rawreader.h>
 #include <varch/archive/archiver.hpp>
+#include <varch/archive/merger.hpp>
+#include <varch/archive/updater.hpp>
+#include <varch/archive/compactor.hpp>
+#include <varch/archive/transcoder.hpp>
 #include <varch/unarchive/unarchiver.hpp>
+#include <varch/utils/unbounded_vector_writer.hpp>
+#include <varch/utils/mapped_reader.hpp>
+#include <varch/utils/direct_reader.hpp>
+#include <varch/utils/sharded_reader.hpp>
+#include <archive/preview.hpp>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 using namespace vm;
 using namespace std;
 using namespace vol;
+using namespace __inner__;
 
-void compress_256( string const &raw_input_file, string const &h264_output_file )
+ArchiverOptions archive_opts_256( string const &raw_input_file, string const &h264_output_file )
 {
 	auto opts = vol::ArchiverOptions{}
 				  .set_x( 256 )
@@ -28,13 +46,16 @@ void compress_256( string const &raw_input_file, string const &h264_output_file
 	  .set_width( 1024 )
 	  .set_height( 1024 )
 	  .set_batch_frames( 4 );
-	{
-		Archiver archiver( opts );
-		archiver.convert();
-	}
+	return opts;
 }
 
-bool compare_block( Unarchiver &unarchiver, string const &raw_input_file, Idx const &idx )
+void compress_256( string const &raw_input_file, string const &h264_output_file )
+{
+	Archiver archiver( archive_opts_256( raw_input_file, h264_output_file ) );
+	archiver.convert();
+}
+
+bool compare_block( Unarchiver &unarchiver, string const &raw_input_file, Idx const &idx, uint32_t channel = 0 )
 {
 	const auto N = unarchiver.block_size();
 	const auto N_3 = N * N * N;
@@ -45,7 +66,7 @@ bool compare_block( Unarchiver &unarchiver, string const &raw_input_file, Idx co
 	RawReaderIO raw_input( raw_input_file, Size3( raw.x, raw.y, raw.z ), sizeof( char ) );
 	vector<unsigned char> src_buffer( N_3 );
 
-	unarchiver.unarchive_to( idx, buffer );
+	unarchiver.unarchive_to( idx, channel, buffer );
 
 	auto begin = Vec3i( idx.x, idx.y, idx.z ) * N;
 	raw_input.readRegion( begin, Size3( N, N, N ), src_buffer.data() );
@@ -123,3 +144,1356 @@ TEST( test_archive, urandom )
 	compress_256( raw_input_file, h264_output_file );
 	decode_256( raw_input_file, h264_output_file );
 }
+
+TEST( test_archive, io_threads )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.h264";
+	auto threaded_output_file = "./test.aneurism_256x256x256_uint8.threaded.h264";
+	compress_256( raw_input_file, h264_output_file );
+	{
+		Archiver archiver( archive_opts_256( raw_input_file, threaded_output_file ).set_io_threads( 3 ) );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	decode_256( raw_input_file, threaded_output_file );
+
+	auto read_file = []( string const &path ) {
+		ifstream is( path, ios::binary );
+		return vector<char>( istreambuf_iterator<char>( is ), istreambuf_iterator<char>() );
+	};
+	EXPECT_EQ( read_file( h264_output_file ), read_file( threaded_output_file ) );
+}
+
+TEST( test_archive, mapped_index )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.mapped.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	MappedReader reader( h264_output_file );
+	Unarchiver unarchiver( reader );
+	auto &footer = unarchiver.data.footer;
+	/* blocks are looked up in the mapped block table, never loaded */
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				ASSERT_TRUE( compare_block( unarchiver, raw_input_file, Idx{ i, j, k } ) );
+			}
+		}
+	}
+	EXPECT_NE( footer.table.content, nullptr );
+
+	BlockIndex entry;
+	EXPECT_FALSE( footer.find( 0, Idx{ 4, 0, 0 }, entry ) );
+	ASSERT_TRUE( footer.find( 0, Idx{ 3, 2, 1 }, entry ) );
+	EXPECT_EQ( footer.index( 0 ).size(), 64 );
+	EXPECT_EQ( footer.table.content, nullptr );
+	EXPECT_EQ( footer.index( 0 ).at( Idx{ 3, 2, 1 } ), entry );
+}
+
+TEST( test_archive, compact_footer )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.compact.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	MappedReader reader( h264_output_file );
+	Unarchiver unarchiver( reader );
+	ASSERT_TRUE( compare_block( unarchiver, raw_input_file, Idx{ 1, 3, 2 } ) );
+	/* blocks archived in order take a tag and a zero delta */
+	auto &table = unarchiver.data.footer.table;
+	ASSERT_TRUE( table.compact );
+	EXPECT_LE( table.chunk_end.back(), 2 * 64 + 8 );
+
+	auto header = unarchiver.data.header;
+	header.set_dim( Idx{ 64, 32, 2 } );
+	Footer footer;
+	footer.frame_offset = { 0, 10, 300, 70000, 70001, 1ull << 40 };
+	footer.channel_idx.resize( 1 );
+	const auto block_bytes = uint32_t( header.block_size * header.block_size * header.block_size );
+	auto &index = footer.block_idx;
+	index[ ( Idx{ 0, 0, 0 } ) ] = BlockIndex{}.set_first_frame( 0 ).set_last_frame( 0 );
+	index[ ( Idx{ 1, 0, 0 } ) ] = BlockIndex{}.set_first_frame( 0 ).set_last_frame( 0 ).set_offset( block_bytes );
+	index[ ( Idx{ 2, 0, 0 } ) ] = BlockIndex{}.set_first_frame( 3 ).set_last_frame( 9 ).set_offset( 7 );
+	index[ ( Idx{ 3, 0, 0 } ) ] = BlockIndex{}.set_first_frame( 4 ).set_last_frame( 4 ).set_codec( BlockCodec::Palette );
+	index[ ( Idx{ 0, 1, 0 } ) ] = BlockIndex{}.set_first_frame( 2 ).set_last_frame( 3 ).set_codec( BlockCodec::Palette );
+	index[ ( Idx{ 1, 1, 0 } ) ] = BlockIndex{}.set_codec( BlockCodec::Empty );
+	index[ ( Idx{ 2, 1, 0 } ) ] = BlockIndex{}.set_codec( BlockCodec::Empty ).set_level( 1 );
+	index[ ( Idx{ 63, 31, 1 } ) ] = BlockIndex{}.set_first_frame( 1 ).set_last_frame( 2 ).set_offset( 100 );
+	footer.channel_idx[ 0 ][ ( Idx{ 5, 20, 1 } ) ] = BlockIndex{}.set_first_frame( 3 ).set_last_frame( 3 ).set_codec( BlockCodec::Palette );
+
+	vector<char> body;
+	{
+		UnboundedVectorWriter writer( body );
+		footer.write_to( writer, header );
+	}
+	SliceReader content( body.data(), body.size() );
+	Footer decoded;
+	decoded.read_from( content, archive_version, true );
+	EXPECT_EQ( decoded.frame_offset, footer.frame_offset );
+	EXPECT_EQ( decoded.table.chunk_end.size(), 8 );
+	BlockIndex entry;
+	EXPECT_FALSE( decoded.find( 0, Idx{ 4, 0, 0 }, entry ) );
+	ASSERT_TRUE( decoded.find( 1, Idx{ 5, 20, 1 }, entry ) );
+	EXPECT_EQ( entry, footer.channel_idx[ 0 ].at( Idx{ 5, 20, 1 } ) );
+	ASSERT_TRUE( decoded.find( 0, Idx{ 2, 0, 0 }, entry ) );
+	EXPECT_EQ( entry, index.at( Idx{ 2, 0, 0 } ) );
+	EXPECT_EQ( decoded.index( 0 ), footer.block_idx );
+	EXPECT_EQ( decoded.index( 1 ), footer.channel_idx[ 0 ] );
+
+	/* a chunk ending in the middle of a varint */
+	Footer truncated;
+	truncated.read_from( content, archive_version, true );
+	body[ truncated.table.offset + truncated.table.chunk_end[ 0 ] - 1 ] |= 0x80;
+	EXPECT_THROW( truncated.find( 0, Idx{ 0, 0, 0 }, entry ), runtime_error );
+}
+
+TEST( test_archive, frame_alignment )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.aligned.h264";
+	{
+		/* the verifier decodes the frames with their filler */
+		Archiver archiver( archive_opts_256( raw_input_file, h264_output_file )
+							 .set_frame_alignment( 4096 )
+							 .set_max_error( 255 ) );
+		archiver.convert();
+	}
+
+	DirectReader reader( h264_output_file );
+	Unarchiver unarchiver( reader, DecodeOptions{}.set_verify_checksums( true ) );
+	auto &footer = unarchiver.data.footer;
+	ASSERT_GT( footer.frame_count(), 1 );
+	for ( uint32_t f = 1; f != footer.frame_count(); ++f ) {
+		EXPECT_EQ( ( sizeof( unarchiver.data.header ) + footer.frame_offset[ f ] ) % 4096, 0 );
+	}
+	EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				ASSERT_TRUE( compare_block( unarchiver, raw_input_file, Idx{ i, j, k } ) );
+			}
+		}
+	}
+
+	/* batches read runs of frames through linked readers whose last
+	   frame ends in filler */
+	MappedReader mapped( h264_output_file );
+	Unarchiver batched( mapped );
+	vector<Idx> blocks;
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				blocks.emplace_back( Idx{ i, j, k } );
+			}
+		}
+	}
+	const auto nbytes = 64 * 64 * 64;
+	map<Idx, vector<unsigned char>> decoded;
+	batched.batch_unarchive( blocks, 0, [&]( Idx const &idx, unsigned char const *src ) {
+		EXPECT_TRUE( decoded.emplace( idx, vector<unsigned char>( src, src + nbytes ) ).second );
+	} );
+	ASSERT_EQ( decoded.size(), blocks.size() );
+	vector<unsigned char> block( nbytes );
+	for ( auto &e : decoded ) {
+		batched.unarchive_to( e.first, block );
+		EXPECT_EQ( e.second, block );
+	}
+	decode_256( raw_input_file, h264_output_file );
+}
+
+TEST( test_archive, aligned_merge )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto merged_file = "./test.aneurism_256x256x256_uint8.aligned_merged.h264";
+	auto compacted_file = "./test.aneurism_256x256x256_uint8.aligned_compacted.h264";
+	vector<string> parts;
+	for ( int i = 0; i != 2; ++i ) {
+		parts.emplace_back( vm::fmt( "./test.aneurism_256x256x256_uint8.aligned_part{}.h264", i ) );
+		Archiver archiver( archive_opts_256( raw_input_file, parts.back() )
+							 .set_frame_alignment( 4096 )
+							 .set_max_error( 255 )
+							 .set_slice_begin( 2 * i )
+							 .set_slice_end( 2 * i + 2 ) );
+		ASSERT_TRUE( archiver.convert() );
+	}
+
+	/* frames start aligned or, if first of a copied run, where the first
+	   frame of an archive starts, returns how many do not start aligned */
+	auto expect_aligned = []( string const &file ) {
+		MappedReader reader( file );
+		Unarchiver unarchiver( reader, DecodeOptions{}.set_verify_checksums( true ) );
+		auto &footer = unarchiver.data.footer;
+		EXPECT_EQ( unarchiver.data.header.frame_alignment(), 4096 );
+		EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+		size_t unaligned = 0;
+		for ( uint32_t f = 0; f != footer.frame_count(); ++f ) {
+			const auto pos = ( sizeof( Header ) + footer.frame_offset[ f ] ) % 4096;
+			EXPECT_TRUE( pos == 0 || pos == sizeof( Header ) ) << file << ": frame " << f;
+			unaligned += pos != 0;
+		}
+		vector<Idx> blocks;
+		for ( uint32_t i = 0; i != 4; ++i ) {
+			for ( uint32_t j = 0; j != 4; ++j ) {
+				for ( uint32_t k = 0; k != 4; ++k ) {
+					blocks.emplace_back( Idx{ i, j, k } );
+				}
+			}
+		}
+		size_t decoded = 0;
+		unarchiver.batch_unarchive( blocks, 0, [&]( Idx const &, unsigned char const * ) { ++decoded; } );
+		EXPECT_EQ( decoded, blocks.size() );
+		return unaligned;
+	};
+
+	ASSERT_TRUE( Merger( MergerOptions{}.set_inputs( parts ).set_output( merged_file ) ).merge() );
+	EXPECT_EQ( expect_aligned( merged_file ), parts.size() );
+	decode_256( raw_input_file, merged_file );
+
+	/* the appended frames follow the old footer padded */
+	vector<unsigned char> region( 8 * 8 * 8, 0 );
+	ASSERT_TRUE( Updater( UpdaterOptions{}
+							.set_archive( merged_file )
+							.set_archive_opts( archive_opts_256( "", "" ).set_max_error( 255 ) ) )
+				   .update( Idx{ 10, 10, 10 }, Idx{ 8, 8, 8 }, region.data() ) );
+	EXPECT_EQ( expect_aligned( merged_file ), parts.size() + 1 );
+
+	ASSERT_TRUE( Compactor( CompactorOptions{}.set_input( merged_file ).set_output( compacted_file ) ).compact() );
+	EXPECT_LE( expect_aligned( compacted_file ), parts.size() + 1 );
+}
+
+TEST( test_archive, plan_region )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.region.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	MappedReader reader( h264_output_file );
+	Unarchiver unarchiver( reader );
+	EXPECT_THROW( unarchiver.plan_region( { 200, 0, 0 }, { 57, 1, 1 } ), logic_error );
+	EXPECT_THROW( unarchiver.plan_region( { 0, 0, 0 }, { 0, 1, 1 } ), logic_error );
+
+	/* inner voxels [ 60, 70 ) x [ 0, 200 ) x [ 63, 129 ) */
+	const auto plan = unarchiver.plan_region( { 60, 0, 63 }, { 10, 200, 66 } );
+	set<Idx> expected;
+	for ( uint32_t z = 0; z != 3; ++z ) {
+		for ( uint32_t y = 0; y != 4; ++y ) {
+			for ( uint32_t x = 0; x != 2; ++x ) {
+				expected.insert( Idx{ x, y, z } );
+			}
+		}
+	}
+	EXPECT_EQ( set<Idx>( plan.blocks.begin(), plan.blocks.end() ), expected );
+	ASSERT_EQ( plan.blocks.size(), expected.size() );
+
+	uint64_t read_bytes = 0, frames = 0;
+	for ( size_t i = 0; i != plan.ranges.size(); ++i ) {
+		auto &range = plan.ranges[ i ];
+		ASSERT_LE( range.first_frame, range.last_frame );
+		if ( i ) {
+			EXPECT_GT( range.first_frame, plan.ranges[ i - 1 ].last_frame + 1 );
+			EXPECT_GT( range.offset, plan.ranges[ i - 1 ].offset + plan.ranges[ i - 1 ].length );
+		}
+		read_bytes += range.length;
+		frames += range.last_frame - range.first_frame + 1;
+	}
+	EXPECT_EQ( plan.read_bytes, read_bytes );
+	EXPECT_LT( plan.read_bytes, reader.size() );
+	EXPECT_EQ( plan.decoded_frames, frames );
+	EXPECT_EQ( plan.decoded_bytes, frames * unarchiver.frame_size() );
+
+	/* the plan decodes to what blocks decode to one by one */
+	const auto nbytes = 64 * 64 * 64;
+	map<Idx, vector<unsigned char>> decoded;
+	unarchiver.unarchive_region( plan, [&]( Idx const &idx, unsigned char const *src ) {
+		EXPECT_TRUE( decoded.emplace( idx, vector<unsigned char>( src, src + nbytes ) ).second );
+	} );
+	ASSERT_EQ( decoded.size(), expected.size() );
+	vector<unsigned char> block( nbytes );
+	for ( auto &e : decoded ) {
+		EXPECT_TRUE( expected.count( e.first ) );
+		unarchiver.unarchive_to( e.first, block );
+		EXPECT_EQ( e.second, block );
+	}
+
+	/* the ranges are read into memory from readers that are not mapped */
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	StreamReader stream( is, 0, is.tellg() );
+	Unarchiver streamed( stream );
+	size_t matched = 0;
+	streamed.unarchive_region( plan, [&]( Idx const &idx, unsigned char const *src ) {
+		matched += equal( src, src + nbytes, decoded.at( idx ).begin() );
+	} );
+	EXPECT_EQ( matched, decoded.size() );
+
+	/* every frame is read from the plan, which must be one of the archive */
+	auto partial = plan;
+	partial.ranges.pop_back();
+	EXPECT_THROW( unarchiver.unarchive_region( partial, []( Idx const &, unsigned char const * ) {} ), logic_error );
+	auto shifted = plan;
+	shifted.ranges.front().offset += 1;
+	EXPECT_THROW( unarchiver.unarchive_region( shifted, []( Idx const &, unsigned char const * ) {} ), logic_error );
+}
+
+/* every preview voxel is the raw voxel at the center of its footprint */
+void expect_preview( Unarchiver &unarchiver, string const &raw_input_file )
+{
+	ifstream is( raw_input_file, ios::binary );
+	const vector<unsigned char> raw( ( istreambuf_iterator<char>( is ) ), istreambuf_iterator<char>() );
+	ASSERT_EQ( raw.size(), 256 * 256 * 256 );
+	ASSERT_TRUE( unarchiver.has_preview() );
+	ASSERT_EQ( unarchiver.preview_dim(), ( Idx{ 128, 128, 128 } ) );
+	ASSERT_EQ( unarchiver.preview_scale(), 2 );
+	vector<unsigned char> preview;
+	ASSERT_TRUE( unarchiver.preview( preview ) );
+	ASSERT_EQ( preview.size(), 128 * 128 * 128 );
+	size_t mismatches = 0;
+	for ( size_t z = 0; z != 128; ++z ) {
+		for ( size_t y = 0; y != 128; ++y ) {
+			for ( size_t x = 0; x != 128; ++x ) {
+				const auto expected = raw[ ( ( 2 * z + 1 ) * 256 + 2 * y + 1 ) * 256 + 2 * x + 1 ];
+				mismatches += preview[ ( z * 128 + y ) * 128 + x ] != expected;
+			}
+		}
+	}
+	EXPECT_EQ( mismatches, 0 );
+}
+
+TEST( test_archive, preview )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.preview.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	MappedReader reader( h264_output_file );
+	Unarchiver unarchiver( reader );
+	expect_preview( unarchiver, raw_input_file );
+	/* read in place, the index is still not loaded */
+	EXPECT_NE( unarchiver.data.footer.table.content, nullptr );
+	vector<unsigned char> preview;
+	EXPECT_FALSE( unarchiver.preview( preview, 1 ) );
+
+	/* bricks that are not in memory are sampled where they are */
+	auto sparse_output_file = "./test.aneurism_256x256x256_uint8.preview_sparse.h264";
+	{
+		ifstream is( raw_input_file, ios::binary );
+		const vector<char> raw( ( istreambuf_iterator<char>( is ) ), istreambuf_iterator<char>() );
+		vector<unique_ptr<istringstream>> streams;
+		Archiver archiver( archive_opts_256( "", sparse_output_file ).set_block_stats( false ) );
+		uint32_t n = 0;
+		ASSERT_TRUE( archiver.convert_sparse(
+		  [&]( Idx &idx, vm::Arc<Reader> &brick ) {
+			  if ( n == 64 ) return false;
+			  idx = Idx{ n % 4, n / 4 % 4, n / 16 };
+			  string data( 64 * 64 * 64, '\0' );
+			  for ( uint32_t z = 0; z != 64; ++z ) {
+				  for ( uint32_t y = 0; y != 64; ++y ) {
+					  memcpy( &data[ ( z * 64 + y ) * 64 ],
+							  raw.data() + ( ( idx.z * 64 + z ) * 256 + idx.y * 64 + y ) * 256 + idx.x * 64, 64 );
+				  }
+			  }
+			  streams.emplace_back( new istringstream( std::move( data ) ) );
+			  brick.reset( new StreamReader( *streams.back(), 0, 64 * 64 * 64 ) );
+			  return ++n, true;
+		  } ) );
+	}
+	MappedReader sparse_reader( sparse_output_file );
+	Unarchiver sparse( sparse_reader );
+	expect_preview( sparse, raw_input_file );
+	ASSERT_TRUE( compare_block( sparse, raw_input_file, Idx{ 2, 1, 3 } ) );
+
+	/* a preview no smaller than raw would be a copy of it */
+	EXPECT_EQ( PreviewSampler::scale_for( Idx{ 128, 100, 64 }, 128 ), 0 );
+	EXPECT_EQ( PreviewSampler::scale_for( Idx{ 129, 100, 64 }, 128 ), 2 );
+	EXPECT_EQ( Footer{}.preview_dim, Idx{} );
+}
+
+TEST( test_archive, codec_identity )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.codec.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	MappedReader reader( h264_output_file );
+	Unarchiver unarchiver( reader, DecodeOptions{}.set_device( ComputeDevice::Default ) );
+	EXPECT_EQ( unarchiver.codec(), FrameCodec::H264 );
+	EXPECT_EQ( unarchiver.packing(), FramePacking::Nv12 );
+	EXPECT_EQ( unarchiver.frame_width(), 1024 );
+	EXPECT_EQ( unarchiver.frame_height(), 1024 );
+	EXPECT_EQ( unarchiver.frame_size(), 1024 * 1024 * 3 / 2 );
+	ASSERT_TRUE( compare_block( unarchiver, raw_input_file, Idx{ 2, 1, 3 } ) );
+
+	/* the codec of older label archives follows from their encode method */
+	auto legacy = unarchiver.data.header;
+	legacy.set_version( 8 ).set_encode_method( EncodeMethod::Label32 ).set_codec( FrameCodec::H264 );
+	legacy.upgrade();
+	EXPECT_EQ( legacy.codec, FrameCodec::Palette );
+	EXPECT_EQ( legacy.packing, FramePacking::Block );
+}
+
+TEST( test_archive, checksums )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.crc.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	vector<char> archive( is.tellg() );
+	is.seekg( 0 );
+	is.read( archive.data(), archive.size() );
+
+	SliceReader reader( archive.data(), archive.size() );
+	Unarchiver unarchiver( reader, DecodeOptions{}.set_verify_checksums( true ) );
+	ASSERT_TRUE( unarchiver.has_checksums() );
+	EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+	ASSERT_TRUE( compare_block( unarchiver, raw_input_file, Idx{ 1, 2, 3 } ) );
+
+	/* flips a byte inside the frames of a block that is not decoded yet */
+	auto &footer = unarchiver.data.footer;
+	const auto block = footer.index( 0 ).at( Idx{ 3, 2, 1 } );
+	const auto frame = block.last_frame;
+	archive[ sizeof( unarchiver.data.header ) + footer.frame_offset[ frame ] + 16 ] ^= 0x5a;
+	EXPECT_EQ( unarchiver.corrupted_frames(), vector<uint32_t>{ frame } );
+
+	vector<unsigned char> buffer( 64 * 64 * 64 );
+	EXPECT_THROW( unarchiver.unarchive_to( Idx{ 3, 2, 1 }, buffer ), runtime_error );
+}
+
+/* a reader that records the byte ranges read through it */
+struct RecordingReader : SliceReader
+{
+	using SliceReader::SliceReader;
+
+	size_t read( char *dst, size_t dlen ) override
+	{
+		const auto pos = tell();
+		const auto nread = SliceReader::read( dst, dlen );
+		reads.emplace_back( pos, pos + nread );
+		return nread;
+	}
+	char const *mapped() const override { return nullptr; }
+
+	bool has_read( uint64_t beg, uint64_t end ) const
+	{
+		return std::any_of( reads.begin(), reads.end(), [&]( pair<uint64_t, uint64_t> const &read ) {
+			return read.first < end && beg < read.second;
+		} );
+	}
+
+	vector<pair<uint64_t, uint64_t>> reads;
+};
+
+TEST( test_archive, footer_sections )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.sections.h264";
+	compress_256( raw_input_file, h264_output_file );
+
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	vector<char> archive( is.tellg() );
+	is.seekg( 0 );
+	is.read( archive.data(), archive.size() );
+
+	vector<unsigned char> expected( 64 * 64 * 64 ), buffer( expected.size() );
+	{
+		SliceReader reader( archive.data(), archive.size() );
+		Unarchiver unarchiver( reader );
+		/* checksums are parsed on first use, without moving the reader
+		   that frames may be read from by then */
+		auto &footer = unarchiver.data.footer;
+		ASSERT_TRUE( unarchiver.has_checksums() );
+		EXPECT_TRUE( footer.frame_crc.empty() );
+		reader.seek( 100 );
+		footer.checksums();
+		EXPECT_EQ( reader.tell(), 100 );
+		EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+		EXPECT_EQ( footer.frame_crc.size(), footer.frame_count() );
+		unarchiver.unarchive_to( Idx{ 2, 1, 3 }, expected );
+	}
+	{
+		/* opening reads none of the checksum bytes */
+		uint64_t meta_offset;
+		uint32_t nsections;
+		memcpy( &meta_offset, archive.data() + archive.size() - sizeof( meta_offset ), sizeof( meta_offset ) );
+		memcpy( &nsections, archive.data() + archive.size() - sizeof( meta_offset ) - sizeof( nsections ), sizeof( nsections ) );
+		auto directory = reinterpret_cast<Section const *>( archive.data() + archive.size() - sizeof( meta_offset ) -
+															sizeof( nsections ) - nsections * sizeof( Section ) );
+		auto checksums = std::find_if( directory, directory + nsections,
+									   []( Section const &section ) { return section.tag == SectionTag::Checksums; } );
+		ASSERT_NE( checksums, directory + nsections );
+		const auto beg = sizeof( Header ) + meta_offset + checksums->offset;
+		const auto end = beg + checksums->length;
+
+		RecordingReader reader( archive.data(), archive.size() );
+		Unarchiver unarchiver( reader );
+		EXPECT_FALSE( reader.has_read( beg, end ) );
+		EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+		EXPECT_TRUE( reader.has_read( beg, end ) );
+	}
+
+	/* appends a section of a future version to the directory */
+	auto with_section = [&]( uint32_t flags ) {
+		uint64_t meta_offset;
+		uint32_t nsections;
+		memcpy( &meta_offset, archive.data() + archive.size() - sizeof( meta_offset ), sizeof( meta_offset ) );
+		memcpy( &nsections, archive.data() + archive.size() - sizeof( meta_offset ) - sizeof( nsections ), sizeof( nsections ) );
+		const auto directory = archive.size() - sizeof( meta_offset ) - sizeof( nsections ) - nsections * sizeof( Section );
+		const string payload = "metadata of a future version";
+		Section section;
+		section.tag = SectionTag( 1000 );
+		section.flags = flags;
+		section.offset = directory - sizeof( Header ) - meta_offset;
+		section.length = payload.size();
+		vector<char> extended( archive.begin(), archive.begin() + directory );
+		extended.insert( extended.end(), payload.begin(), payload.end() );
+		extended.insert( extended.end(), archive.begin() + directory, archive.end() - sizeof( meta_offset ) - sizeof( nsections ) );
+		extended.insert( extended.end(), reinterpret_cast<char *>( &section ), reinterpret_cast<char *>( &section + 1 ) );
+		++nsections;
+		extended.insert( extended.end(), reinterpret_cast<char *>( &nsections ), reinterpret_cast<char *>( &nsections + 1 ) );
+		extended.insert( extended.end(), reinterpret_cast<char *>( &meta_offset ), reinterpret_cast<char *>( &meta_offset + 1 ) );
+		return extended;
+	};
+
+	auto optional = with_section( 0 );
+	SliceReader reader( optional.data(), optional.size() );
+	Unarchiver unarchiver( reader, DecodeOptions{}.set_verify_checksums( true ) );
+	unarchiver.unarchive_to( Idx{ 2, 1, 3 }, buffer );
+	EXPECT_EQ( buffer, expected );
+
+	auto required = with_section( required_section );
+	SliceReader required_reader( required.data(), required.size() );
+	EXPECT_THROW( Unarchiver{ required_reader }, runtime_error );
+
+	/* a section is parsed within its length */
+	auto truncated = archive;
+	{
+		uint32_t nsections;
+		memcpy( &nsections, truncated.data() + truncated.size() - sizeof( uint64_t ) - sizeof( nsections ), sizeof( nsections ) );
+		auto directory = reinterpret_cast<Section *>( truncated.data() + truncated.size() - sizeof( uint64_t ) -
+													  sizeof( nsections ) - nsections * sizeof( Section ) );
+		auto checksums = std::find_if( directory, directory + nsections,
+									   []( Section const &section ) { return section.tag == SectionTag::Checksums; } );
+		ASSERT_NE( checksums, directory + nsections );
+		checksums->length -= sizeof( uint32_t );
+	}
+	SliceReader truncated_reader( truncated.data(), truncated.size() );
+	Unarchiver truncated_unarchiver( truncated_reader );
+	EXPECT_THROW( truncated_unarchiver.corrupted_frames(), runtime_error );
+
+	/* and so are the sections read with the footer */
+	Footer footer;
+	footer.frame_offset.assign( 1, 0 );
+	footer.transfer = { 0.f, .5f, 1.f };
+	vector<char> bytes;
+	{
+		UnboundedVectorWriter writer( bytes );
+		footer.write_to( writer, Header{}.set_dim( Idx{ 1, 1, 1 } ).set_block_size( 64 ).set_frame_size( 1 ) );
+	}
+	uint64_t meta_offset;
+	uint32_t nsections;
+	memcpy( &meta_offset, bytes.data() + bytes.size() - sizeof( meta_offset ), sizeof( meta_offset ) );
+	memcpy( &nsections, bytes.data() + bytes.size() - sizeof( meta_offset ) - sizeof( nsections ), sizeof( nsections ) );
+	auto directory = reinterpret_cast<Section const *>( bytes.data() + bytes.size() - sizeof( meta_offset ) -
+														sizeof( nsections ) - nsections * sizeof( Section ) );
+	auto transfer = std::find_if( directory, directory + nsections,
+								  []( Section const &section ) { return section.tag == SectionTag::Transfer; } );
+	ASSERT_NE( transfer, directory + nsections );
+	{
+		SliceReader reader( bytes.data(), bytes.size() );
+		Footer read;
+		read.read_from( reader, archive_version );
+		EXPECT_EQ( read.transfer, footer.transfer );
+	}
+	uint64_t count = 1000;
+	memcpy( bytes.data() + meta_offset + transfer->offset, &count, sizeof( count ) );
+	{
+		SliceReader reader( bytes.data(), bytes.size() );
+		Footer read;
+		EXPECT_THROW( read.read_from( reader, archive_version ), runtime_error );
+	}
+}
+
+/* the archive with its footer laid out like version, one field after
+   another, as archives before v14 were written */
+vector<char> with_legacy_footer( vector<char> const &archive, uint64_t version )
+{
+	SliceReader reader( archive.data(), archive.size() );
+	UnarchiverData data( reader );
+	auto header = data.header;
+	auto &footer = data.footer;
+	header.version = version;
+	vector<char> legacy( archive.begin(), archive.begin() + sizeof( Header ) + footer.frame_offset.back() );
+	memcpy( legacy.data(), &header, sizeof( header ) );
+	UnboundedVectorWriter writer( legacy );
+	writer.seek( legacy.size() );
+	const uint64_t meta_offset = footer.frame_offset.back();
+	vector<unsigned char> lengths;
+	for ( uint32_t f = 0; f != footer.frame_count(); ++f ) {
+		put_varint( lengths, footer.frame_offset[ f + 1 ] - footer.frame_offset[ f ] );
+	}
+	writer.write_typed( lengths );
+	footer.write_block_table( writer, header );
+	writer.write_typed( footer.residuals() );
+	writer.write_typed( footer.transfer );
+	writer.write_typed( footer.checksums() );
+	footer.write_stats_table( writer, header.dim );
+	writer.write_typed( footer.shards );
+	writer.write_typed( footer.shard_offset );
+	writer.write_typed( footer.frame_shard );
+	if ( version >= 13 ) {
+		writer.write_typed( footer.preview_dim );
+		writer.write_typed( footer.preview_scale );
+		writer.write_typed( footer.preview );
+	}
+	writer.write_typed( meta_offset );
+	return legacy;
+}
+
+TEST( test_archive, legacy_footer )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.legacy.h264";
+	compress_256( raw_input_file, h264_output_file );
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	vector<char> archive( is.tellg() );
+	is.seekg( 0 );
+	is.read( archive.data(), archive.size() );
+
+	SliceReader reader( archive.data(), archive.size() );
+	Unarchiver current( reader );
+	vector<unsigned char> expected( 64 * 64 * 64 ), buffer( expected.size() );
+	current.unarchive_to( Idx{ 2, 1, 3 }, expected );
+	vector<unsigned char> expected_preview, preview;
+	ASSERT_TRUE( current.preview( expected_preview ) );
+	BlockStats expected_stats, stats;
+	ASSERT_TRUE( current.block_stats( Idx{ 2, 1, 3 }, expected_stats ) );
+
+	for ( uint64_t version : { 12, 13 } ) {
+		const auto legacy = with_legacy_footer( archive, version );
+		SliceReader legacy_reader( legacy.data(), legacy.size() );
+		Unarchiver unarchiver( legacy_reader, DecodeOptions{}.set_verify_checksums( true ) );
+		EXPECT_EQ( unarchiver.data.header.version, version );
+		EXPECT_EQ( unarchiver.data.footer.frame_offset, current.data.footer.frame_offset );
+		EXPECT_TRUE( unarchiver.has_checksums() );
+		EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+		unarchiver.unarchive_to( Idx{ 2, 1, 3 }, buffer );
+		EXPECT_EQ( buffer, expected );
+		ASSERT_TRUE( unarchiver.block_stats( Idx{ 2, 1, 3 }, stats ) );
+		EXPECT_EQ( stats.min, expected_stats.min );
+		EXPECT_EQ( stats.max, expected_stats.max );
+		EXPECT_EQ( stats.histogram, expected_stats.histogram );
+		/* the preview came with v13 */
+		EXPECT_EQ( unarchiver.preview( preview ), version >= 13 );
+		if ( version >= 13 ) {
+			EXPECT_EQ( preview, expected_preview );
+		}
+	}
+}
+
+TEST( test_archive, block_stats )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.stats.h264";
+	{
+		Archiver archiver( archive_opts_256( raw_input_file, h264_output_file ).set_histogram_bins( 8 ) );
+		ASSERT_TRUE( archiver.convert() );
+	}
+
+	/* statistics of the raw voxels of every block */
+	RawReaderIO raw_input( raw_input_file, Size3( 256, 256, 256 ), sizeof( char ) );
+	vector<unsigned char> brick( 64 * 64 * 64 );
+	map<Idx, BlockStats> expected;
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				raw_input.readRegion( Vec3i( i, j, k ) * 64, Size3( 64, 64, 64 ), brick.data() );
+				auto &stats = expected[ Idx{ i, j, k } ];
+				stats.min = *std::min_element( brick.begin(), brick.end() );
+				stats.max = *std::max_element( brick.begin(), brick.end() );
+				stats.mean = std::accumulate( brick.begin(), brick.end(), 0.0 ) / brick.size();
+				stats.histogram.resize( 8 );
+				for ( auto v : brick ) {
+					++stats.histogram[ v / 32 ];
+				}
+			}
+		}
+	}
+
+	MappedReader reader( h264_output_file );
+	Unarchiver unarchiver( reader );
+	ASSERT_TRUE( unarchiver.has_block_stats() );
+	ASSERT_EQ( unarchiver.histogram_bins(), 8 );
+	BlockStats stats;
+	for ( auto &e : expected ) {
+		ASSERT_TRUE( unarchiver.block_stats( e.first, stats ) );
+		EXPECT_EQ( stats.min, e.second.min );
+		EXPECT_EQ( stats.max, e.second.max );
+		EXPECT_NEAR( stats.mean, e.second.mean, 1e-3 );
+		EXPECT_EQ( stats.histogram, e.second.histogram );
+	}
+
+	vector<Idx> bright;
+	for ( auto &e : expected ) {
+		if ( e.second.max >= 128 ) bright.emplace_back( e.first );
+	}
+	auto in_range = unarchiver.blocks_in_range( 128, 255 );
+	std::sort( in_range.begin(), in_range.end() );
+	EXPECT_EQ( in_range, bright );
+
+	/* the same statistics once the index is loaded */
+	unarchiver.data.footer.load_index();
+	ASSERT_TRUE( unarchiver.block_stats( Idx{ 2, 1, 3 }, stats ) );
+	EXPECT_EQ( stats.histogram, expected[ ( Idx{ 2, 1, 3 } ) ].histogram );
+	in_range = unarchiver.blocks_in_range( 128, 255 );
+	std::sort( in_range.begin(), in_range.end() );
+	EXPECT_EQ( in_range, bright );
+}
+
+TEST( test_archive, sparse )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.sparse.h264";
+	auto is_occupied = []( Idx const &idx ) { return ( idx.x + idx.y + idx.z ) % 3 == 0; };
+	{
+		RawReaderIO raw_input( raw_input_file, Size3( 256, 256, 256 ), sizeof( char ) );
+		vector<vector<char>> bricks;
+		vector<Idx> occupied;
+		for ( uint32_t i = 0; i != 4; ++i ) {
+			for ( uint32_t j = 0; j != 4; ++j ) {
+				for ( uint32_t k = 0; k != 4; ++k ) {
+					if ( is_occupied( { i, j, k } ) ) {
+						bricks.emplace_back( 64 * 64 * 64 );
+						occupied.emplace_back( Idx{ i, j, k } );
+						raw_input.readRegion( Vec3i( i, j, k ) * 64, Size3( 64, 64, 64 ),
+											  reinterpret_cast<unsigned char *>( bricks.back().data() ) );
+					}
+				}
+			}
+		}
+
+		auto opts = archive_opts_256( "", h264_output_file );
+		Archiver archiver( opts );
+		int i = 0;
+		ASSERT_TRUE( archiver.convert_sparse(
+		  [&]( Idx &idx, vm::Arc<Reader> &brick ) {
+			  if ( i == bricks.size() ) return false;
+			  idx = occupied[ i ];
+			  brick.reset( new SliceReader( bricks[ i ].data(), bricks[ i ].size() ) );
+			  return ++i, true;
+		  } ) );
+	}
+
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	StreamReader reader( is, 0, is.tellg() );
+	Unarchiver unarchiver( reader );
+	EXPECT_EQ( unarchiver.dim(), ( Idx{ 4, 4, 4 } ) );
+
+	vector<unsigned char> buffer( 64 * 64 * 64 );
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				Idx idx{ i, j, k };
+				ASSERT_EQ( unarchiver.is_empty( idx ), !is_occupied( idx ) );
+				if ( is_occupied( idx ) ) {
+					ASSERT_TRUE( compare_block( unarchiver, raw_input_file, idx ) );
+				} else {
+					buffer.assign( buffer.size(), 0xff );
+					unarchiver.unarchive_to( idx, buffer );
+					ASSERT_EQ( std::count( buffer.begin(), buffer.end(), 0 ), buffer.size() );
+				}
+			}
+		}
+	}
+}
+
+TEST( test_archive, adaptive )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.adaptive.h264";
+	{
+		auto opts = archive_opts_256( raw_input_file, h264_output_file )
+					  .set_log_block_size( 5 )
+					  .set_max_block_level( 2 )
+					  .set_homogeneity( 4 );
+		Archiver archiver( opts );
+		ASSERT_TRUE( archiver.convert() );
+	}
+
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	StreamReader reader( is, 0, is.tellg() );
+	Unarchiver unarchiver( reader );
+	EXPECT_EQ( unarchiver.dim(), ( Idx{ 8, 8, 8 } ) );
+
+	int merged = 0;
+	for ( uint32_t i = 0; i != 8; ++i ) {
+		for ( uint32_t j = 0; j != 8; ++j ) {
+			for ( uint32_t k = 0; k != 8; ++k ) {
+				Idx idx{ i, j, k };
+				auto level = unarchiver.block_level( idx );
+				auto node = unarchiver.resolve( idx );
+				EXPECT_EQ( node, ( Idx{ i >> level << level, j >> level << level, k >> level << level } ) );
+				merged += level > 0;
+				ASSERT_TRUE( compare_block( unarchiver, raw_input_file, idx ) );
+			}
+		}
+	}
+	EXPECT_GT( merged, 0 );
+}
+
+TEST( test_archive, in_memory )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	vector<char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( raw.data(), raw.size() );
+
+	auto opts = archive_opts_256( "", "" ).set_padding( 1 );
+	auto decode = [&]( vector<char> const &archive ) {
+		SliceReader reader( archive.data(), archive.size() );
+		Unarchiver unarchiver( reader );
+		EXPECT_EQ( unarchiver.dim(), ( Idx{ 5, 5, 5 } ) );
+		vector<unsigned char> buffer( 64 * 64 * 64 );
+		for ( uint32_t i = 0; i != 5; ++i ) {
+			for ( uint32_t j = 0; j != 5; ++j ) {
+				for ( uint32_t k = 0; k != 5; ++k ) {
+					unarchiver.unarchive_to( Idx{ i, j, k }, buffer );
+					for ( int z = 0; z < 64; z += 7 ) {
+						for ( int y = 0; y < 64; y += 5 ) {
+							for ( int x = 0; x != 64; ++x ) {
+								const int rx = i * 62 - 1 + x, ry = j * 62 - 1 + y, rz = k * 62 - 1 + z;
+								const bool inside = rx >= 0 && rx < 256 && ry >= 0 && ry < 256 && rz >= 0 && rz < 256;
+								const int expected = inside ? (unsigned char)raw[ ( rz * 256 + ry ) * 256 + rx ] : 0;
+								ASSERT_LE( std::abs( buffer[ ( z * 64 + y ) * 64 + x ] - expected ), 32 );
+							}
+						}
+					}
+				}
+			}
+		}
+	};
+
+	vector<char> from_reader;
+	{
+		SliceReader input( raw.data(), raw.size() );
+		UnboundedVectorWriter output( from_reader );
+		Archiver archiver( opts, input, output );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	decode( from_reader );
+
+	vector<char> from_callback;
+	size_t nregions = 0;
+	{
+		UnboundedVectorWriter output( from_callback );
+		Archiver archiver(
+		  opts,
+		  [&]( Idx const &start, Idx const &size, unsigned char *dst ) {
+			  ++nregions;
+			  for ( uint32_t z = 0; z != size.z; ++z ) {
+				  for ( uint32_t y = 0; y != size.y; ++y ) {
+					  memcpy( dst, raw.data() + ( ( start.z + z ) * 256 + start.y + y ) * 256 + start.x, size.x );
+					  dst += size.x;
+				  }
+			  }
+		  },
+		  output );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	EXPECT_GT( nregions, 0 );
+	decode( from_callback );
+}
+
+TEST( test_archive, max_error )
+{
+	auto raw_input_file = "./test_data/urandom_256x256x256_uint8.raw";
+	vector<char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( raw.data(), raw.size() );
+
+	const int max_error = 1;
+	auto opts = archive_opts_256( "", "" ).set_max_error( max_error );
+	auto check = [&]( vector<char> const &archive ) {
+		SliceReader reader( archive.data(), archive.size() );
+		Unarchiver unarchiver( reader );
+		auto &index = unarchiver.data.footer.index( 0 );
+		EXPECT_GT( std::count_if( index.begin(), index.end(),
+								  []( auto &e ) { return e.second.codec == BlockCodec::Palette; } ),
+				   0 );
+		vector<unsigned char> buffer( 64 * 64 * 64 );
+		for ( uint32_t i = 0; i != 4; ++i ) {
+			for ( uint32_t j = 0; j != 4; ++j ) {
+				for ( uint32_t k = 0; k != 4; ++k ) {
+					unarchiver.unarchive_to( Idx{ i, j, k }, buffer );
+					for ( int z = 0; z != 64; ++z ) {
+						for ( int y = 0; y != 64; ++y ) {
+							auto src = raw.data() + ( ( k * 64 + z ) * 256 + j * 64 + y ) * 256 + i * 64;
+							auto dst = buffer.data() + ( z * 64 + y ) * 64;
+							for ( int x = 0; x != 64; ++x ) {
+								ASSERT_LE( std::abs( dst[ x ] - (unsigned char)src[ x ] ), max_error );
+							}
+						}
+					}
+				}
+			}
+		}
+	};
+
+	vector<char> strided;
+	{
+		SliceReader input( raw.data(), raw.size() );
+		UnboundedVectorWriter output( strided );
+		Archiver archiver( opts, input, output );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	check( strided );
+
+	vector<char> sparse, brick( 64 * 64 * 64 );
+	{
+		UnboundedVectorWriter output( sparse );
+		Archiver archiver( opts, output );
+		uint32_t n = 0;
+		ASSERT_TRUE( archiver.convert_sparse(
+		  [&]( Idx &idx, vm::Arc<Reader> &reader ) {
+			  if ( n == 64 ) return false;
+			  idx = Idx{ n % 4, n / 4 % 4, n / 16 };
+			  for ( uint32_t z = 0; z != 64; ++z ) {
+				  for ( uint32_t y = 0; y != 64; ++y ) {
+					  memcpy( brick.data() + ( z * 64 + y ) * 64,
+							  raw.data() + ( ( idx.z * 64 + z ) * 256 + idx.y * 64 + y ) * 256 + idx.x * 64, 64 );
+				  }
+			  }
+			  reader.reset( new SliceReader( brick.data(), brick.size() ) );
+			  return ++n, true;
+		  } ) );
+	}
+	check( sparse );
+}
+
+TEST( test_archive, residual )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	vector<char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( raw.data(), raw.size() );
+
+	vector<char> archive;
+	{
+		SliceReader input( raw.data(), raw.size() );
+		UnboundedVectorWriter output( archive );
+		Archiver archiver( archive_opts_256( "", "" ).set_residual( true ), input, output );
+		ASSERT_TRUE( archiver.convert() );
+	}
+
+	/* lossy decode is unaffected, refined decode is exact */
+	for ( bool refine : { false, true } ) {
+		SliceReader reader( archive.data(), archive.size() );
+		Unarchiver unarchiver( reader, DecodeOptions{}.set_refine( refine ) );
+		ASSERT_TRUE( unarchiver.has_residuals() );
+		vector<unsigned char> buffer( 64 * 64 * 64 );
+		size_t ndiff = 0;
+		for ( uint32_t i = 0; i != 4; ++i ) {
+			for ( uint32_t j = 0; j != 4; ++j ) {
+				for ( uint32_t k = 0; k != 4; ++k ) {
+					unarchiver.unarchive_to( Idx{ i, j, k }, buffer );
+					for ( int z = 0; z != 64; ++z ) {
+						for ( int y = 0; y != 64; ++y ) {
+							auto src = raw.data() + ( ( k * 64 + z ) * 256 + j * 64 + y ) * 256 + i * 64;
+							auto dst = buffer.data() + ( z * 64 + y ) * 64;
+							for ( int x = 0; x != 64; ++x ) {
+								ndiff += dst[ x ] != (unsigned char)src[ x ];
+							}
+						}
+					}
+				}
+			}
+		}
+		if ( refine ) {
+			EXPECT_EQ( ndiff, 0 );
+		} else {
+			EXPECT_GT( ndiff, 0 );
+		}
+	}
+}
+
+TEST( test_archive, transcode )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto source_file = "./test.aneurism_256x256x256_uint8.residual.h264";
+	auto output_file = "./test.aneurism_256x256x256_uint8.transcoded.h264";
+	{
+		Archiver archiver( archive_opts_256( raw_input_file, source_file ).set_residual( true ) );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	vector<char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( raw.data(), raw.size() );
+
+	/* exact source voxels rearchived losslessly into a padded 32^3 grid */
+	auto archive_opts = archive_opts_256( "", "" )
+						  .set_log_block_size( 5 )
+						  .set_padding( 1 )
+						  .set_suggest_mem_gb( 1 )
+						  .set_max_error( 0 );
+	{
+		Transcoder transcoder( TranscoderOptions{}
+								 .set_input( source_file )
+								 .set_output( output_file )
+								 .set_archive_opts( archive_opts )
+								 .set_decode_opts( DecodeOptions{}.set_refine( true ) ) );
+		ASSERT_TRUE( transcoder.transcode() );
+	}
+
+	ifstream is( output_file, ios::ate | ios::binary );
+	StreamReader reader( is, 0, is.tellg() );
+	Unarchiver unarchiver( reader );
+	EXPECT_EQ( unarchiver.raw(), ( Idx{ 256, 256, 256 } ) );
+	EXPECT_EQ( unarchiver.block_size(), 32 );
+	EXPECT_EQ( unarchiver.dim(), ( Idx{ 9, 9, 9 } ) );
+	vector<unsigned char> buffer( 32 * 32 * 32 );
+	for ( uint32_t i = 0; i != 9; ++i ) {
+		for ( uint32_t j = 0; j != 9; ++j ) {
+			for ( uint32_t k = 0; k != 9; ++k ) {
+				unarchiver.unarchive_to( Idx{ i, j, k }, buffer );
+				for ( int z = 0; z != 32; ++z ) {
+					for ( int y = 0; y != 32; ++y ) {
+						for ( int x = 0; x != 32; ++x ) {
+							const int rx = i * 30 - 1 + x, ry = j * 30 - 1 + y, rz = k * 30 - 1 + z;
+							const bool inside = rx >= 0 && rx < 256 && ry >= 0 && ry < 256 && rz >= 0 && rz < 256;
+							const int expected = inside ? (unsigned char)raw[ ( rz * 256 + ry ) * 256 + rx ] : 0;
+							ASSERT_EQ( buffer[ ( z * 32 + y ) * 32 + x ], expected );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+TEST( test_archive, update )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto archive_file = "./test.aneurism_256x256x256_uint8.update.h264";
+	auto compacted_file = "./test.aneurism_256x256x256_uint8.compacted.h264";
+	/* lossless everywhere, so that decoded voxels are compared exactly */
+	auto opts = archive_opts_256( raw_input_file, archive_file ).set_padding( 1 ).set_max_error( 0 );
+	{
+		Archiver archiver( opts );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	vector<char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( raw.data(), raw.size() );
+
+	/* the region touches the padding of neighbouring blocks */
+	const Idx start{ 50, 61, 123 }, size{ 40, 30, 20 };
+	vector<unsigned char> region( size.total() );
+	for ( uint32_t z = 0; z != size.z; ++z ) {
+		for ( uint32_t y = 0; y != size.y; ++y ) {
+			for ( uint32_t x = 0; x != size.x; ++x ) {
+				auto &v = raw[ ( ( start.z + z ) * 256 + start.y + y ) * 256 + start.x + x ];
+				v = 255 - (unsigned char)v;
+				region[ ( z * size.y + y ) * size.x + x ] = v;
+			}
+		}
+	}
+	{
+		Updater updater( UpdaterOptions{}.set_archive( archive_file ).set_archive_opts( opts ) );
+		ASSERT_TRUE( updater.update( start, size, region.data() ) );
+	}
+	{
+		Compactor compactor( CompactorOptions{}.set_input( archive_file ).set_output( compacted_file ) );
+		ASSERT_TRUE( compactor.compact() );
+	}
+
+	for ( auto file : { archive_file, compacted_file } ) {
+		ifstream is( file, ios::ate | ios::binary );
+		StreamReader reader( is, 0, is.tellg() );
+		Unarchiver unarchiver( reader );
+		vector<unsigned char> buffer( 64 * 64 * 64 );
+		for ( uint32_t i = 0; i != 5; ++i ) {
+			for ( uint32_t j = 0; j != 5; ++j ) {
+				for ( uint32_t k = 0; k != 5; ++k ) {
+					unarchiver.unarchive_to( Idx{ i, j, k }, buffer );
+					for ( int z = 0; z != 64; ++z ) {
+						for ( int y = 0; y != 64; ++y ) {
+							for ( int x = 0; x != 64; ++x ) {
+								const int rx = i * 62 - 1 + x, ry = j * 62 - 1 + y, rz = k * 62 - 1 + z;
+								const bool inside = rx >= 0 && rx < 256 && ry >= 0 && ry < 256 && rz >= 0 && rz < 256;
+								const int expected = inside ? (unsigned char)raw[ ( rz * 256 + ry ) * 256 + rx ] : 0;
+								ASSERT_EQ( buffer[ ( z * 64 + y ) * 64 + x ], expected );
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	ifstream updated( archive_file, ios::ate | ios::binary ), compacted( compacted_file, ios::ate | ios::binary );
+	EXPECT_LT( compacted.tellg(), updated.tellg() );
+}
+
+TEST( test_archive, quantize )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	vector<unsigned char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( reinterpret_cast<char *>( raw.data() ), raw.size() );
+	/* uint16 voxels whose window maps back to the original 8-bit values */
+	vector<uint16_t> wide( raw.size() );
+	for ( size_t i = 0; i != raw.size(); ++i ) {
+		wide[ i ] = 1000 + raw[ i ] * 40;
+	}
+
+	for ( auto mode : { Quantize::Window, Quantize::Equalize } ) {
+		/* lossless blocks, so that decoded voxels are the quantized ones */
+		auto opts = archive_opts_256( "", "" ).set_max_error( 0 );
+		opts.quantize.set_mode( mode ).set_window_lo( 1000 ).set_window_hi( 1000 + 255 * 40 );
+		vector<char> archive;
+		{
+			SliceReader input( reinterpret_cast<char const *>( wide.data() ), wide.size() * sizeof( uint16_t ) );
+			UnboundedVectorWriter writer( archive );
+			Archiver archiver( opts, input, writer );
+			ASSERT_TRUE( archiver.convert() );
+		}
+
+		SliceReader reader( archive.data(), archive.size() );
+		Unarchiver unarchiver( reader );
+		auto &transfer = unarchiver.transfer();
+		ASSERT_EQ( transfer.size(), 256 );
+		for ( int c = 1; c != 256; ++c ) {
+			EXPECT_LE( transfer[ c - 1 ], transfer[ c ] );
+		}
+		if ( mode != Quantize::Window ) continue;
+
+		for ( int c = 0; c != 256; ++c ) {
+			EXPECT_NEAR( transfer[ c ], 1000 + c * 40, 1e-2 );
+		}
+		vector<unsigned char> buffer( 64 * 64 * 64 );
+		for ( auto idx : { Idx{ 0, 0, 0 }, Idx{ 1, 2, 3 }, Idx{ 3, 3, 3 } } ) {
+			unarchiver.unarchive_to( idx, buffer );
+			for ( int z = 0; z != 64; ++z ) {
+				for ( int y = 0; y != 64; ++y ) {
+					for ( int x = 0; x != 64; ++x ) {
+						const auto v = raw[ ( ( idx.z * 64 + z ) * 256 + idx.y * 64 + y ) * 256 + idx.x * 64 + x ];
+						ASSERT_EQ( buffer[ ( z * 64 + y ) * 64 + x ], v );
+					}
+				}
+			}
+		}
+	}
+}
+
+TEST( test_archive, halo_reuse )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	vector<unsigned char> raw( 256 * 256 * 256 );
+	ifstream( raw_input_file, ios::binary ).read( reinterpret_cast<char *>( raw.data() ), raw.size() );
+	size_t nread = 0;
+	auto input = [&]( Idx const &start, Idx const &size, unsigned char *dst ) {
+		for ( uint32_t z = 0; z != size.z; ++z ) {
+			for ( uint32_t y = 0; y != size.y; ++y ) {
+				memcpy( dst, &raw[ ( ( start.z + z ) * 256 + start.y + y ) * 256 + start.x ], size.x );
+				dst += size.x;
+			}
+		}
+		nread += size.total();
+	};
+	/* lossless, so that the halos taken from previous strides are compared exactly */
+	auto opts = archive_opts_256( "", "" ).set_log_block_size( 5 ).set_padding( 2 ).set_max_error( 0 );
+	vector<char> archive;
+	{
+		UnboundedVectorWriter writer( archive );
+		Archiver archiver( opts, input, writer );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	EXPECT_EQ( nread, raw.size() );
+
+	SliceReader reader( archive.data(), archive.size() );
+	Unarchiver unarchiver( reader );
+	const auto dim = unarchiver.dim();
+	vector<unsigned char> buffer( 32 * 32 * 32 );
+	for ( uint32_t k = 0; k != dim.z; ++k ) {
+		for ( uint32_t j = 0; j != dim.y; ++j ) {
+			for ( uint32_t i = 0; i != dim.x; ++i ) {
+				unarchiver.unarchive_to( Idx{ i, j, k }, buffer );
+				for ( int z = 0; z != 32; ++z ) {
+					for ( int y = 0; y != 32; ++y ) {
+						for ( int x = 0; x != 32; ++x ) {
+							const int rx = i * 28 - 2 + x, ry = j * 28 - 2 + y, rz = k * 28 - 2 + z;
+							const bool inside = rx >= 0 && rx < 256 && ry >= 0 && ry < 256 && rz >= 0 && rz < 256;
+							const int expected = inside ? raw[ ( rz * 256 + ry ) * 256 + rx ] : 0;
+							ASSERT_EQ( buffer[ ( z * 32 + y ) * 32 + x ], expected );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+TEST( test_archive, cancel )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.resumed.h264";
+	vector<string> parts = { "./test.aneurism_256x256x256_uint8.cancelled.h264",
+							 "./test.aneurism_256x256x256_uint8.resume.h264" };
+	size_t slices_done = 0;
+	{
+		Archiver *running = nullptr;
+		auto opts = archive_opts_256( raw_input_file, parts[ 0 ] )
+					  .set_on_progress( [&]( ArchiveProgress const &progress ) {
+						  EXPECT_EQ( progress.blocks_total, 64 );
+						  EXPECT_LE( progress.blocks_done, progress.blocks_total );
+						  EXPECT_EQ( progress.bytes_in, progress.blocks_done * 64 * 64 * 64 );
+						  if ( progress.slices_done == 2 ) {
+							  running->cancel();
+						  }
+						  slices_done = progress.slices_done;
+					  } );
+		Archiver archiver( opts );
+		running = &archiver;
+		EXPECT_FALSE( archiver.convert() );
+	}
+	ASSERT_EQ( slices_done, 2 );
+	{
+		ifstream is( parts[ 0 ], ios::ate | ios::binary );
+		StreamReader reader( is, 0, is.tellg() );
+		Unarchiver unarchiver( reader );
+		EXPECT_EQ( unarchiver.data.footer.index( 0 ).size(), 2 * 4 * 4 );
+	}
+
+	/* the cancelled archive is resumed from slices_done and merged */
+	{
+		Archiver archiver( archive_opts_256( raw_input_file, parts[ 1 ] ).set_slice_begin( slices_done ) );
+		ASSERT_TRUE( archiver.convert() );
+	}
+	Merger merger( MergerOptions{}
+					 .set_inputs( parts )
+					 .set_output( h264_output_file ) );
+	ASSERT_TRUE( merger.merge() );
+	decode_256( raw_input_file, h264_output_file );
+	{
+		/* each part sampled the preview voxels of its own slab */
+		MappedReader reader( h264_output_file );
+		Unarchiver unarchiver( reader );
+		expect_preview( unarchiver, raw_input_file );
+	}
+}
+
+TEST( test_archive, multi_channel )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto inverted_file = "./test.aneurism_256x256x256_uint8.inverted.raw";
+	auto interleaved_file = "./test.aneurism_256x256x256_uint8x2.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8x2.h264";
+	{
+		ifstream is( raw_input_file, ios::binary );
+		vector<char> channel( 256 * 256 * 256 ), inverted( channel.size() ), interleaved( channel.size() * 2 );
+		is.read( channel.data(), channel.size() );
+		for ( size_t i = 0; i != channel.size(); ++i ) {
+			inverted[ i ] = ~channel[ i ];
+			interleaved[ 2 * i ] = channel[ i ];
+			interleaved[ 2 * i + 1 ] = inverted[ i ];
+		}
+		ofstream( inverted_file, ios::binary ).write( inverted.data(), inverted.size() );
+		ofstream( interleaved_file, ios::binary ).write( interleaved.data(), interleaved.size() );
+	}
+	{
+		Archiver archiver( archive_opts_256( interleaved_file, h264_output_file ).set_channels( 2 ) );
+		ASSERT_TRUE( archiver.convert() );
+	}
+
+	ifstream is( h264_output_file, ios::ate | ios::binary );
+	StreamReader reader( is, 0, is.tellg() );
+	Unarchiver unarchiver( reader );
+	ASSERT_EQ( unarchiver.channels(), 2 );
+
+	const size_t N_3 = 64 * 64 * 64;
+	vector<unsigned char> c0( N_3 ), c1( N_3 ), interleaved( 2 * N_3 );
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				Idx idx{ i, j, k };
+				ASSERT_TRUE( compare_block( unarchiver, raw_input_file, idx, 0 ) );
+				ASSERT_TRUE( compare_block( unarchiver, inverted_file, idx, 1 ) );
+				unarchiver.unarchive_to( idx, 0, c0 );
+				unarchiver.unarchive_to( idx, 1, c1 );
+				ASSERT_EQ( unarchiver.unarchive_interleaved_to( idx, interleaved ), 2 * N_3 );
+				for ( size_t v = 0; v != N_3; ++v ) {
+					ASSERT_EQ( interleaved[ 2 * v ], c0[ v ] );
+					ASSERT_EQ( interleaved[ 2 * v + 1 ], c1[ v ] );
+				}
+			}
+		}
+	}
+	EXPECT_THROW( unarchiver.unarchive_to( Idx{ 0, 0, 0 }, 2, c0 ), std::logic_error );
+}
+
+#ifndef WIN32
+TEST( test_archive, slab_merge )
+{
+	auto raw_input_file = "./test_data/aneurism_256x256x256_uint8.raw";
+	auto h264_output_file = "./test.aneurism_256x256x256_uint8.merged.h264";
+	const int nslabs = 3;
+	const int slab_ranges[ nslabs + 1 ] = { 0, 1, 3, 4 };
+
+	vector<string> parts;
+	vector<pid_t> children;
+	for ( int i = 0; i != nslabs; ++i ) {
+		parts.emplace_back( vm::fmt( "./test.aneurism_256x256x256_uint8.part{}.h264", i ) );
+		auto pid = fork();
+		ASSERT_GE( pid, 0 );
+		if ( pid == 0 ) {
+			auto opts = archive_opts_256( raw_input_file, parts.back() )
+						  .set_slice_begin( slab_ranges[ i ] )
+						  .set_slice_end( slab_ranges[ i + 1 ] );
+			Archiver archiver( opts );
+			_exit( archiver.convert() ? 0 : 1 );
+		}
+		children.emplace_back( pid );
+	}
+	for ( auto pid : children ) {
+		int status;
+		ASSERT_EQ( waitpid( pid, &status, 0 ), pid );
+		ASSERT_TRUE( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+	}
+
+	Merger merger( MergerOptions{}
+					 .set_inputs( parts )
+					 .set_output( h264_output_file ) );
+	ASSERT_TRUE( merger.merge() );
+	decode_256( raw_input_file, h264_output_file );
+
+	/* the parts as shards of a manifest, read concurrently */
+	auto manifest_file = "./test.aneurism_256x256x256_uint8.manifest.h264";
+	ASSERT_TRUE( Merger( MergerOptions{}
+						   .set_inputs( parts )
+						   .set_output( manifest_file )
+						   .set_manifest( true ) )
+				   .merge() );
+	ASSERT_TRUE( ShardedReader::is_manifest( manifest_file ) );
+	{
+		ifstream is( manifest_file, ios::ate | ios::binary );
+		StreamReader reader( is, 0, is.tellg() );
+		EXPECT_THROW( Unarchiver{ reader }, runtime_error );
+	}
+	ShardedReader sharded( manifest_file );
+	Unarchiver unarchiver( sharded, DecodeOptions{}.set_verify_checksums( true ) );
+	ASSERT_EQ( unarchiver.shards().size(), nslabs );
+	/* shards next to the manifest are stored relative to it */
+	for ( auto &shard : unarchiver.shards() ) {
+		EXPECT_EQ( shard.find_first_of( "/\\" ), string::npos ) << shard;
+	}
+	EXPECT_TRUE( unarchiver.corrupted_frames().empty() );
+	for ( uint32_t i = 0; i != 4; ++i ) {
+		for ( uint32_t j = 0; j != 4; ++j ) {
+			for ( uint32_t k = 0; k != 4; ++k ) {
+				ASSERT_TRUE( compare_block( unarchiver, raw_input_file, Idx{ i, j, k } ) );
+			}
+		}
+	}
+
+	/* a single read across all shards returns the frames of the merged archive */
+	ifstream merged( h264_output_file, ios::binary );
+	vector<char> expected( unarchiver.data.footer.frame_offset.back() ), actual( expected.size() );
+	merged.seekg( sizeof( unarchiver.data.header ) );
+	merged.read( expected.data(), expected.size() );
+	sharded.seek( sizeof( unarchiver.data.header ) );
+	ASSERT_EQ( sharded.read( actual.data(), actual.size() ), actual.size() );
+	EXPECT_TRUE( expected == actual );
+}
+#endif
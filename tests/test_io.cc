@@ -1,9 +1,13 @@
+#include <random>
 #include <gtest/gtest.h>
 #include <varch/utils/linked_reader.hpp>
 #include <varch/utils/padded_reader.hpp>
 #include <varch/utils/unbounded_vector_writer.hpp>
+#include <varch/utils/varint.hpp>
+#include <unarchive/crc32c.hpp>
 
 using namespace vol;
+using namespace __inner__;
 using namespace std;
 
 TEST( test_io, linked_reader )
@@ -30,6 +34,11 @@ TEST( test_io, linked_reader )
 	EXPECT_EQ( 21, reader.tell() );
 
 	EXPECT_EQ( 0, reader.read( const_cast<char *>( d.data() ), d.length() ) );
+
+	reader.seek( 2 );
+	reader.seek( 21 );
+	EXPECT_EQ( 21, reader.tell() );
+	EXPECT_EQ( 0, reader.read( const_cast<char *>( d.data() ), d.length() ) );
 }
 
 TEST( test_io, padded_reader )
@@ -55,12 +64,54 @@ TEST( test_io, unbounded_vector_writer )
 		"QWERTY"
 	};
 	writer.write( data[ 0 ].c_str(), data[ 0 ].length() );
-	EXPECT_STREQ( vec.data(), "123456789" );
+	EXPECT_EQ( string( vec.begin(), vec.end() ), "123456789" );
 	EXPECT_EQ( writer.tell(), 9 );
 	writer.write( data[ 1 ].c_str(), data[ 1 ].length() );
-	EXPECT_STREQ( vec.data(), "123456789abcdef" );
+	EXPECT_EQ( string( vec.begin(), vec.end() ), "123456789abcdef" );
 	EXPECT_EQ( writer.tell(), 15 );
 	writer.seek( 12 );
 	writer.write( data[ 2 ].c_str(), data[ 2 ].length() );
-	EXPECT_STREQ( vec.data(), "123456789abcQWERTY" );
+	EXPECT_EQ( string( vec.begin(), vec.end() ), "123456789abcQWERTY" );
+}
+
+TEST( test_io, crc32c )
+{
+	const char check[] = "123456789";
+	EXPECT_EQ( crc32c( check, 9 ), 0xE3069283u );
+	EXPECT_EQ( crc32c( check + 4, 5, crc32c( check, 4 ) ), 0xE3069283u );
+
+	/* unaligned heads and tails of every length */
+	vector<char> data( 4099 );
+	std::mt19937 rng( 0 );
+	for ( auto &c : data ) c = char( rng() );
+	for ( std::size_t len : { 0, 1, 7, 8, 9, 63, 1024, 4097 } ) {
+		const auto whole = crc32c( data.data() + 1, len );
+		const auto half = len / 2;
+		EXPECT_EQ( crc32c( data.data() + 1 + half, len - half, crc32c( data.data() + 1, half ) ), whole );
+	}
+}
+
+TEST( test_io, varint )
+{
+	/* runs of single byte values mixed with long ones at every alignment */
+	vector<uint64_t> values;
+	vector<unsigned char> bytes;
+	std::mt19937_64 rng( 0 );
+	for ( int i = 0; i != 4096; ++i ) {
+		const auto bits = rng() % 8 ? 7 : rng() % 64 + 1;
+		values.emplace_back( bits == 64 ? rng() : rng() & ( ( 1ull << bits ) - 1 ) );
+		put_varint( bytes, values.back() );
+	}
+	vector<uint64_t> decoded = { 42 };
+	EXPECT_EQ( decode_varints( bytes.data(), bytes.size(), decoded ), int64_t( values.size() ) );
+	EXPECT_EQ( decoded[ 0 ], 42u );
+	EXPECT_EQ( vector<uint64_t>( decoded.begin() + 1, decoded.end() ), values );
+
+	/* a cut off varint */
+	bytes.clear();
+	put_varint( bytes, 1ull << 40 );
+	EXPECT_LT( decode_varints( bytes.data(), bytes.size() - 1, decoded ), 0 );
+	for ( int64_t x : { int64_t( 0 ), int64_t( -1 ), int64_t( 1 ), INT64_MIN, INT64_MAX } ) {
+		EXPECT_EQ( unzigzag( zigzag( x ) ), x );
+	}
 }
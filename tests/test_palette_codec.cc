@@ -0,0 +1,137 @@
+#include <random>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <varch/archive/archiver.hpp>
+#include <varch/unarchive/unarchiver.hpp>
+#include <archive/backends/palette/palette_encoder.hpp>
+#include <unarchive/backends/palette/palette_decoder.hpp>
+
+using namespace std;
+using namespace vol;
+using namespace __inner__;
+
+void roundtrip( vector<uint32_t> const &src )
+{
+	PaletteEncoder encoder;
+	PaletteDecoder decoder;
+	vector<unsigned char> chunk;
+	encoder.encode( src.data(), src.size(), chunk );
+	vector<uint32_t> dst( src.size(), 0xdeadbeef );
+	decoder.decode( chunk.data(), chunk.size(), dst.data(), dst.size() );
+	ASSERT_EQ( dst, src );
+}
+
+TEST( test_palette_codec, roundtrip )
+{
+	const size_t n = 32 * 32 * 32;
+	minstd_rand rng( 42 );
+
+	roundtrip( vector<uint32_t>( n, 7 ) );
+	roundtrip( vector<uint32_t>( n, 0xffffffff ) );
+
+	/* long runs of few labels */
+	vector<uint32_t> runs( n );
+	for ( size_t i = 0; i < n; ) {
+		const auto len = std::min( size_t( rng() % 500 + 1 ), n - i );
+		std::fill( runs.begin() + i, runs.begin() + i + len, rng() % 5 * 1000003 );
+		i += len;
+	}
+	roundtrip( runs );
+
+	/* palette sizes crossing every index width */
+	for ( uint32_t npalette : { 2u, 3u, 16u, 17u, 256u, 257u, 70000u } ) {
+		vector<uint32_t> noise( n );
+		for ( auto &x : noise ) x = rng() % npalette * 7919;
+		roundtrip( noise );
+	}
+
+	/* odd lengths leave a partial last word */
+	vector<uint32_t> odd( 1001 );
+	for ( auto &x : odd ) x = rng() % 3;
+	roundtrip( odd );
+}
+
+TEST( test_palette_codec, corrupted )
+{
+	vector<uint32_t> src( 4096 );
+	for ( size_t i = 0; i != src.size(); ++i ) src[ i ] = i % 13;
+	vector<unsigned char> chunk;
+	PaletteEncoder().encode( src.data(), src.size(), chunk );
+	vector<uint32_t> dst( src.size() );
+	EXPECT_THROW( PaletteDecoder().decode( chunk.data(), chunk.size() / 2, dst.data(), dst.size() ),
+				  std::runtime_error );
+}
+
+TEST( test_palette_codec, archive )
+{
+	const uint32_t X = 100, Y = 70, Z = 50;
+	auto raw_input_file = "./test.labels_100x70x50_uint32.raw";
+	auto output_file = "./test.labels_100x70x50_uint32.h264";
+
+	/* blobs of constant labels with a noisy slab */
+	vector<uint32_t> labels( X * Y * Z );
+	minstd_rand rng( 7 );
+	for ( uint32_t z = 0; z != Z; ++z ) {
+		for ( uint32_t y = 0; y != Y; ++y ) {
+			for ( uint32_t x = 0; x != X; ++x ) {
+				auto &v = labels[ ( z * Y + y ) * X + x ];
+				v = x / 17 + y / 23 * 7 + z / 11 * 100 + 1;
+				if ( z >= 20 && z < 24 ) v = rng();
+			}
+		}
+	}
+	ofstream( raw_input_file, ios::binary )
+	  .write( reinterpret_cast<char const *>( labels.data() ), labels.size() * sizeof( uint32_t ) );
+
+	{
+		auto opts = ArchiverOptions{}
+					  .set_x( X )
+					  .set_y( Y )
+					  .set_z( Z )
+					  .set_log_block_size( 5 )
+					  .set_padding( 1 )
+					  .set_suggest_mem_gb( 1 )
+					  .set_input( raw_input_file )
+					  .set_output( output_file )
+					  .set_encode_method( EncodeMethod::Label32 );
+		opts.compress_opts.set_threads( 3 );
+		Archiver archiver( opts );
+		ASSERT_TRUE( archiver.convert() );
+	}
+
+	ifstream is( output_file, ios::ate | ios::binary );
+	StreamReader reader( is, 0, is.tellg() );
+	Unarchiver unarchiver( reader );
+	ASSERT_EQ( unarchiver.encode_method(), EncodeMethod::Label32 );
+	ASSERT_EQ( unarchiver.codec(), FrameCodec::Palette );
+	ASSERT_EQ( unarchiver.packing(), FramePacking::Block );
+	ASSERT_EQ( unarchiver.voxel_size(), sizeof( uint32_t ) );
+
+	const int N = unarchiver.block_size();
+	const int N_i = unarchiver.block_inner();
+	const int P = unarchiver.padding();
+	const auto dim = unarchiver.dim();
+	vector<uint32_t> block( N * N * N );
+	for ( uint32_t k = 0; k != dim.z; ++k ) {
+		for ( uint32_t j = 0; j != dim.y; ++j ) {
+			for ( uint32_t i = 0; i != dim.x; ++i ) {
+				const auto len = unarchiver.unarchive_to(
+				  Idx{ i, j, k },
+				  cufx::MemoryView1D<unsigned char>( reinterpret_cast<unsigned char *>( block.data() ),
+													 block.size() * sizeof( uint32_t ) ) );
+				ASSERT_EQ( len, block.size() * sizeof( uint32_t ) );
+				for ( int z = 0; z != N; ++z ) {
+					for ( int y = 0; y != N; ++y ) {
+						for ( int x = 0; x != N; ++x ) {
+							const int rx = i * N_i - P + x, ry = j * N_i - P + y, rz = k * N_i - P + z;
+							const bool inside = rx >= 0 && rx < X && ry >= 0 && ry < Y && rz >= 0 && rz < Z;
+							ASSERT_EQ( block[ ( z * N + y ) * N + x ],
+									   inside ? labels[ ( rz * Y + ry ) * X + rx ] : 0 )
+							  << Idx{ i, j, k } << " " << x << " " << y << " " << z;
+						}
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <VMUtils/fmt.hpp>
+#include <varch/utils/common.hpp>
+
+/* option values shared by the tools */
+inline vol::EncodePreset parse_preset( std::string const &preset )
+{
+	if ( preset == "default" ) return vol::EncodePreset::Default;
+	if ( preset == "hp" ) return vol::EncodePreset::HP;
+	if ( preset == "hq" ) return vol::EncodePreset::HQ;
+	if ( preset == "lossless" ) return vol::EncodePreset::LosslessDefault;
+	throw std::logic_error( vm::fmt( "unknown preset: {}", preset ) );
+}
+
+inline vol::ComputeDevice parse_device( std::string const &device )
+{
+	if ( device == "default" ) return vol::ComputeDevice::Default;
+	if ( device == "cuda" ) return vol::ComputeDevice::Cuda;
+	if ( device == "cpu" ) return vol::ComputeDevice::Cpu;
+	throw std::logic_error( vm::fmt( "unknown device: {}", device ) );
+}
@@ -1,7 +1,9 @@
 #include <iostream>
 #include <string>
+#include <csignal>
 #include <VMUtils/cmdline.hpp>
 #include <varch/archive/archiver.hpp>
+#include "tool_options.hpp"
 
 #ifdef WIN32
 #include <windows.h>
@@ -25,6 +27,15 @@ unsigned long long get_system_memory()
 using namespace std;
 using namespace vol;
 
+/* SIGINT and SIGTERM finish the archive at the next stride, the flag is
+   polled by the progress callback, which runs after every stride */
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void on_interrupt( int )
+{
+	interrupted = 1;
+}
+
 int main( int argc, char **argv )
 {
 	auto system_memory_gb = get_system_memory() / 1024 /*kb*/ / 1024 /*mb*/ / 1024 /*gb*/;
@@ -38,7 +49,27 @@ int main( int argc, char **argv )
 	a.add<int>( "padding", 'p', "block padding", false, 2, cmdline::oneof<int>( 0, 1, 2 ) );
 	a.add<int>( "side", 's', "block size in log(voxel)", false, 6, cmdline::oneof<int>( 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 ) );
 	a.add<string>( "device", 'd', "video compression device: default/cuda/cpu", false, "default", cmdline::oneof<string>( "default", "cuda", "cpu" ) );
+	a.add<string>( "preset", 'P', "encode preset: default/hp/hq", false, "default", cmdline::oneof<string>( "default", "hp", "hq" ) );
+	a.add<int>( "width", 'W', "frame width", false, 1024 );
+	a.add<int>( "height", 'H', "frame height", false, 1024 );
+	a.add<int>( "batch-frames", 'B', "frames encoded per batch", false, 16 );
+	a.add<int>( "io-threads", 'j', "threads reading the input concurrently", false, 1, cmdline::range( 1, 256 ) );
 	a.add<string>( "of", 'o', "output filename", true );
+	a.add<int>( "slice-begin", 'b', "first block slice (z) to archive", false, 0 );
+	a.add<int>( "slice-end", 'e', "block slice (z) to stop before, -1 for all", false, -1 );
+	a.add<int>( "levels", 'l', "max octree levels of adaptive bricking, 0 for fixed block size", false, 0, cmdline::oneof<int>( 0, 1, 2, 3, 4 ) );
+	a.add<int>( "homogeneity", 't', "max value range of a merged octree node", false, 0 );
+	a.add<int>( "channels", 'c', "channels interleaved in each input voxel", false, 1 );
+	a.add<int>( "max-error", 'E', "store blocks whose max voxel error exceeds this losslessly, -1 to skip", false, -1 );
+	a.add( "residual", 'R', "also store residuals, so that blocks can be refined to exact values" );
+	a.add<string>( "quantize", 'q', "map uint16 input to 8 bits: none/window/equalize", false, "none", cmdline::oneof<string>( "none", "window", "equalize" ) );
+	a.add<int>( "window-lo", '\0', "lower bound of the quantize window, percentiles if not below window-hi", false, 0, cmdline::range( 0, 65535 ) );
+	a.add<int>( "window-hi", '\0', "upper bound of the quantize window", false, 0, cmdline::range( 0, 65535 ) );
+	a.add( "labels", 'L', "input is uint32 segmentation labels, archived losslessly" );
+	a.add<int>( "histogram-bins", '\0', "bins of the coarse histogram stored per block, 0 for none", false, 0 );
+	a.add( "no-block-stats", '\0', "do not store per block min, max and mean" );
+	a.add<int>( "preview-size", '\0', "longest side of the embedded preview volume, 0 for none", false, 128 );
+	a.add<int>( "frame-alignment", '\0', "start every frame at a multiple of this many bytes, e.g. 4096 for direct reads", false, 0 );
 
 	//cout<<a.usage();
 	a.parse_check( argc, argv );
@@ -51,7 +82,17 @@ int main( int argc, char **argv )
 	auto padding = a.get<int>( "padding" );
 	auto log = a.get<int>( "side" );
 	auto dev = a.get<string>( "device" );
+	auto preset = a.get<string>( "preset" );
 	auto mem = a.get<size_t>( "memlimit" );
+	auto slice_begin = a.get<int>( "slice-begin" );
+	auto slice_end = a.get<int>( "slice-end" );
+	auto levels = a.get<int>( "levels" );
+	auto homogeneity = a.get<int>( "homogeneity" );
+	auto channels = a.get<int>( "channels" );
+	auto max_error = a.get<int>( "max-error" );
+	auto residual = a.exist( "residual" );
+	auto labels = a.exist( "labels" );
+	auto quantize = a.get<string>( "quantize" );
 
 	try {
 		auto opts = ArchiverOptions{}
@@ -61,32 +102,66 @@ int main( int argc, char **argv )
 					  .set_log_block_size( log )
 					  .set_padding( padding )
 					  .set_suggest_mem_gb( mem )
-					  .set_input( input );
+					  .set_io_threads( a.get<int>( "io-threads" ) )
+					  .set_input( input )
+					  .set_slice_begin( slice_begin )
+					  .set_max_block_level( levels )
+					  .set_homogeneity( homogeneity )
+					  .set_encode_method( labels ? EncodeMethod::Label32 : EncodeMethod::H264 )
+					  .set_channels( channels )
+					  .set_max_error( max_error )
+					  .set_residual( residual )
+					  .set_block_stats( not a.exist( "no-block-stats" ) )
+					  .set_histogram_bins( a.get<int>( "histogram-bins" ) )
+					  .set_preview_size( a.get<int>( "preview-size" ) )
+					  .set_frame_alignment( a.get<int>( "frame-alignment" ) );
+		if ( slice_end >= 0 ) {
+			opts.set_slice_end( slice_end );
+		}
+		opts.quantize = QuantizeOptions{}
+						  .set_mode( quantize == "window" ? Quantize::Window : quantize == "equalize" ? Quantize::Equalize : Quantize::None )
+						  .set_window_lo( a.get<int>( "window-lo" ) )
+						  .set_window_hi( a.get<int>( "window-hi" ) );
 
 		auto &compress_opts = opts.compress_opts;
 		compress_opts = EncodeOptions{}
-						  .set_encode_preset( EncodePreset::Default )
-						  .set_width( 1024 )
-						  .set_height( 1024 )
-						  .set_batch_frames( 16 );
-		if ( dev == "cuda" ) {
-			compress_opts.set_device( ComputeDevice::Cuda );
-		} else if ( dev == "cpu" ) {
-			compress_opts.set_device( ComputeDevice::Cpu );
-		} else if ( dev == "default" ) {
-			compress_opts.set_device( ComputeDevice::Default );
-		} else {
-			throw std::logic_error( vm::fmt( "unknown device: {}", dev ) );
-		}
+						  .set_encode_preset( parse_preset( preset ) )
+						  .set_device( parse_device( dev ) )
+						  .set_width( a.get<int>( "width" ) )
+						  .set_height( a.get<int>( "height" ) )
+						  .set_batch_frames( a.get<int>( "batch-frames" ) );
 
 		opts.set_output( vm::fmt( "{}.h264", output ) );
 
+		size_t slices_done = 0;
+		Archiver *running = nullptr;
+		opts.set_on_progress( [&]( ArchiveProgress const &progress ) {
+			vm::println( "{} / {} block(s), {} MB/s, eta {} s",
+						 progress.blocks_done, progress.blocks_total, progress.throughput, progress.eta );
+			slices_done = progress.slices_done;
+			if ( interrupted && running ) {
+				running->cancel();
+			}
+		} );
+
 		{
 			Archiver archiver( opts );
+			running = &archiver;
+			signal( SIGINT, on_interrupt );
+			signal( SIGTERM, on_interrupt );
 
-			archiver.convert();
+			const bool done = archiver.convert();
+			signal( SIGINT, SIG_DFL );
+			signal( SIGTERM, SIG_DFL );
+			running = nullptr;
 
-			vm::println( "written to {}", output );
+			if ( done ) {
+				vm::println( "written to {}", output );
+			} else {
+				vm::eprintln( "cancelled, {} holds block slices [{}, {}), resume with -b {}",
+							  output, slice_begin, slices_done, slices_done );
+				return 1;
+			}
 		}
 	} catch ( exception &e ) {
 		vm::eprintln( "{}", e.what() );
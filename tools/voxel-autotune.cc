@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <algorithm>
+#include "cxxopts.hpp"
+#include "tool_options.hpp"
+#include <VMUtils/fmt.hpp>
+#include <VMat/geometry.h>
+#include <VMFoundation/rawreader.h>
+#include <varch/archive/archiver.hpp>
+#include <varch/unarchive/unarchiver.hpp>
+#include <varch/utils/unbounded_vector_writer.hpp>
+
+using namespace vm;
+using namespace std;
+using namespace vol;
+
+struct Trial
+{
+	string device, preset;
+	int side, frame, batch;
+	double encode_mbps = 0, ratio = 0, decode_ms = 0, score = 0;
+};
+
+static double seconds_since( chrono::steady_clock::time_point const &t0 )
+{
+	return chrono::duration<double>( chrono::steady_clock::now() - t0 ).count();
+}
+
+/* encodes the sampled bricks as a sparse archive on a 1d grid, then
+   decodes every brick once in random access order */
+static void run_trial( Trial &trial, vector<vector<char>> const &bricks, int padding )
+{
+	const int N = 1 << trial.side;
+	const int inner = N - 2 * padding;
+	auto opts = ArchiverOptions{}
+				  .set_x( inner * bricks.size() )
+				  .set_y( inner )
+				  .set_z( inner )
+				  .set_log_block_size( trial.side )
+				  .set_padding( padding );
+	opts.compress_opts
+	  .set_device( parse_device( trial.device ) )
+	  .set_encode_preset( parse_preset( trial.preset ) )
+	  .set_width( trial.frame )
+	  .set_height( trial.frame )
+	  .set_batch_frames( trial.batch );
+
+	vector<char> archive;
+	const double raw_bytes = double( bricks.size() ) * N * N * N;
+	{
+		UnboundedVectorWriter writer( archive );
+		Archiver archiver( opts, writer );
+		/* encoder setup differs by preset and device, only encoding is timed */
+		const auto t0 = chrono::steady_clock::now();
+		uint32_t i = 0;
+		archiver.convert_sparse( [&]( Idx &idx, vm::Arc<Reader> &brick ) {
+			if ( i == bricks.size() ) return false;
+			idx = Idx{}.set_x( i );
+			brick.reset( new SliceReader( bricks[ i ].data(), bricks[ i ].size() ) );
+			return ++i, true;
+		} );
+		trial.encode_mbps = raw_bytes / ( 1 << 20 ) / seconds_since( t0 );
+	}
+	trial.ratio = raw_bytes / archive.size();
+
+	SliceReader reader( archive.data(), archive.size() );
+	Unarchiver unarchiver( reader, DecodeOptions{}.set_device( opts.compress_opts.device ) );
+	vector<unsigned char> buffer( N * N * N );
+	vector<uint32_t> order( bricks.size() );
+	std::iota( order.begin(), order.end(), 0 );
+	std::shuffle( order.begin(), order.end(), std::mt19937( 0 ) );
+	const auto t0 = chrono::steady_clock::now();
+	for ( auto i : order ) {
+		unarchiver.unarchive_to( Idx{}.set_x( i ), buffer );
+	}
+	trial.decode_ms = seconds_since( t0 ) * 1e3 / bricks.size();
+}
+
+int main( int argc, char **argv )
+{
+	cxxopts::Options options( "voxel-autotune", "Trial-encode sampled blocks to recommend archive parameters" );
+	options.add_options()(
+	  "i,input", ".raw input filename", cxxopts::value<string>() )(
+	  "x", "raw.x", cxxopts::value<int>() )(
+	  "y", "raw.y", cxxopts::value<int>() )(
+	  "z", "raw.z", cxxopts::value<int>() )(
+	  "p,padding", "block padding", cxxopts::value<int>()->default_value( "2" ) )(
+	  "n,samples", "sampled blocks, as 64^3 blocks of equal volume", cxxopts::value<int>()->default_value( "256" ) )(
+	  "s,sides", "block sizes in log(voxel) to try", cxxopts::value<vector<int>>()->default_value( "5,6,7" ) )(
+	  "f,frames", "square frame sizes to try", cxxopts::value<vector<int>>()->default_value( "512,1024,2048" ) )(
+	  "b,batches", "batch_frames to try", cxxopts::value<vector<int>>()->default_value( "4,16,64" ) )(
+	  "P,presets", "encode presets to try: default/hp/hq", cxxopts::value<vector<string>>()->default_value( "default,hp,hq" ) )(
+	  "d,devices", "devices to try: cuda/cpu, unavailable ones are skipped", cxxopts::value<vector<string>>()->default_value( "cuda,cpu" ) )(
+	  "O,objective", "ratio/encode/decode/balanced", cxxopts::value<string>()->default_value( "balanced" ) )(
+	  "seed", "sampling seed", cxxopts::value<unsigned>()->default_value( "0" ) )(
+	  "h,help", "print this help message" );
+
+	auto opts = options.parse( argc, argv );
+	if ( opts.count( "h" ) || !opts.count( "i" ) || !opts.count( "x" ) || !opts.count( "y" ) || !opts.count( "z" ) ) {
+		vm::println( "{}", options.help() );
+		return 0;
+	}
+
+	try {
+		const auto input = opts[ "i" ].as<string>();
+		const Size3 raw( opts[ "x" ].as<int>(), opts[ "y" ].as<int>(), opts[ "z" ].as<int>() );
+		const auto padding = opts[ "p" ].as<int>();
+		const auto samples = opts[ "n" ].as<int>();
+		const auto objective = opts[ "O" ].as<string>();
+		if ( objective != "ratio" && objective != "encode" && objective != "decode" && objective != "balanced" ) {
+			throw std::logic_error( vm::fmt( "unknown objective: {}", objective ) );
+		}
+
+		RawReaderIO raw_input( input, raw, sizeof( char ) );
+		std::mt19937 rng( opts[ "seed" ].as<unsigned>() );
+		vector<Trial> trials;
+
+		for ( auto side : opts[ "s" ].as<vector<int>>() ) {
+			const int N = 1 << side;
+			if ( N > raw.x || N > raw.y || N > raw.z || N <= 2 * padding ) {
+				vm::eprintln( "skipped block size {}: larger than the volume", N );
+				continue;
+			}
+			/* the same sampled volume for every block size */
+			const auto nblocks = std::max( 8, int( samples * ( 64.0 * 64 * 64 ) / ( double( N ) * N * N ) ) );
+			vector<vector<char>> bricks( nblocks, vector<char>( N * N * N ) );
+			for ( auto &brick : bricks ) {
+				const Vec3i start( rng() % ( raw.x - N + 1 ), rng() % ( raw.y - N + 1 ), rng() % ( raw.z - N + 1 ) );
+				raw_input.readRegion( start, Size3( N, N, N ), reinterpret_cast<unsigned char *>( brick.data() ) );
+			}
+
+			for ( auto &device : opts[ "d" ].as<vector<string>>() ) {
+				for ( auto &preset : opts[ "P" ].as<vector<string>>() ) {
+					for ( auto frame : opts[ "f" ].as<vector<int>>() ) {
+						for ( auto batch : opts[ "b" ].as<vector<int>>() ) {
+							Trial trial{ device, preset, side, frame, batch };
+							try {
+								run_trial( trial, bricks, padding );
+							} catch ( exception &e ) {
+								vm::eprintln( "skipped {} {} {}x{} batch {}: {}", device, preset, frame, frame, batch, e.what() );
+								continue;
+							}
+							vm::println( "{>6} {>8} side {} frame {>4} batch {>2}: {} MB/s encode, {}x, {} ms/block decode",
+										 device, preset, N, frame, batch, trial.encode_mbps, trial.ratio, trial.decode_ms );
+							trials.emplace_back( trial );
+						}
+					}
+				}
+			}
+		}
+		if ( trials.empty() ) {
+			throw std::runtime_error( "no trial succeeded" );
+		}
+
+		/* every metric normalized to the best trial, balanced weighs them equally */
+		double best_mbps = 0, best_ratio = 0, best_ms = numeric_limits<double>::max();
+		for ( auto &t : trials ) {
+			best_mbps = std::max( best_mbps, t.encode_mbps );
+			best_ratio = std::max( best_ratio, t.ratio );
+			best_ms = std::min( best_ms, t.decode_ms );
+		}
+		for ( auto &t : trials ) {
+			const double enc = t.encode_mbps / best_mbps, ratio = t.ratio / best_ratio, dec = best_ms / t.decode_ms;
+			t.score = objective == "ratio" ? ratio : objective == "encode" ? enc : objective == "decode" ? dec : std::cbrt( enc * ratio * dec );
+		}
+		auto &best = *std::max_element( trials.begin(), trials.end(),
+										[]( Trial const &a, Trial const &b ) { return a.score < b.score; } );
+
+		vm::println( "\nrecommended for objective {}:", objective );
+		vm::println( "  ArchiverOptions: log_block_size = {}, padding = {}", best.side, padding );
+		vm::println( "  EncodeOptions: device = {}, encode_preset = {}, width = {}, height = {}, batch_frames = {}",
+					 best.device, best.preset, best.frame, best.frame, best.batch );
+		vm::println( "  expected: {} MB/s encode, {}x, {} ms/block decode", best.encode_mbps, best.ratio, best.decode_ms );
+		vm::println( "  voxel-archive -i {} -x {} -y {} -z {} -p {} -s {} -d {} --preset {} --width {} --height {} --batch-frames {} -o ...",
+					 input, raw.x, raw.y, raw.z, padding, best.side, best.device, best.preset, best.frame, best.frame, best.batch );
+	} catch ( exception &e ) {
+		vm::eprintln( "{}", e.what() );
+		return 1;
+	}
+}
@@ -0,0 +1,33 @@
+#include "cxxopts.hpp"
+#include <VMUtils/fmt.hpp>
+#include <varch/archive/compactor.hpp>
+
+using namespace std;
+
+int main( int argc, char **argv )
+{
+	cxxopts::Options options( "voxel-compact", "Drop frames of an updated archive that are no longer referenced" );
+	options.add_options()(
+	  "i,input", "updated archive file", cxxopts::value<string>() )(
+	  "o,output", "compacted archive file", cxxopts::value<string>() )(
+	  "h,help", "print this help message" );
+
+	auto opts = options.parse( argc, argv );
+	if ( opts.count( "h" ) || !opts.count( "i" ) || !opts.count( "o" ) ) {
+		vm::println( "{}", options.help() );
+		return 0;
+	}
+
+	try {
+		auto compact_opts = vol::CompactorOptions{}
+							  .set_input( opts[ "i" ].as<string>() )
+							  .set_output( opts[ "o" ].as<string>() );
+		vol::Compactor compactor( compact_opts );
+		compactor.compact();
+
+		vm::println( "written to {}", compact_opts.output );
+	} catch ( exception &e ) {
+		vm::eprintln( "{}", e.what() );
+		return 1;
+	}
+}
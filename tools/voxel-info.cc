@@ -1,8 +1,11 @@
 #include <fstream>
+#include <memory>
 #include "cxxopts.hpp"
 #include <VMUtils/fmt.hpp>
 #include <varch/unarchive/unarchiver.hpp>
 #include <varch/utils/io.hpp>
+#include <varch/utils/mapped_reader.hpp>
+#include <varch/utils/sharded_reader.hpp>
 
 using namespace std;
 
@@ -11,6 +14,7 @@ int main( int argc, char **argv )
 	cxxopts::Options options( "voxel-info", "Print voxel info" );
 	options.add_options()(
 	  "i,input", "input compressed file", cxxopts::value<string>() )(
+	  "verify", "check every frame against its checksum" )(
 	  "h,help", "print this help message" );
 	//   ("l,list", "list indices" );
 
@@ -21,16 +25,62 @@ int main( int argc, char **argv )
 	}
 
 	try {
-		ifstream in( opts[ "i" ].as<string>(), std::ios::ate | std::ios::binary );
-		auto len = in.tellg();
-		vol::StreamReader reader( in, 0, len );
-		vol::Unarchiver e( reader );
+		const auto input = opts[ "i" ].as<string>();
+		std::unique_ptr<vol::Reader> reader;
+		if ( vol::ShardedReader::is_manifest( input ) ) {
+			reader.reset( new vol::ShardedReader( input ) );
+		} else {
+			reader.reset( new vol::MappedReader( input ) );
+		}
+		vol::Unarchiver e( *reader );
 
 		vm::println( "{>16}: {}", "Size", e.raw() );
 		vm::println( "{>16}: {}", "Padded Size", e.adjusted() );
 		vm::println( "{>16}: {}", "Grid Size", e.dim() );
 		vm::println( "{>16}: {} = 2^{}", "Block Size", e.block_size(), e.log_block_size() );
 		vm::println( "{>16}: {}", "Padding", e.padding() );
+		vm::println( "{>16}: {}", "Channels", e.channels() );
+		vm::println( "{>16}: {}", "Encode Method",
+					 e.encode_method() == vol::EncodeMethod::Label32 ? "label32" : "h264" );
+		vm::println( "{>16}: {}", "Frame Codec",
+					 e.codec() == vol::FrameCodec::Palette ? "palette" : "h264" );
+		vm::println( "{>16}: {}", "Frame Packing",
+					 e.packing() == vol::FramePacking::Block ? "block" : "nv12" );
+		if ( e.frame_width() ) {
+			vm::println( "{>16}: {}x{}, {} bytes", "Frame", e.frame_width(), e.frame_height(), e.frame_size() );
+		} else {
+			vm::println( "{>16}: {} bytes", "Frame", e.frame_size() );
+		}
+		vm::println( "{>16}: {}", "Residuals", e.has_residuals() ? "yes" : "no" );
+		if ( e.transfer().empty() ) {
+			vm::println( "{>16}: {}", "Quantized", "no" );
+		} else {
+			vm::println( "{>16}: [{}, {}]", "Quantized", e.transfer().front(), e.transfer().back() );
+		}
+		vm::println( "{>16}: {}", "Checksums", e.has_checksums() ? "crc32c" : "no" );
+		if ( not e.shards().empty() ) {
+			vm::println( "{>16}: {}", "Shards", e.shards().size() );
+		}
+		if ( e.has_block_stats() ) {
+			vm::println( "{>16}: yes, {} histogram bin(s)", "Block Stats", e.histogram_bins() );
+		} else {
+			vm::println( "{>16}: {}", "Block Stats", "no" );
+		}
+		if ( e.has_preview() ) {
+			vm::println( "{>16}: {}, 1/{} of raw", "Preview", e.preview_dim(), e.preview_scale() );
+		} else {
+			vm::println( "{>16}: {}", "Preview", "no" );
+		}
+		if ( opts.count( "verify" ) && e.has_checksums() ) {
+			auto corrupted = e.corrupted_frames();
+			for ( auto frame : corrupted ) {
+				vm::println( "{>16}: {}", "Corrupted Frame", frame );
+			}
+			if ( not corrupted.empty() ) {
+				return 1;
+			}
+			vm::println( "{>16}: {}", "Verified", "ok" );
+		}
 
 	} catch ( exception &e ) {
 		vm::eprintln( "{}", e.what() );
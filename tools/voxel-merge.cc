@@ -0,0 +1,36 @@
+#include "cxxopts.hpp"
+#include <VMUtils/fmt.hpp>
+#include <varch/archive/merger.hpp>
+
+using namespace std;
+
+int main( int argc, char **argv )
+{
+	cxxopts::Options options( "voxel-merge", "Merge archives of disjoint slice ranges into one archive" );
+	options.add_options()(
+	  "i,input", "partial archive files, in slice order", cxxopts::value<vector<string>>() )(
+	  "o,output", "merged archive file", cxxopts::value<string>() )(
+	  "m,manifest", "write a manifest that keeps the inputs as shards instead of copying them" )(
+	  "h,help", "print this help message" );
+	options.parse_positional( "input" );
+
+	auto opts = options.parse( argc, argv );
+	if ( opts.count( "h" ) || !opts.count( "i" ) || !opts.count( "o" ) ) {
+		vm::println( "{}", options.help() );
+		return 0;
+	}
+
+	try {
+		auto merge_opts = vol::MergerOptions{}
+							.set_inputs( opts[ "i" ].as<vector<string>>() )
+							.set_output( opts[ "o" ].as<string>() )
+							.set_manifest( opts.count( "m" ) > 0 );
+		vol::Merger merger( merge_opts );
+		merger.merge();
+
+		vm::println( "written to {}", merge_opts.output );
+	} catch ( exception &e ) {
+		vm::eprintln( "{}", e.what() );
+		return 1;
+	}
+}
@@ -0,0 +1,60 @@
+#include "cxxopts.hpp"
+#include "tool_options.hpp"
+#include <VMUtils/fmt.hpp>
+#include <varch/archive/transcoder.hpp>
+
+using namespace std;
+using namespace vol;
+
+int main( int argc, char **argv )
+{
+	cxxopts::Options options( "voxel-transcode", "Rearchive an archive with a new block geometry or encoding" );
+	options.add_options()(
+	  "i,input", "input archive file", cxxopts::value<string>() )(
+	  "o,output", "output archive file", cxxopts::value<string>() )(
+	  "s,side", "block size in log(voxel)", cxxopts::value<int>()->default_value( "6" ) )(
+	  "p,padding", "block padding", cxxopts::value<int>()->default_value( "2" ) )(
+	  "d,device", "video compression device: default/cuda/cpu", cxxopts::value<string>()->default_value( "default" ) )(
+	  "m,memlimit", "maximum memory limit of the archiver in gb", cxxopts::value<size_t>()->default_value( "4" ) )(
+	  "P,preset", "encode preset: default/hp/hq/lossless", cxxopts::value<string>()->default_value( "default" ) )(
+	  "E,max-error", "store blocks whose max voxel error exceeds this losslessly, -1 to skip", cxxopts::value<int>()->default_value( "-1" ) )(
+	  "R,residual", "also store residuals, so that blocks can be refined to exact values" )(
+	  "r,refine", "decode exact voxels from an input archive with residuals" )(
+	  "h,help", "print this help message" );
+
+	auto opts = options.parse( argc, argv );
+	if ( opts.count( "h" ) || !opts.count( "i" ) || !opts.count( "o" ) ) {
+		vm::println( "{}", options.help() );
+		return 0;
+	}
+
+	try {
+		auto archive_opts = ArchiverOptions{}
+							  .set_log_block_size( opts[ "s" ].as<int>() )
+							  .set_padding( opts[ "p" ].as<int>() )
+							  .set_suggest_mem_gb( opts[ "m" ].as<size_t>() )
+							  .set_max_error( opts[ "E" ].as<int>() )
+							  .set_residual( opts.count( "R" ) > 0 );
+
+		auto &compress_opts = archive_opts.compress_opts;
+		compress_opts
+		  .set_batch_frames( 16 )
+		  .set_device( parse_device( opts[ "d" ].as<string>() ) )
+		  .set_encode_preset( parse_preset( opts[ "P" ].as<string>() ) );
+
+		auto transcode_opts = TranscoderOptions{}
+								.set_input( opts[ "i" ].as<string>() )
+								.set_output( opts[ "o" ].as<string>() )
+								.set_archive_opts( archive_opts )
+								.set_decode_opts( DecodeOptions{}
+													.set_device( compress_opts.device )
+													.set_refine( opts.count( "r" ) > 0 ) );
+		Transcoder transcoder( transcode_opts );
+		transcoder.transcode();
+
+		vm::println( "written to {}", transcode_opts.output );
+	} catch ( exception &e ) {
+		vm::eprintln( "{}", e.what() );
+		return 1;
+	}
+}